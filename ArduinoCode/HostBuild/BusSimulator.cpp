@@ -0,0 +1,550 @@
+#include <Arduino.h>
+#include "BusSimulator.h"
+#include "SlaveComms.h"
+#include "Crc16.h"
+
+const unsigned long BIT_TIMES_PER_BYTE = 10;           // start bit + 8 data bits + stop bit
+const unsigned long MIN_TURNAROUND_US = 3000UL;        // slave n needs at least 3 + n % 4 ms of turnaround
+const unsigned long RELAY_SLOW_STEP_US = 100000UL;     // slow mode: sendrelaysbyte 80 ms + latchrelaysstate 20 ms
+const unsigned long RELAY_FAST_STEP_US = 2000UL;       // fast mode: shiftout + latch
+const byte DEFAULT_RELAYS_AT_ONCE = 1;
+const byte DEFAULT_SETTLE_TICKS = 10;
+const byte MAX_RELAY_BOARDS = 4;
+const unsigned long BUS_SPEED_FALLBACK_US = 20000000UL; // no valid frames for this long at a higher speed: back to base speed
+const unsigned char V1_FRAME_ATTENTION_BYTE = '!';
+const unsigned char V1_REPLY_ATTENTION_BYTE = '$';
+const unsigned char FRAME_ATTENTION_BYTE = '#';
+const unsigned char REPLY_ATTENTION_BYTE = '%';
+const unsigned char REPLAYED_REPLY_ATTENTION_BYTE = '&';
+const int V1_FRAME_BASELEN = 1+1+4;
+const int FRAME_BASELEN = 1+1+4+1;      // version 2: with the sequence number
+const int FRAME_PAYLOADLEN = FRAME_BASELEN + 2;
+const int REPLY_LENGTH = 1 + FRAME_PAYLOADLEN;
+
+struct SimulatedSlave {
+  unsigned char byteid;
+  byte relayBoards;              // RELAY_BOARDS: up to four daisy-chained relay modules of 8 relays
+  unsigned long currentStates;
+  unsigned long targetStates;
+  unsigned long stagedStates;    // commands 113, 114
+  unsigned int stagedTick;
+  bool stagedArmed;
+  bool replyPending;
+  unsigned long replyStartTime;
+  unsigned char reply[REPLY_LENGTH];
+  byte replyLength;
+  unsigned char cachedReply[REPLY_LENGTH];   // the last version 2 reply, and the request it answered
+  byte cachedSequence;
+  unsigned short cachedRequestCrc;
+  unsigned int requestsReplayed;
+  unsigned long replyBaud;       // the reply is sent at this speed
+  unsigned long baud;
+  unsigned long lastFrameTime;   // the last time a valid frame for any slave was heard (for the bus speed fallback)
+  unsigned long busyUntil;       // not listening to the bus until this time
+  unsigned int framesMissed;     // frames which arrived while the slave was busy
+  byte relaysAtOnce;             // command 105 settings
+  byte outputMode;               // command 106
+  byte replyDelayms;             // command 108
+  byte driverSwitchDelayms;
+  unsigned long minTurnaroundus; // replies sent with less turnaround than this arrive corrupted
+  bool replyTooEarly;
+  byte settleTicks;
+  unsigned long nextStepTime;    // the settle time after the last transition step ends at this time
+};
+
+const int MAX_SIMULATED_SLAVES = 16;
+SimulatedSlave simulatedSlaves[MAX_SIMULATED_SLAVES];
+byte simulatedSlaveCount = 0;
+bool simulatorRunning = false;
+BusTransport *transportBeforeSimulation = NULL;
+
+SimulatedBus simulatedBus;
+unsigned long masterBaud = BUS_BASE_BAUD_RATE;
+
+// frame being sent by the master
+unsigned char masterFrame[FRAME_PAYLOADLEN];
+int masterFrameIdx = -1;
+int masterFrameBaseLength;
+unsigned long masterTxEndTime;   // the master's bytes are on the wire until this time
+
+// reply currently being sent by a slave
+int replyingSlave = -1;
+unsigned long replyWireStart;
+unsigned long replyByteTimeus;
+byte replyBytesRead;
+bool replyCorrupted;
+
+unsigned long framesSent = 0;
+unsigned long repliesSent = 0;
+unsigned long collisions = 0;
+
+// loss injection: percentage of the master's frames which the slaves don't receive, and of the replies which are corrupted
+byte requestLossPercent = 0;
+byte replyLossPercent = 0;
+unsigned long lossSeed = 1;
+
+// simulated slave i starts up as the relay module does after a reset
+void resetSimulatedSlave(int i, unsigned char byteid)
+{
+  SimulatedSlave &slave = simulatedSlaves[i];
+  memset(&slave, 0, sizeof(slave));
+  slave.byteid = byteid;
+  slave.relayBoards = MAX_RELAY_BOARDS;
+  slave.baud = BUS_BASE_BAUD_RATE;
+  slave.relaysAtOnce = DEFAULT_RELAYS_AT_ONCE;
+  slave.settleTicks = DEFAULT_SETTLE_TICKS;
+  slave.outputMode = RELAY_OUTPUT_FAST;
+  slave.replyDelayms = DEFAULT_REPLY_DELAY_MS;
+  slave.driverSwitchDelayms = DEFAULT_DRIVER_SWITCH_DELAY_MS;
+  slave.minTurnaroundus = MIN_TURNAROUND_US + (i % 4) * 1000UL;
+}
+
+byte startBusSimulator(byte count, unsigned char firstbyteid)
+{
+  if (count > MAX_SIMULATED_SLAVES) count = MAX_SIMULATED_SLAVES;
+  for (int i = 0; i < count; ++i) {
+    resetSimulatedSlave(i, firstbyteid + i);
+  }
+  simulatedSlaveCount = count;
+  masterFrameIdx = -1;
+  replyingSlave = -1;
+  framesSent = 0;
+  repliesSent = 0;
+  collisions = 0;
+  if (!simulatorRunning) {
+    transportBeforeSimulation = getBusTransport();
+  }
+  simulatorRunning = true;
+  setBusTransport(&simulatedBus);
+  return count;
+}
+
+void stopBusSimulator()
+{
+  if (!simulatorRunning) return;
+  simulatorRunning = false;
+  simulatedSlaveCount = 0;
+  setBusTransport(transportBeforeSimulation);
+}
+
+bool addSimulatedSlave(unsigned char byteid)
+{
+  if (!simulatorRunning || simulatedSlaveCount >= MAX_SIMULATED_SLAVES) return false;
+  resetSimulatedSlave(simulatedSlaveCount, byteid);
+  ++simulatedSlaveCount;
+  return true;
+}
+
+bool setSimulatedRelayBoards(unsigned char byteid, byte boards)
+{
+  if (boards < 1 || boards > MAX_RELAY_BOARDS) return false;
+  bool found = false;
+  for (int i = 0; i < simulatedSlaveCount; ++i) {
+    if (simulatedSlaves[i].byteid == byteid) {
+      simulatedSlaves[i].relayBoards = boards;
+      found = true;
+    }
+  }
+  return found;
+}
+
+void setSimulatedLoss(byte requestPercent, byte replyPercent)
+{
+  requestLossPercent = requestPercent > 100 ? 100 : requestPercent;
+  replyLossPercent = replyPercent > 100 ? 100 : replyPercent;
+}
+
+// true with the given percentage chance
+bool simulatedLoss(byte percent)
+{
+  if (percent == 0) return false;
+  lossSeed = lossSeed * 1103515245UL + 12345;
+  return (lossSeed >> 16) % 100 < percent;
+}
+
+bool busSimulatorRunning()
+{
+  return simulatorRunning;
+}
+
+void SimulatedBus::begin(unsigned long baud)
+{
+  masterBaud = baud;
+}
+
+unsigned long byteTimeus(unsigned long baud)
+{
+  return BIT_TIMES_PER_BYTE * 1000000UL / baud;
+}
+
+// the relay states which the slave can hold: the relays of modules which aren't fitted are 0, as settarget stores them
+unsigned long fittedStates(const SimulatedSlave &slave, unsigned long states)
+{
+  return (slave.relayBoards >= MAX_RELAY_BOARDS) ? states : states & ((1UL << (8 * slave.relayBoards)) - 1);
+}
+
+// a new target for the relays: the transition starts straight away unless the last step is still settling
+void setTargetStates(SimulatedSlave &slave, unsigned long targetStates, unsigned long frametime)
+{
+  slave.targetStates = fittedStates(slave, targetStates);
+  if ((long)(frametime - slave.nextStepTime) > 0) slave.nextStepTime = frametime;
+}
+
+unsigned long relayStepus(const SimulatedSlave &slave)
+{
+  return (slave.outputMode == RELAY_OUTPUT_FAST) ? RELAY_FAST_STEP_US : RELAY_SLOW_STEP_US;
+}
+
+// the dword parameter of a frame (byte 0 = bits 0-7)
+unsigned long frameDword(const unsigned char frame[])
+{
+  return frame[2] | ((unsigned long)frame[3] << 8) | ((unsigned long)frame[4] << 16) | ((unsigned long)frame[5] << 24);
+}
+
+void putReplyDword(unsigned char reply[], unsigned long dword)
+{
+  for (int i = 0; i < 4; ++i) {
+    reply[3 + i] = (dword >> (8 * i)) & 0xff;
+  }
+}
+
+bool validRelayTransition(const unsigned char frame[])
+{
+  return frame[2] >= 1 && frame[2] <= MAX_RELAYS_AT_ONCE && frame[3] >= 1;
+}
+
+// the bus tick parameter of a time beacon or arm command (bytes 0, 1)
+unsigned int frameTick(const unsigned char frame[])
+{
+  return frame[2] | ((unsigned int)frame[3] << 8);
+}
+
+// a time beacon: the staged states are applied if armed for this tick or an earlier one
+void receiveTimeBeacon(SimulatedSlave &slave, unsigned int tick, unsigned long frametime)
+{
+  if (!slave.stagedArmed || (int16_t)(uint16_t)(tick - slave.stagedTick) < 0) return;
+  slave.stagedArmed = false;
+  setTargetStates(slave, slave.stagedStates, frametime);
+}
+
+// the slave has received a complete frame with a valid CRC, at time frametime.  baselength = the length of the frame
+//   without its CRC, which gives the version
+void slaveReceiveFrame(SimulatedSlave &slave, const unsigned char frame[], int baselength, unsigned long frametime)
+{
+  unsigned char byteid = frame[0];
+  unsigned char bytecommand = frame[1];
+  unsigned char multicastOffset = slave.byteid - byteid;
+  bool busy = ((long)(frametime - slave.busyUntil) < 0);
+  if (!busy) slave.lastFrameTime = frametime;   // any valid frame shows the bus is working at this speed
+  if (bytecommand == COMMAND_MULTICAST_OUTPUT) {
+    if (multicastOffset >= MULTICAST_GROUP_SIZE) return;
+  } else if (byteid != slave.byteid && byteid != BROADCAST_BYTEID) {
+    return;
+  }
+  if (busy) {
+    ++slave.framesMissed;
+    return;
+  }
+
+  if (byteid == BROADCAST_BYTEID || bytecommand == COMMAND_MULTICAST_OUTPUT) {
+    if (bytecommand == COMMAND_CHANGE_OUTPUT) {
+      setTargetStates(slave, frameDword(frame), frametime);
+    } else if (isRelayMaskCommand(bytecommand)) {
+      setTargetStates(slave, applyRelayMask(bytecommand, slave.targetStates, frameDword(frame)), frametime);
+    } else if (bytecommand == COMMAND_MULTICAST_OUTPUT) {
+      setTargetStates(slave, (slave.targetStates & ~0xFFUL) | frame[2 + multicastOffset], frametime);
+    } else if (bytecommand == COMMAND_TIME_BEACON) {
+      receiveTimeBeacon(slave, frameTick(frame), frametime);
+    } else if (bytecommand == COMMAND_STAGE_OUTPUT) {
+      slave.stagedStates = fittedStates(slave, frameDword(frame));
+      slave.stagedArmed = false;
+    } else if (bytecommand == COMMAND_ARM_STAGED_OUTPUT) {
+      slave.stagedTick = frameTick(frame);
+      slave.stagedArmed = true;
+    } else if (bytecommand == COMMAND_SET_BUS_SPEED) {
+      if (frame[2] <= MAX_BUS_SPEED_CODE) slave.baud = BUS_BASE_BAUD_RATE << frame[2];
+    } else if (bytecommand == COMMAND_SET_RELAY_TRANSITION) {
+      if (validRelayTransition(frame)) {
+        slave.relaysAtOnce = frame[2];
+        slave.settleTicks = frame[3];
+      }
+    } else if (bytecommand == COMMAND_SET_RELAY_OUTPUT_MODE) {
+      if (frame[2] <= RELAY_OUTPUT_FAST) slave.outputMode = frame[2];
+    } else if (bytecommand == COMMAND_SET_TURNAROUND) {
+      if (frame[3] <= MAX_DRIVER_SWITCH_DELAY_MS) {
+        slave.replyDelayms = frame[2];
+        slave.driverSwitchDelayms = frame[3];
+      }
+    }
+    return;
+  }
+
+  bool version2 = (baselength == FRAME_BASELEN);
+  unsigned short requestCrc = frame[baselength] | ((unsigned short)frame[baselength + 1] << 8);
+  unsigned long benchus = 0;
+  unsigned char *reply = slave.reply;
+  slave.replyBaud = slave.baud;
+  slave.replyLength = 1 + baselength + 2;
+  bool replayed = version2 && frame[FRAME_BASELEN - 1] != NO_SEQUENCE
+                  && frame[FRAME_BASELEN - 1] == slave.cachedSequence && requestCrc == slave.cachedRequestCrc;
+  if (replayed) {
+    ++slave.requestsReplayed;
+    memcpy(reply, slave.cachedReply, REPLY_LENGTH);
+    reply[0] = REPLAYED_REPLY_ATTENTION_BYTE;
+    bytecommand = 0;   // don't act on the request again
+  } else {
+    reply[0] = version2 ? REPLY_ATTENTION_BYTE : V1_REPLY_ATTENTION_BYTE;
+    memcpy(reply + 1, frame, baselength);
+  }
+  switch (bytecommand) {
+    case 0: {
+      break;   // replayed
+    }
+    case COMMAND_ALIVE: {
+      reply[3] = 0;
+      reply[4] = 0;
+      reply[5] = 0;
+      reply[6] = 0;
+      break;
+    }
+    case COMMAND_CURRENT_OUTPUT: {
+      if (frame[2] == OUTPUT_CURRENT_STATES) {
+        putReplyDword(reply, slave.currentStates);
+      } else if (frame[2] == OUTPUT_TARGET_STATES) {
+        putReplyDword(reply, slave.targetStates);
+      } else if (frame[2] == OUTPUT_STAGED_STATES) {
+        putReplyDword(reply, slave.stagedStates);
+      } else {
+        reply[2] = COMMAND_INVALID_REPLY;
+      }
+      break;
+    }
+    case COMMAND_CHANGE_OUTPUT: {
+      putReplyDword(reply, fittedStates(slave, frameDword(frame)));
+      break;
+    }
+    case COMMAND_SET_RELAYS:
+    case COMMAND_CLEAR_RELAYS:
+    case COMMAND_TOGGLE_RELAYS: {
+      setTargetStates(slave, applyRelayMask(bytecommand, slave.targetStates, frameDword(frame)), frametime);
+      putReplyDword(reply, slave.targetStates);
+      break;
+    }
+    case COMMAND_STAGE_OUTPUT: {
+      slave.stagedStates = fittedStates(slave, frameDword(frame));
+      slave.stagedArmed = false;
+      putReplyDword(reply, slave.stagedStates);
+      break;
+    }
+    case COMMAND_ARM_STAGED_OUTPUT: {
+      slave.stagedTick = frameTick(frame);
+      slave.stagedArmed = true;
+      break;
+    }
+    case COMMAND_SET_BUS_SPEED: {
+      if (frame[2] > MAX_BUS_SPEED_CODE) {
+        reply[2] = COMMAND_INVALID_REPLY;
+      } else {
+        slave.baud = BUS_BASE_BAUD_RATE << frame[2];  // the reply still goes at the old speed
+      }
+      break;
+    }
+    case COMMAND_SET_RELAY_TRANSITION: {
+      if (!validRelayTransition(frame)) {
+        reply[2] = COMMAND_INVALID_REPLY;
+      } else {
+        slave.relaysAtOnce = frame[2];
+        slave.settleTicks = frame[3];
+      }
+      break;
+    }
+    case COMMAND_SET_RELAY_OUTPUT_MODE: {
+      if (frame[2] > RELAY_OUTPUT_FAST) {
+        reply[2] = COMMAND_INVALID_REPLY;
+      } else {
+        slave.outputMode = frame[2];
+      }
+      break;
+    }
+    case COMMAND_RELAY_BENCH: {
+      if (slave.currentStates != 0 || slave.targetStates != 0 || frame[2] == 0 || frame[2] > MAX_RELAY_BENCH_REPETITIONS) {
+        reply[2] = COMMAND_INVALID_REPLY;
+      } else {
+        reply[4] = slave.outputMode;
+        reply[5] = 0;
+        reply[6] = 0;
+        benchus = frame[2] * relayStepus(slave);
+      }
+      break;
+    }
+    case COMMAND_SET_TURNAROUND: {
+      if (frame[3] > MAX_DRIVER_SWITCH_DELAY_MS) {
+        reply[2] = COMMAND_INVALID_REPLY;
+      }
+      break;
+    }
+    default: {
+      reply[2] = COMMAND_INVALID_REPLY;
+      break;
+    }
+  }
+  if (!replayed) {
+    unsigned short checksum = crc16(reply + 1, baselength);
+    reply[1 + baselength] = checksum & 0xff;
+    reply[2 + baselength] = (checksum >> 8) & 0xff;
+  }
+  if (version2 && !replayed && frame[FRAME_BASELEN - 1] != NO_SEQUENCE) {
+    memcpy(slave.cachedReply, reply, REPLY_LENGTH);
+    slave.cachedSequence = frame[FRAME_BASELEN - 1];
+    slave.cachedRequestCrc = requestCrc;
+  }
+
+  slave.replyPending = true;
+  unsigned long replyDelayus = slave.replyDelayms * 1000UL;
+  unsigned long driverSwitchus = slave.driverSwitchDelayms * 1000UL;
+  slave.replyTooEarly = (replyDelayus + driverSwitchus < slave.minTurnaroundus);
+  slave.replyStartTime = frametime + replyDelayus + benchus + driverSwitchus;
+  slave.busyUntil = slave.replyStartTime + slave.replyLength * byteTimeus(slave.replyBaud) + driverSwitchus;
+  if (bytecommand == COMMAND_SET_TURNAROUND && reply[2] == COMMAND_SET_TURNAROUND) {
+    slave.replyDelayms = frame[2];   // the reply still goes with the old settings
+    slave.driverSwitchDelayms = frame[3];
+  }
+  if (bytecommand == COMMAND_CHANGE_OUTPUT) {
+    setTargetStates(slave, frameDword(frame), frametime);
+  }
+}
+
+// advance the simulation to the current time
+void updateSimulatedBus()
+{
+  unsigned long timenow = micros();
+  for (int i = 0; i < simulatedSlaveCount; ++i) {
+    SimulatedSlave &slave = simulatedSlaves[i];
+
+    if (slave.baud != BUS_BASE_BAUD_RATE && (long)(timenow - slave.lastFrameTime) > (long)BUS_SPEED_FALLBACK_US) {
+      slave.baud = BUS_BASE_BAUD_RATE;
+    }
+
+    // transitionstep switches up to relaysAtOnce relays (highest bit first), once the slave is free and the last step has settled
+    while (slave.currentStates != slave.targetStates) {
+      unsigned long stepTime = slave.nextStepTime;
+      if ((long)(slave.busyUntil - stepTime) > 0) stepTime = slave.busyUntil;
+      if ((long)(timenow - stepTime) < 0) break;
+      unsigned long changes = slave.currentStates ^ slave.targetStates;
+      byte relaysLeft = slave.relaysAtOnce;
+      for (unsigned long bitmask = 0x80000000UL; bitmask != 0 && relaysLeft > 0; bitmask >>= 1) {
+        if (changes & bitmask) {
+          slave.currentStates ^= bitmask;
+          --relaysLeft;
+        }
+      }
+      slave.busyUntil = stepTime + relayStepus(slave);
+      slave.nextStepTime = slave.busyUntil + slave.settleTicks * RELAY_SETTLE_TICK_MS * 1000UL;
+    }
+
+    if (slave.replyPending && (long)(timenow - slave.replyStartTime) >= 0) {
+      slave.replyPending = false;
+      ++repliesSent;
+      if (replyingSlave >= 0 || (long)(slave.replyStartTime - masterTxEndTime) < 0) {
+        ++collisions;
+        replyCorrupted = true;
+      } else {
+        replyingSlave = i;
+        replyWireStart = slave.replyStartTime;
+        replyByteTimeus = byteTimeus(slave.replyBaud);
+        replyBytesRead = 0;
+        replyCorrupted = (slave.replyBaud != masterBaud) || slave.replyTooEarly || simulatedLoss(replyLossPercent);
+      }
+    }
+  }
+}
+
+// number of bytes of the current reply which have arrived at the master by now
+byte replyBytesArrived()
+{
+  if (replyingSlave < 0) return 0;
+  byte length = simulatedSlaves[replyingSlave].replyLength;
+  unsigned long bytes = (micros() - replyWireStart) / replyByteTimeus;
+  return bytes > length ? length : bytes;
+}
+
+int SimulatedBus::available()
+{
+  updateSimulatedBus();
+  if (replyingSlave < 0) return 0;
+  return replyBytesArrived() - replyBytesRead;
+}
+
+int SimulatedBus::read()
+{
+  if (available() <= 0) return -1;
+  unsigned char c = simulatedSlaves[replyingSlave].reply[replyBytesRead];
+  if (replyCorrupted) c ^= 0x55;
+  if (++replyBytesRead >= simulatedSlaves[replyingSlave].replyLength) {
+    replyingSlave = -1;
+  }
+  return c;
+}
+
+// the master's bytes arrive at the slaves one byte time after each other; a complete frame is handed to each slave
+void masterByteSent(unsigned char c)
+{
+  unsigned long timenow = micros();
+  if ((long)(timenow - masterTxEndTime) > 0) masterTxEndTime = timenow;
+  masterTxEndTime += byteTimeus(masterBaud);
+  if (replyingSlave >= 0) {
+    ++collisions;
+    replyCorrupted = true;
+  }
+
+  if ((c == FRAME_ATTENTION_BYTE || c == V1_FRAME_ATTENTION_BYTE) && masterFrameIdx < 0) {
+    masterFrameIdx = 0;
+    masterFrameBaseLength = (c == FRAME_ATTENTION_BYTE) ? FRAME_BASELEN : V1_FRAME_BASELEN;
+    return;
+  }
+  if (masterFrameIdx < 0) return;
+  masterFrame[masterFrameIdx++] = c;
+  if (masterFrameIdx < masterFrameBaseLength + 2) return;
+
+  masterFrameIdx = -1;
+  ++framesSent;
+  unsigned short checksum = crc16(masterFrame, masterFrameBaseLength);
+  if (masterFrame[masterFrameBaseLength] != (checksum & 0xff) || masterFrame[masterFrameBaseLength+1] != ((checksum >> 8) & 0xff)) return;
+  if (simulatedLoss(requestLossPercent)) return;
+  for (int i = 0; i < simulatedSlaveCount; ++i) {
+    if (simulatedSlaves[i].baud != masterBaud) continue;  // the slave sees garbage
+    slaveReceiveFrame(simulatedSlaves[i], masterFrame, masterFrameBaseLength, masterTxEndTime);
+  }
+}
+
+bool SimulatedBus::sendFrame(const unsigned char frame[], byte length)
+{
+  for (int i = 0; i < length; ++i) {
+    masterByteSent(frame[i]);
+  }
+  return true;
+}
+
+void printBusSimulatorStats(Print &dest)
+{
+  if (!simulatorRunning) {
+    dest.println("bus simulator not running");
+    return;
+  }
+  dest.print("simulated frames sent:"); dest.println(framesSent);
+  dest.print("simulated replies:"); dest.println(repliesSent);
+  dest.print("simulated collisions:"); dest.println(collisions);
+  dest.print("simulated loss(%) requests:"); dest.print(requestLossPercent);
+  dest.print(" replies:"); dest.println(replyLossPercent);
+  dest.println("id current target missed replayed baud turnaround(ms)");
+  for (int i = 0; i < simulatedSlaveCount; ++i) {
+    SimulatedSlave &slave = simulatedSlaves[i];
+    dest.print(slave.byteid, HEX); dest.print(" ");
+    dest.print(slave.currentStates, HEX); dest.print(" ");
+    dest.print(slave.targetStates, HEX); dest.print(" ");
+    dest.print(slave.framesMissed); dest.print(" ");
+    dest.print(slave.requestsReplayed); dest.print(" ");
+    dest.print(slave.baud); dest.print(" ");
+    dest.print(slave.replyDelayms); dest.print("+"); dest.println(slave.driverSwitchDelayms);
+  }
+}
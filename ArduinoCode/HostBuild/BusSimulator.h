@@ -0,0 +1,58 @@
+#ifndef BUSSIMULATOR_H
+#define BUSSIMULATOR_H
+#include <Arduino.h>
+#include "BusTransport.h"
+
+// A simulated half-duplex RS485 bus with emulated relay modules, which behave like RelayControlModule.bas with
+//   RELAY_BOARDS = 4 (32 relays) unless set otherwise:
+//  - the relays of modules which aren't fitted stay 0, and the replies to 102 and 113 give the states as stored
+//  - the slave waits 100 ms after a frame before replying, plus 5 ms either side for switching its RS485 driver
+//    (adjustable with command 108).  Slave n needs a total turnaround of at least 3 + n % 4 ms, or its replies are corrupted
+//  - it ignores the bus while it is replying and while it is shifting out and latching a step of a relay transition
+//    (2 ms, or 100 ms in slow output mode - see command 106); the relays change in steps of up to 1 relay (see command
+//    105) with a settle time (500 ms) after each step
+//  - broadcast and multicast frames are acted on without replying
+//  - a repeated request (same sequence number and CRC as the last one) gets the last reply again, without being acted on
+//  - staged target states (command 113) are applied by the first time beacon (112) at or after the tick they are armed for
+// The master's frames and the slaves' replies take the same time as they would on the wire at the bus baud rate; if two
+//   slaves reply at the same time, the replies collide and arrive corrupted.  A slave only understands frames sent at
+//   its own speed (see command 104), and falls back to the base speed if it sees no valid frames (for any
+//   slave) for 20 seconds.
+// Used in place of the real bus (see setBusTransport), to test the master's protocol handling and to measure bus
+//   throughput and latency with many slaves, without any hardware.
+// Part of the host build only (the emulated slaves take too much of the Arduino's SRAM): the sketch's !h commands
+//   are compiled in when RS485_HOST_BUILD is defined.
+
+class SimulatedBus : public BusTransport {
+public:
+  virtual void begin(unsigned long baud);
+  virtual const __FlashStringHelper *name() { return F("simulated"); }
+  virtual int available();
+  virtual int read();
+  virtual bool sendFrame(const unsigned char frame[], byte length);
+};
+
+extern SimulatedBus simulatedBus;
+
+// replace the bus with count emulated slaves with byte ids firstbyteid, firstbyteid+1, etc.  stopBusSimulator returns to the real bus.
+// returns the number of slaves actually emulated
+byte startBusSimulator(byte count, unsigned char firstbyteid);
+void stopBusSimulator();
+
+// add one more emulated slave to the running simulation, eg with the same byte id as another one to test duplicate
+//   detection.  returns false if the simulator isn't running or has no room for another slave
+bool addSimulatedSlave(unsigned char byteid);
+bool busSimulatorRunning();
+
+// the number of relay modules (1 - 4) fitted to the emulated slave(s) with this byte id.  returns false if there is no
+//   such slave or boards is out of range
+bool setSimulatedRelayBoards(unsigned char byteid, byte boards);
+
+// lose the given percentage of the master's frames (no slave receives them) and of the slaves' replies (they arrive
+//   corrupted), at random, to test the retries
+void setSimulatedLoss(byte requestPercent, byte replyPercent);
+
+// print statistics for the simulated bus and its slaves
+void printBusSimulatorStats(Print &dest);
+
+#endif
@@ -0,0 +1,254 @@
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <deque>
+#include "HostSupport.h"
+
+// the clock
+static bool clockManual = false;
+static unsigned long long manualClockus = 0;
+
+static unsigned long long realClockus()
+{
+  static unsigned long long startus = 0;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  unsigned long long nowus = now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+  if (startus == 0) startus = nowus;
+  return nowus - startus;
+}
+
+void hostClockManual(bool manual)
+{
+  if (manual && !clockManual) manualClockus = realClockus();
+  clockManual = manual;
+}
+
+void hostClockAdvance(unsigned long us)
+{
+  if (clockManual) {
+    manualClockus += us;
+  } else {
+    usleep(us);
+  }
+}
+
+unsigned long micros()
+{
+  return clockManual ? manualClockus : realClockus();
+}
+
+unsigned long millis()
+{
+  return micros() / 1000;
+}
+
+void delay(unsigned long ms)
+{
+  hostClockAdvance(ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  hostClockAdvance(us);
+}
+
+void hostRunLoop(unsigned long durationms, unsigned long stepus)
+{
+  unsigned long starttime = millis();
+  while (millis() - starttime < durationms) {
+    loop();
+    hostClockAdvance(stepus);
+  }
+}
+
+// pins: nothing is connected
+void pinMode(uint8_t, uint8_t) {}
+void digitalWrite(uint8_t, uint8_t) {}
+int digitalRead(uint8_t) { return LOW; }
+int analogRead(uint8_t) { return 0; }
+void noInterrupts() {}
+void interrupts() {}
+
+// the console
+static std::deque<char> consoleInput;
+static bool consoleReadStdin = false;
+static bool consoleCapture = false;
+static std::string consoleOutput;
+
+void hostConsoleType(const char *text)
+{
+  while (*text) consoleInput.push_back(*text++);
+}
+
+void hostConsoleReadStdin(bool enable)
+{
+  consoleReadStdin = enable;
+}
+
+void hostConsoleCapture(bool capture)
+{
+  consoleCapture = capture;
+}
+
+bool hostConsoleStdinOpen()
+{
+  return consoleReadStdin;
+}
+
+std::string hostConsoleTake()
+{
+  std::string output;
+  output.swap(consoleOutput);
+  return output;
+}
+
+// move whatever has been typed on stdin to the console input, without waiting
+static void pollStdin()
+{
+  if (!consoleReadStdin) return;
+  fd_set readfds;
+  FD_ZERO(&readfds);
+  FD_SET(STDIN_FILENO, &readfds);
+  struct timeval notime = {0, 0};
+  if (select(STDIN_FILENO + 1, &readfds, NULL, NULL, &notime) <= 0) return;
+  char buffer[64];
+  ssize_t count = ::read(STDIN_FILENO, buffer, sizeof(buffer));
+  if (count <= 0) {
+    consoleReadStdin = false;   // end of input
+    return;
+  }
+  consoleInput.insert(consoleInput.end(), buffer, buffer + count);
+}
+
+HardwareSerial Serial;
+
+void HardwareSerial::begin(unsigned long) {}
+void HardwareSerial::end() {}
+
+int HardwareSerial::available()
+{
+  pollStdin();
+  return consoleInput.size();
+}
+
+int HardwareSerial::read()
+{
+  if (available() == 0) return -1;
+  char c = consoleInput.front();
+  consoleInput.pop_front();
+  return (unsigned char)c;
+}
+
+int HardwareSerial::peek()
+{
+  if (available() == 0) return -1;
+  return (unsigned char)consoleInput.front();
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+  if (consoleCapture) {
+    consoleOutput += (char)c;
+  } else {
+    putchar(c);
+  }
+  return 1;
+}
+
+int HardwareSerial::availableForWrite()
+{
+  return 63;
+}
+
+void HardwareSerial::flush()
+{
+  if (!consoleCapture) fflush(stdout);
+}
+
+// Print, as in the Arduino core
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+  size_t count = 0;
+  while (size--) count += write(*buffer++);
+  return count;
+}
+
+static size_t printNumber(Print &dest, unsigned long n, int base)
+{
+  char buffer[8 * sizeof(n) + 1];
+  char *str = &buffer[sizeof(buffer) - 1];
+  *str = '\0';
+  if (base < 2) base = 10;
+  do {
+    char digit = n % base;
+    n /= base;
+    *--str = digit < 10 ? digit + '0' : digit + 'A' - 10;
+  } while (n);
+  return dest.write(str);
+}
+
+size_t Print::print(const __FlashStringHelper *str) { return write(reinterpret_cast<const char *>(str)); }
+size_t Print::print(const char str[]) { return write(str); }
+size_t Print::print(char c) { return write((uint8_t)c); }
+size_t Print::print(unsigned char n, int base) { return printNumber(*this, n, base); }
+size_t Print::print(int n, int base) { return print((long)n, base); }
+size_t Print::print(unsigned int n, int base) { return printNumber(*this, n, base); }
+size_t Print::print(unsigned long n, int base) { return printNumber(*this, n, base); }
+
+// as on the AVR: only base 10 has a sign, the other bases print the 32-bit two's complement
+size_t Print::print(long n, int base)
+{
+  if (base != 10) return printNumber(*this, (uint32_t)n, base);
+  if (n < 0) return write('-') + printNumber(*this, -n, 10);
+  return printNumber(*this, n, 10);
+}
+
+size_t Print::print(double n, int digits)
+{
+  char buffer[40];
+  snprintf(buffer, sizeof(buffer), "%.*f", digits, n);
+  return write(buffer);
+}
+
+size_t Print::println() { return write("\r\n"); }
+size_t Print::println(const __FlashStringHelper *str) { return print(str) + println(); }
+size_t Print::println(const char str[]) { return print(str) + println(); }
+size_t Print::println(char c) { return print(c) + println(); }
+size_t Print::println(unsigned char n, int base) { return print(n, base) + println(); }
+size_t Print::println(int n, int base) { return print(n, base) + println(); }
+size_t Print::println(unsigned int n, int base) { return print(n, base) + println(); }
+size_t Print::println(long n, int base) { return print(n, base) + println(); }
+size_t Print::println(unsigned long n, int base) { return print(n, base) + println(); }
+size_t Print::println(double n, int digits) { return print(n, digits) + println(); }
+
+// the EEPROM
+static uint8_t eepromContents[E2END + 1];
+static bool eepromErased = false;
+
+uint8_t EEPROMClass::read(int address)
+{
+  if (!eepromErased) {
+    memset(eepromContents, 0xFF, sizeof(eepromContents));
+    eepromErased = true;
+  }
+  if (address < 0 || address > E2END) return 0xFF;
+  return eepromContents[address];
+}
+
+void EEPROMClass::write(int address, uint8_t value)
+{
+  read(address);
+  if (address < 0 || address > E2END) return;
+  eepromContents[address] = value;
+}
+
+void EEPROMClass::update(int address, uint8_t value)
+{
+  write(address, value);
+}
+
+EEPROMClass EEPROM;
@@ -0,0 +1,20 @@
+#include <Arduino.h>
+#include "HostSupport.h"
+
+// The master on the host, with the console on stdin and stdout.  There is no bus until the simulator is started
+//   (!h {count} {firstByteID}).  At the end of the input (eg commands piped in), it runs for a few more seconds so
+//   that their results are shown, and stops.
+const unsigned long RUN_ON_AFTER_INPUT_MS = 3000;
+
+int main()
+{
+  hostConsoleReadStdin(true);
+  setup();
+  while (hostConsoleStdinOpen()) {
+    loop();
+    hostClockAdvance(100);
+  }
+  hostRunLoop(RUN_ON_AFTER_INPUT_MS);
+  Serial.flush();
+  return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef HOSTSUPPORT_H
+#define HOSTSUPPORT_H
+#include <Arduino.h>
+#include <string>
+
+// Host build: control of the shimmed Arduino core (see shims/Arduino.h), for the host main and the tests.
+
+// the sketch's setup() and loop() (RS485tester.ino, compiled as C++)
+void setup();
+void loop();
+
+// The clock (millis and micros) follows the real time, unless it is stepped manually: then it only moves when
+//   advanced, so that the tests run the same every time and as fast as the host can go
+void hostClockManual(bool manual);
+void hostClockAdvance(unsigned long us);
+
+// run loop() until the clock has moved on by durationms, advancing the clock by stepus each time round (a real clock
+//   by sleeping)
+void hostRunLoop(unsigned long durationms, unsigned long stepus = 100);
+
+// The console: input is read from stdin and can be added by hostConsoleType; output goes to stdout, unless it is
+//   being captured (then it is only kept, until hostConsoleTake)
+void hostConsoleType(const char *text);
+void hostConsoleReadStdin(bool enable);
+bool hostConsoleStdinOpen();   // false once the end of stdin has been reached
+void hostConsoleCapture(bool capture);
+std::string hostConsoleTake();
+
+#endif
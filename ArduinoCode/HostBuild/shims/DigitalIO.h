@@ -0,0 +1,20 @@
+#ifndef DIGITALIO_H
+#define DIGITALIO_H
+// Host build: pins which remember what was written to them
+#include <Arduino.h>
+
+template<uint8_t PinNumber>
+class DigitalPin {
+public:
+  DigitalPin() : level(false) {}
+  void mode(uint8_t) {}
+  void write(bool value) { level = value; }
+  bool read() { return level; }
+  void high() { level = true; }
+  void low() { level = false; }
+  void toggle() { level = !level; }
+private:
+  bool level;
+};
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef EEPROM_H
+#define EEPROM_H
+// Host build: the EEPROM is held in memory, erased (0xFF) at startup
+#include <Arduino.h>
+
+class EEPROMClass {
+public:
+  uint8_t read(int address);
+  void write(int address, uint8_t value);
+  void update(int address, uint8_t value);
+  uint16_t length() { return E2END + 1; }
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
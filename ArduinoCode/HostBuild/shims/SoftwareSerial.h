@@ -0,0 +1,21 @@
+#ifndef SOFTWARESERIAL_H
+#define SOFTWARESERIAL_H
+// Host build: there is no bus wired to the pins.  Everything sent is lost and nothing is received; use the bus
+//   simulator (!h) or the loopback transport (!u l) instead
+#include <Arduino.h>
+
+class SoftwareSerial : public Stream {
+public:
+  SoftwareSerial(uint8_t, uint8_t) {}
+  void begin(long) {}
+  void end() {}
+  bool listen() { return true; }
+  bool overflow() { return false; }
+  virtual int available() { return 0; }
+  virtual int read() { return -1; }
+  virtual int peek() { return -1; }
+  virtual size_t write(uint8_t) { return 1; }
+  using Print::write;
+};
+
+#endif
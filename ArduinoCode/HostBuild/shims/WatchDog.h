@@ -0,0 +1,14 @@
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+// Host build: the watchdog timer interrupt isn't called, so the status LED doesn't flash
+
+enum WatchDogPeriod {OVF_16MS, OVF_32MS, OVF_64MS, OVF_125MS, OVF_250MS, OVF_500MS, OVF_1000MS, OVF_2000MS, OVF_4000MS, OVF_8000MS};
+
+namespace WatchDog {
+  inline void init(void (*)()) {}
+  inline void setPeriod(WatchDogPeriod) {}
+  inline void start() {}
+  inline void stop() {}
+}
+
+#endif
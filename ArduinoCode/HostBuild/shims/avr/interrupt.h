@@ -0,0 +1,9 @@
+#ifndef AVR_INTERRUPT_H
+#define AVR_INTERRUPT_H
+// Host build: there are no interrupts
+
+#define ISR(vector) extern "C" void vector(void)
+#define cli()
+#define sei()
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef AVR_IO_H
+#define AVR_IO_H
+// Host build: no AVR peripherals.  The sketch leaves out the code for the peripherals whose registers aren't defined
+//   (the ADC for the probes, the hardware UART transport)
+
+#ifndef E2END
+#define E2END 4095   // as the Mega (4 KB of EEPROM).  -DE2END=1023 checks the Uno build (see Schedule.h)
+#endif
+
+#endif
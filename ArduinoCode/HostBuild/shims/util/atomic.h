@@ -0,0 +1,9 @@
+#ifndef UTIL_ATOMIC_H
+#define UTIL_ATOMIC_H
+// Host build: there are no interrupts, so every block is atomic
+
+#define ATOMIC_RESTORESTATE 0
+#define ATOMIC_FORCEON 1
+#define ATOMIC_BLOCK(type) for (int atomicBlockOnce = 1; atomicBlockOnce; atomicBlockOnce = 0)
+
+#endif
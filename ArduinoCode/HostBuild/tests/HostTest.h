@@ -0,0 +1,30 @@
+#ifndef HOSTTEST_H
+#define HOSTTEST_H
+#include <stdio.h>
+
+// A minimal check for the host tests: a failed check is reported and counted, and the test carries on.  main returns
+//   HOST_TEST_RESULT, so ctest sees the failure.
+int hostTestFailures = 0;
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+      ++hostTestFailures; \
+    } \
+  } while (0)
+
+#define CHECK_EQUAL(expected, actual) \
+  do { \
+    unsigned long long checkExpected = (expected), checkActual = (actual); \
+    if (checkExpected != checkActual) { \
+      printf("%s:%d: check failed: %s == %s (0x%llX != 0x%llX)\n", __FILE__, __LINE__, #expected, #actual, \
+             checkExpected, checkActual); \
+      ++hostTestFailures; \
+    } \
+  } while (0)
+
+#define HOST_TEST_RESULT (printf(hostTestFailures ? "%d check(s) failed\n" : "passed\n", hostTestFailures), \
+                          hostTestFailures ? 1 : 0)
+
+#endif
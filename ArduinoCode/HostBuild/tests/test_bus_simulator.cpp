@@ -0,0 +1,88 @@
+#include <Arduino.h>
+#include "HostSupport.h"
+#include "HostTest.h"
+#include "SlaveTable.h"
+#include "BusSimulator.h"
+
+// The master polling emulated slaves on the simulated bus: every slave is found and polled without errors, relay
+//   changes reach the slaves and are read back (also from a slave with fewer relay modules fitted), and the retries get
+//   through a lossy bus.
+
+extern unsigned long lostRequestCount;
+extern unsigned long lostReplyCount;
+
+const unsigned char FIRST_BYTEID = 0x10;
+const byte SLAVE_COUNT = 4;
+
+void checkSlavesHealthy(const char *when)
+{
+  printf("%s\n", when);
+  for (byte i = 0; i < SLAVE_COUNT; ++i) {
+    SlaveRecord *slave = findSlave(FIRST_BYTEID + i);
+    CHECK(slave != NULL);
+    if (slave == NULL) continue;
+    CHECK(slave->seen);
+    CHECK(slave->pollCount > 0);
+    CHECK_EQUAL(SLAVE_HEALTHY, slaveHealth(*slave));
+  }
+}
+
+int main()
+{
+  hostClockManual(true);
+  hostConsoleCapture(true);
+  setup();
+
+  hostConsoleType("!h 4 10\n");
+  hostRunLoop(5000);
+  checkSlavesHealthy("polling");
+  for (byte i = 0; i < SLAVE_COUNT; ++i) {
+    SlaveRecord *slave = findSlave(FIRST_BYTEID + i);
+    if (slave != NULL) CHECK_EQUAL(0, slave->errorCount);
+  }
+
+  hostConsoleType("!o 11 +5\n");
+  hostRunLoop(5000);
+  SlaveRecord *slave = findSlave(0x11);
+  CHECK(slave != NULL);
+  if (slave != NULL) {
+    CHECK_EQUAL(5, slave->targetStates);
+    CHECK_EQUAL(5, slave->currentStates);
+    CHECK(!slaveDirty(*slave));
+  }
+  slave = findSlave(0x12);
+  if (slave != NULL) CHECK_EQUAL(0, slave->currentStates);
+
+  // a slave with one relay module: a broadcast target for 16 relays leaves it with 8, and the cache settles there
+  hostConsoleType("!hb 13 1\n");
+  hostConsoleType("!o * FFFF\n");
+  hostRunLoop(15000);
+  slave = findSlave(0x13);
+  CHECK(slave != NULL);
+  if (slave != NULL) {
+    CHECK_EQUAL(0xFF, slave->targetStates);
+    CHECK_EQUAL(0xFF, slave->currentStates);
+    CHECK(!slaveDirty(*slave));
+    CHECK(slaveOutputsConfirmed(0x13, 0xFF));
+  }
+  slave = findSlave(0x10);
+  if (slave != NULL) {
+    CHECK_EQUAL(0xFFFF, slave->currentStates);
+    CHECK(!slaveDirty(*slave));
+  }
+
+  hostConsoleType("!hl 20 20\n");
+  hostRunLoop(20000);
+  hostConsoleType("!hl 0 0\n");
+  hostRunLoop(2000);
+  CHECK(lostRequestCount > 0);
+  CHECK(lostReplyCount > 0);
+  checkSlavesHealthy("after losing frames");
+
+  hostConsoleType("!h\n");
+  hostRunLoop(100);
+  std::string output = hostConsoleTake();
+  CHECK(output.find("simulated slaves:4") != std::string::npos);
+  if (hostTestFailures) printf("%s", output.c_str());
+  return HOST_TEST_RESULT;
+}
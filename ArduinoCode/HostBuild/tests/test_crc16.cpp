@@ -0,0 +1,88 @@
+#include <Arduino.h>
+#include "HostTest.h"
+#include "Crc16.h"
+#include "SlaveComms.h"
+#include "BusTransport.h"
+
+// crc16 against known check values, against the bit-by-bit reference, and against calculatecrc16 in
+//   RelayControlModule.bas, which the slaves use to check the master's frames.
+
+// calculatecrc16 from RelayControlModule.bas, statement for statement, with the PICAXE's byte variables
+unsigned short picaxeCalculateCrc16(const unsigned char buffer[], int length)
+{
+  byte crc16valueHi = 0xFF, crc16valueLo = 0xFF;
+  byte x, x2;
+  for (int i = 0; i < length; ++i) {
+    x = buffer[i];
+    x = x ^ crc16valueHi;
+    x2 = x / 16;
+    x = x ^ x2;
+    crc16valueHi = crc16valueLo;
+    x2 = x * 16;
+    crc16valueHi = crc16valueHi ^ x2;
+    x2 = x / 8;
+    crc16valueHi = crc16valueHi ^ x2;
+    x2 = x * 32;
+    crc16valueLo = x2;
+    crc16valueLo = crc16valueLo ^ x;
+  }
+  return (crc16valueHi << 8) | crc16valueLo;
+}
+
+unsigned short crc16Incremental(const unsigned char data[], int length)
+{
+  unsigned short crc = crc16Init();
+  for (int i = 0; i < length; ++i) {
+    crc = crc16Update(crc, data[i]);
+  }
+  return crc16Finalize(crc);
+}
+
+void checkAllCalculations(unsigned short expected, const unsigned char data[], int length)
+{
+  CHECK_EQUAL(expected, crc16(data, length));
+  CHECK_EQUAL(expected, crc16Bitwise(data, length));
+  CHECK_EQUAL(expected, crc16Incremental(data, length));
+  CHECK_EQUAL(expected, picaxeCalculateCrc16(data, length));
+}
+
+int main()
+{
+  // the check value of CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF, no reflection, no final xor)
+  const unsigned char check[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+  checkAllCalculations(0x29B1, check, sizeof(check));
+  checkAllCalculations(0xFFFF, check, 0);
+  const unsigned char zero[] = {0x00};
+  checkAllCalculations(0xE1F0, zero, sizeof(zero));
+
+  // frames as the slave sees them: {BYTEID}{BYTECOMMAND}{DWORDCOMMANDPARAM}, and {SEQUENCE} in version 2
+  const unsigned char v1Frame[] = {0x5A, 102, 0x05, 0x00, 0x00, 0x00};          // !: slave 5A outputs = 5
+  checkAllCalculations(0x909A, v1Frame, sizeof(v1Frame));
+  const unsigned char v2Frame[] = {0x10, 100, 0x00, 0x00, 0x00, 0x00, 0x01};    // #: slave 10 status, sequence 1
+  checkAllCalculations(0x8F2D, v2Frame, sizeof(v2Frame));
+
+  // every single byte, and every pair of bytes after a frame prefix
+  for (int i = 0; i < 256; ++i) {
+    unsigned char data[1] = {(unsigned char)i};
+    CHECK_EQUAL(picaxeCalculateCrc16(data, 1), crc16(data, 1));
+  }
+  unsigned char frame[7] = {0x10, 101, 0x00, 0x00, 0x00, 0x00, 0x00};
+  for (int i = 0; i < 0x10000; ++i) {
+    frame[5] = i & 0xFF;
+    frame[6] = i >> 8;
+    if (crc16(frame, sizeof(frame)) != picaxeCalculateCrc16(frame, sizeof(frame))) {
+      CHECK_EQUAL(picaxeCalculateCrc16(frame, sizeof(frame)), crc16(frame, sizeof(frame)));
+      break;
+    }
+  }
+
+  // the master sends the CRC low byte first (inputCRCb0 in the slave)
+  setBusTransport(&loopbackTransport);
+  CHECK(sendCommand(0x10, 100, 0, 0x01));
+  const unsigned char expected[] = {'#', 0x10, 100, 0x00, 0x00, 0x00, 0x00, 0x01, 0x2D, 0x8F};
+  CHECK_EQUAL(sizeof(expected), loopbackTransport.available());
+  for (unsigned int i = 0; i < sizeof(expected); ++i) {
+    CHECK_EQUAL(expected[i], loopbackTransport.read());
+  }
+  return HOST_TEST_RESULT;
+}
@@ -0,0 +1,136 @@
+#include <Arduino.h>
+#include "HostSupport.h"
+#include "HostTest.h"
+#include "Probes.h"
+
+// Synthetic sample streams through the probe filter (probeSampleInput, then tickProbes): the trimmed mean and its
+//   extra resolution, the rejection of outliers, and the faults for readings out of range, noise and no samples.
+
+const byte SAMPLES_PER_BLOCK = 16;
+const unsigned int ONE_COUNT = 1 << PROBE_FRACTION_BITS;
+
+// a block of samples from the given pattern, repeated; then the blocks are converted into a reading
+void feedBlock(byte probe, const unsigned int pattern[], int patternLength)
+{
+  for (int i = 0; i < SAMPLES_PER_BLOCK; ++i) {
+    probeSampleInput(probe, pattern[i % patternLength]);
+  }
+  hostClockAdvance(1000);
+  tickProbes();
+}
+
+void feedLevel(byte probe, unsigned int level, int blocks)
+{
+  for (int i = 0; i < blocks; ++i) {
+    feedBlock(probe, &level, 1);
+  }
+}
+
+bool readingIs(byte probe, unsigned int expected)
+{
+  unsigned int reading = 0;
+  if (!probeReading(probe, reading)) {
+    printf("probe %d: no reading, expected %u\n", probe, expected);
+    return false;
+  }
+  if (reading != expected) printf("probe %d: reading %u, expected %u\n", probe, reading, expected);
+  return reading == expected;
+}
+
+bool probeFaulty(byte probe)
+{
+  unsigned int reading;
+  return !probeReading(probe, reading);
+}
+
+int main()
+{
+  hostClockManual(true);
+  setupProbes();
+  unsigned int reading;
+  CHECK(!probeReading(0, reading));
+
+  // a steady level
+  feedLevel(0, 500, 1);
+  CHECK(readingIs(0, 500 * ONE_COUNT));
+
+  // the highest and lowest sample of each block are rejected
+  const unsigned int spikes[SAMPLES_PER_BLOCK] = {500, 1023, 500, 500, 500, 500, 500, 500,
+                                                   500, 500, 500, 0, 500, 500, 500, 500};
+  feedBlock(0, spikes, SAMPLES_PER_BLOCK);
+  CHECK(readingIs(0, 500 * ONE_COUNT));
+
+  // averaging gives resolution finer than one ADC count: 7 x 500 and 7 x 501 are left after the trimming
+  const unsigned int halfway[] = {500, 501};
+  feedBlock(0, halfway, 2);
+  CHECK(readingIs(0, 500 * ONE_COUNT + ONE_COUNT / 2));
+  const unsigned int quarter[] = {300, 300, 300, 301};
+  feedBlock(0, quarter, 4);
+  CHECK(readingIs(0, 300 * ONE_COUNT + 3));   // (12 x 300 + 4 x 301 - 300 - 301) / 14 = 300.21
+
+  // the probes are independent, and a block is only finished after 16 samples
+  feedLevel(1, 700, 1);
+  CHECK(readingIs(1, 700 * ONE_COUNT));
+  CHECK(readingIs(0, 300 * ONE_COUNT + 3));
+  for (int i = 0; i < SAMPLES_PER_BLOCK - 1; ++i) probeSampleInput(1, 100);
+  tickProbes();
+  CHECK(readingIs(1, 700 * ONE_COUNT));
+  probeSampleInput(1, 100);
+  tickProbes();
+  CHECK(readingIs(1, 100 * ONE_COUNT));
+
+  // near the ends of the range: open or short circuit
+  feedLevel(2, 2, 1);
+  CHECK(probeFaulty(2));
+  feedLevel(2, 1020, 1);
+  CHECK(probeFaulty(2));
+  feedLevel(2, 512, 1);
+  CHECK(readingIs(2, 512 * ONE_COUNT));
+
+  // noise: the reading is still given until too many noisy blocks in a row
+  const unsigned int noisy[] = {400, 600};
+  for (int i = 0; i < 7; ++i) feedBlock(3, noisy, 2);
+  CHECK(readingIs(3, 500 * ONE_COUNT));
+  feedBlock(3, noisy, 2);
+  CHECK(probeFaulty(3));
+  feedLevel(3, 500, 1);
+  CHECK(readingIs(3, 500 * ONE_COUNT));
+
+  // no blocks for too long
+  hostClockAdvance(400000);
+  tickProbes();
+  CHECK(readingIs(3, 500 * ONE_COUNT));
+  hostClockAdvance(200000);
+  tickProbes();
+  CHECK(probeFaulty(3));
+  feedLevel(3, 500, 1);
+  CHECK(readingIs(3, 500 * ONE_COUNT));
+
+  // more blocks than the ring holds between ticks: the extra ones are dropped, the reading carries on
+  for (int i = 0; i < 20; ++i) {
+    for (int j = 0; j < SAMPLES_PER_BLOCK; ++j) probeSampleInput(0, 200);
+  }
+  tickProbes();
+  CHECK(readingIs(0, 200 * ONE_COUNT));
+
+  // the built-in synthetic stream: the noise and a spike in every block are filtered out
+  simulateProbe(1, 600, 10, SAMPLES_PER_BLOCK);
+  for (int i = 0; i < 200; ++i) {
+    hostClockAdvance(1000);
+    tickProbes();
+  }
+  CHECK(probeReading(1, reading));
+  CHECK(reading >= 596 * ONE_COUNT && reading <= 604 * ONE_COUNT);
+
+  // only one outlier at each end of a block is rejected: spikes more often than that make the probe noisy
+  simulateProbe(2, 600, 10, 7);
+  for (int i = 0; i < 200; ++i) {
+    hostClockAdvance(1000);
+    tickProbes();
+  }
+  CHECK(probeFaulty(2));
+  CHECK(probeReading(1, reading));
+  stopProbeSimulation();
+
+  return HOST_TEST_RESULT;
+}
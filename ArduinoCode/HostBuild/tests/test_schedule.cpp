@@ -0,0 +1,49 @@
+#include <Arduino.h>
+#include "HostSupport.h"
+#include "HostTest.h"
+#include "Schedule.h"
+
+// The schedule's clock and events over 55 days, an hour at a time: the time of week stays right as the clock base is
+//   moved on (see rebaseScheduleClock) and every event is applied once.  millis() is 64 bits on the host, so it
+//   doesn't wrap after 49.7 days as it does on the Arduino: the wrap itself isn't tested here.
+
+const unsigned long HOUR_US = 3600000000UL;
+
+bool outputContains(const std::string &output, const char *text)
+{
+  if (output.find(text) != std::string::npos) return true;
+  printf("expected \"%s\" in:\n%s\n", text, output.c_str());
+  return false;
+}
+
+int main()
+{
+  hostClockManual(true);
+  hostConsoleCapture(true);
+  setup();
+  setScheduleClock(0, 0);   // Monday 00:00
+  ScheduleRule rule = {0x10, 3, ALL_DAYS, 6 * 60 + 30, 15};
+  CHECK(addScheduleRule(rule));
+
+  // 55 days, an hour at a time, to Sunday 00:00
+  for (unsigned long hour = 0; hour < 55 * 24; ++hour) {
+    hostClockAdvance(HOUR_US);
+    loop();
+  }
+  hostConsoleTake();
+  printSchedule(Serial);
+  std::string output = hostConsoleTake();
+  CHECK(outputContains(output, "clock:Sun 0:00"));
+  CHECK(outputContains(output, "events applied:110 "));   // on and off on each day
+  CHECK(outputContains(output, "next event:Sun 6:30 id:10 relay:3 on"));
+
+  // and on through the day's event
+  hostClockAdvance(6 * HOUR_US + 31 * 60000000UL);
+  loop();
+  printSchedule(Serial);
+  output = hostConsoleTake();
+  CHECK(outputContains(output, "clock:Sun 6:31"));
+  CHECK(outputContains(output, "events applied:111 "));
+  CHECK(outputContains(output, "next event:Sun 6:45 id:10 relay:3 off"));
+  return HOST_TEST_RESULT;
+}
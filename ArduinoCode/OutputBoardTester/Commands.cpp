@@ -1,6 +1,8 @@
 #include <ctype.h>
 #include "Commands.h"
 #include "SystemStatus.h"
+#include "PulseTrain.h"
+#include "Profiler.h"
 
 const int MAX_COMMAND_LENGTH = 30;
 const int COMMAND_BUFFER_SIZE = MAX_COMMAND_LENGTH + 2;  // if buffer fills to max size, truncation occurs
@@ -8,17 +10,14 @@ int commandBufferIdx = -1;
 char commandBuffer[COMMAND_BUFFER_SIZE];  
 const char COMMAND_START_CHAR = '!';
 
-long timedelay = 1000; // default time (ms) for each transition
-const int C_PIN = 3;
-const int D_PIN = 4;
-const int L_PIN = 5;
+unsigned long timedelayus = 1000000UL; // default time (us) for each transition
+const unsigned long MIN_TIME_DELAY_US = MIN_PULSETRAIN_STEP_US;   // the shortest step which polling can time (see PulseTrain.h)
+const unsigned long MAX_TIME_DELAY_US = 10000000UL;
 
 // currently doesn't do anything in particular
 void setupCommands()
 {
-  pinMode(C_PIN, OUTPUT);
-  pinMode(D_PIN, OUTPUT);
-  pinMode(L_PIN, OUTPUT);
+  setupPulseTrain();
 }
 
 // parse a long from the given string, returns in retval.  Also returns the ptr to the next character which wasn't parsed
@@ -52,33 +51,13 @@ bool parseFloatFromString(const char *buffer, const char * &nextUnparsedChar, fl
 }
 
 
-// output a pulse train on pins C, D, L.  
-//  each char corresponds to a pin 
-// c = c low
-// C = c high
-// d = d low
-// D = d high
-// l = l low
-// L = l high
-// delayms = duration of each pulse
-void pulsetrain(char command [], long delayms) {
-  int i;
-  for (i = 0; i < strlen(command); ++i) {
-    switch(command[i]) {
-      case 'c': digitalWrite(C_PIN,  LOW); break;    
-      case 'C': digitalWrite(C_PIN,  HIGH); break;    
-      case 'd': digitalWrite(D_PIN,  LOW); break;    
-      case 'D': digitalWrite(D_PIN,  HIGH); break;    
-      case 'l': digitalWrite(L_PIN,  LOW); break;    
-      case 'L': digitalWrite(L_PIN,  HIGH); break;    
-    }
-    console->print(command[i]);
-    delay(timedelay);
+// queue a pulse train on pins C, D, L; see PulseTrain.h
+void pulsetrain(char command [], unsigned long delayus) {
+  if (!queuePulseTrain(command, delayus)) {
+    console->println(F("pulse train queue full; try again later or !a to abort")); 
   }
-  console->println("");
 }
 
-
 // execute the command encoded in commandString.  Null-terminated
 void executeCommand(char command[]) 
 {
@@ -86,9 +65,11 @@ void executeCommand(char command[])
   switch (command[0]) {
     case '?': {
       commandIsValid = true;
-      console->println("commands (turn CR+LF on):");
-      console->println("!t {time} = set command delay time (ms)");
-      console->println("!cCdDlL = output train on pins C, D, L respectively.  c = low C = high etc.  Example: cDdCDd = cLo Dhi Dlo CHi Dhi Dlo");
+      console->println(F("commands (turn CR+LF on):"));
+      console->println(F("!t {time} = set command delay time (ms).  !t {time}u = set command delay time (us).  At least 25 ms"));
+      console->println(F("!cCdDlL = output train on pins C, D, L respectively.  c = low C = high etc.  Example: cDdCDd = cLo Dhi Dlo CHi Dhi Dlo"));
+      console->println(F("!a = abort the pulse train in progress"));
+      console->println(F("!p = print the loop and command timing statistics, then reset them"));
       break;
     }
     case 'C':
@@ -98,7 +79,7 @@ void executeCommand(char command[])
     case 'D':
     case 'd': {
       commandIsValid = true;
-      pulsetrain(command, timedelay);
+      pulsetrain(command, timedelayus);
       break;
     }
     case 't': {
@@ -106,14 +87,34 @@ void executeCommand(char command[])
       long retval;
       const char *nextUnparsedChar;
       bool success = parseLongFromString(command+1, nextUnparsedChar, retval);
-      if (success) {
-        timedelay = retval;
-        if (timedelay < 10) timedelay = 10;
-        if (timedelay > 10000) timedelay = 10000;
-        console->print("time delay set to: ");
-        console->println(timedelay); 
+      if (success && retval >= 0) {
+        if (*nextUnparsedChar == 'u') {
+          timedelayus = retval;
+        } else {
+          timedelayus = (retval > (long)(MAX_TIME_DELAY_US / 1000)) ? MAX_TIME_DELAY_US : retval * 1000UL;
+        }
+        if (timedelayus < MIN_TIME_DELAY_US) timedelayus = MIN_TIME_DELAY_US;
+        if (timedelayus > MAX_TIME_DELAY_US) timedelayus = MAX_TIME_DELAY_US;
+        console->print(F("time delay set to (us): "));
+        console->println(timedelayus); 
+      } else {
+        console->println(F("invalid time delay specified")); 
+      }
+      break;
+    }
+    case 'p': {
+      commandIsValid = true; 
+      printProfile(*console);
+      console->print(F("pulse train steps late:")); console->println(pulseTrainLateSteps);
+      pulseTrainLateSteps = 0;
+      break;
+    }
+    case 'a': {
+      commandIsValid = true; 
+      if (abortPulseTrain()) {
+        console->println(F("pulse train aborted")); 
       } else {
-        console->print("invalid time delay specified"); 
+        console->println(F("no pulse train in progress")); 
       }
       break;
     }
@@ -123,15 +124,17 @@ void executeCommand(char command[])
   }
 
   if (!commandIsValid) {
-    console->print("unknown command:");
+    console->print(F("unknown command:"));
     console->println(command);
-    console->println("use ? for help");
+    console->println(F("use ? for help"));
   }
 }
 
+// continue any pulse train in progress, then
 // look for incoming serial input (commands); collect the command and execute it when the entire command has arrived.
 void tickCommands()
 {
+  tickPulseTrain();
   while (consoleInput->available()) {
     if (commandBufferIdx < -1  || commandBufferIdx > COMMAND_BUFFER_SIZE) {
       assertFailureCode = ASSERT_INDEX_OUT_OF_BOUNDS;
@@ -142,14 +145,16 @@ void tickCommands()
       commandBufferIdx = 0;        
     } else if (nextChar == '\n') {
       if (commandBufferIdx == -1) {
-        console->println("Type !? for help");
+        console->println(F("Type !? for help"));
       } else if (commandBufferIdx > 0) {
         if (commandBufferIdx > MAX_COMMAND_LENGTH) {
           commandBuffer[MAX_COMMAND_LENGTH] = '\0';
-          console->print("Command too long:"); console->println(commandBuffer);
+          console->print(F("Command too long:")); console->println(commandBuffer);
         } else {
           commandBuffer[commandBufferIdx++] = '\0';
+          unsigned long starttime = micros();
           executeCommand(commandBuffer);
+          profileCommand(commandBuffer, starttime);
         } 
         commandBufferIdx = -1; 
       }
@@ -2,23 +2,33 @@
 #include "OutputBoardTester.h"
 #include "Commands.h"
 #include "SystemStatus.h"
+#include "Profiler.h"
 
 /********************************************************************/
 
+byte profileTickCommands;
+byte profileTickSystemStatus;
+
 void setup(void) 
 { 
   // start serial port 
   Serial.begin(9600);
-  Serial.print("Version:");
+  Serial.print(F("Version:"));
   Serial.println(OBT_VERSION); 
-  Serial.println("Setting up"); 
+  Serial.println(F("Setting up")); 
 
+  setupProfiler();
+  profileTickCommands = addProfilePoint(F("tickCommands"));
+  profileTickSystemStatus = addProfilePoint(F("tickSystemStatus"));
   setupSystemStatus();
   setupCommands();
 } 
 
 void loop(void) 
 { 
+  unsigned long starttime = micros();
   tickCommands();
+  starttime = profileRecord(profileTickCommands, starttime);
   tickSystemStatus();
+  profileRecord(profileTickSystemStatus, starttime);
 }
@@ -0,0 +1,40 @@
+#ifndef PULSETRAIN_H
+#define PULSETRAIN_H
+#include <Arduino.h>
+
+// Outputs pulse trains on pins C, D, L in the background: the steps are queued, and each call to tickPulseTrain
+//   applies the next step once it has fallen due (timed using micros()), so the rest of the system keeps running.
+// The steps are polled from loop(), not timed by an interrupt, so they can't be shorter than the longest time for which
+//   loop() is held up: a bus frame sent with SoftwareSerial at 4800 baud takes about 21 ms, and console output waits
+//   for room in the transmit buffer (about 1 ms per character at 9600 baud).  A step which ends late is counted in
+//   pulseTrainLateSteps, and the following steps keep their full length.
+// Each step char corresponds to a pin:
+// c = c low
+// C = c high
+// d = d low
+// D = d high
+// l = l low
+// L = l high
+
+const unsigned long MIN_PULSETRAIN_STEP_US = 25000UL;
+const unsigned long PULSETRAIN_LATE_US = 1000;   // steps which end more than this late are counted as late
+
+// steps which ended late since the count was last reset
+extern unsigned long pulseTrainLateSteps;
+
+void setupPulseTrain();
+
+// call as often as possible; the timing accuracy of the steps depends on it
+void tickPulseTrain();
+
+// queue a pulse train; each step lasts stepus microseconds (at least MIN_PULSETRAIN_STEP_US for accurate timing).
+// returns false (and queues nothing) if there isn't enough space left in the queue
+bool queuePulseTrain(const char steps[], unsigned long stepus);
+
+// stop the current pulse train and discard any queued.  The pins are left in their current state.
+// returns false if no pulse train was running
+bool abortPulseTrain();
+
+bool pulseTrainRunning();
+
+#endif
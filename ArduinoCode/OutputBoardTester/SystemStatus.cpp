@@ -11,8 +11,8 @@ Stream *consoleInput;
 
 void printDebugInfo(Print &dest)
 {
-  dest.print("Version:"); dest.println(OBT_VERSION); 
-  dest.print("Last Assert Error:"); dest.println(assertFailureCode); 
+  dest.print(F("Version:")); dest.println(OBT_VERSION); 
+  dest.print(F("Last Assert Error:")); dest.println(assertFailureCode); 
 }
 
 DigitalPin<LED_BUILTIN> pinStatusLED;
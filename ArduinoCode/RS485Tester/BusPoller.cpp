@@ -0,0 +1,173 @@
+#include <Arduino.h>
+#include "BusPoller.h"
+#include "BusTransactions.h"
+#include "SlaveComms.h"
+#include "SlaveTable.h"
+
+const unsigned int MIN_POLL_INTERVAL_MS = 250;
+const unsigned int MAX_POLL_INTERVAL_MS = 8000;
+const unsigned long STATES_VERIFY_INTERVAL_MS = 60000UL;
+// a dirty slave whose current states are read this many times in a row without changing has probably finished its
+//   transition short of the cached target (eg the target was broadcast with relays for modules it doesn't have fitted),
+//   so its target states are read again
+const byte STALLED_POLL_COUNT = 4;
+
+bool pollInProgress = false;
+bool pollingPaused = false;
+unsigned long pollsCompleted = 0;
+unsigned long pollRateStartTime = 0;
+
+void setupBusPoller()
+{
+  pollInProgress = false;
+  pollsCompleted = 0;
+  pollRateStartTime = millis();
+}
+
+bool startPollingSlave(unsigned char byteid)
+{
+  SlaveRecord *slave = addSlave(byteid);
+  if (slave == NULL) return false;
+  slave->pollIntervalms = MIN_POLL_INTERVAL_MS;
+  slave->nextPollTime = millis();
+  slave->nextPollCommand = COMMAND_CURRENT_OUTPUT;   // find out the target states first, in case the master was reset
+  slave->nextPollStates = OUTPUT_TARGET_STATES;
+  return true;
+}
+
+bool stopPollingSlave(unsigned char byteid)
+{
+  return removeSlave(byteid);
+}
+
+void pollSlaveSoon(SlaveRecord &slave)
+{
+  slave.pollIntervalms = MIN_POLL_INTERVAL_MS;
+  slave.nextPollTime = millis();
+  slave.nextPollCommand = COMMAND_CURRENT_OUTPUT;
+}
+
+void pollSlaveSoon(unsigned char byteid)
+{
+  if (byteid == BROADCAST_BYTEID) {
+    for (int i = 0; i < MAX_SLAVES; ++i) {
+      if (slaveTable[i].inUse) pollSlaveSoon(slaveTable[i]);
+    }
+    return;
+  }
+  SlaveRecord *slave = findSlave(byteid);
+  if (slave != NULL) pollSlaveSoon(*slave);
+}
+
+void pollDirtySlavesSoon()
+{
+  for (int i = 0; i < MAX_SLAVES; ++i) {
+    if (slaveTable[i].inUse && slaveDirty(slaveTable[i])) pollSlaveSoon(slaveTable[i]);
+  }
+}
+
+// adjust the poll interval for the slave based on the result of the poll
+void pollComplete(const Transaction &transaction)
+{
+  pollInProgress = false;
+  ++pollsCompleted;
+  SlaveRecord *slave = findSlave(transaction.byteid);
+  if (slave == NULL) return;  // removed while the poll was in progress
+  ++slave->pollCount;
+
+  if (transaction.outcome != TXN_SUCCESS) {
+    ++slave->errorCount;
+    if (slave->consecutiveErrors < 255) ++slave->consecutiveErrors;
+    slave->pollIntervalms = (slave->consecutiveErrors >= OFFLINE_ERROR_COUNT) ? MAX_POLL_INTERVAL_MS : MIN_POLL_INTERVAL_MS;
+  } else {
+    slave->consecutiveErrors = 0;
+    if (transaction.bytecommand == COMMAND_ALIVE) {
+      slave->lastStatus = transaction.dwordstatus;
+    } else if (slave->nextPollStates == OUTPUT_TARGET_STATES) {
+      slave->targetStates = transaction.dwordstatus;
+      slave->nextPollStates = OUTPUT_CURRENT_STATES;
+      markSlaveDirty(*slave, true);   // find out whether the current states have caught up
+    } else {
+      bool unchanged = (transaction.dwordstatus == slave->currentStates);
+      slave->currentStates = transaction.dwordstatus;
+      slave->confirmedTime = millis();
+      bool settled = (slave->currentStates == slave->targetStates);
+      if (settled || !unchanged) {
+        slave->unchangedPolls = 0;
+      } else if (slave->unchangedPolls < 255) {
+        ++slave->unchangedPolls;
+      }
+      if (!settled && (!slaveDirty(*slave) || slave->unchangedPolls >= STALLED_POLL_COUNT)) {
+        slave->nextPollStates = OUTPUT_TARGET_STATES;   // the cache was wrong (eg the slave was reset): read it again
+        slave->unchangedPolls = 0;
+      }
+      markSlaveDirty(*slave, !settled);
+    }
+    if (slaveDirty(*slave)) {
+      slave->pollIntervalms = MIN_POLL_INTERVAL_MS;
+    } else if (slave->pollIntervalms < MAX_POLL_INTERVAL_MS / 2) {
+      slave->pollIntervalms *= 2;
+    } else {
+      slave->pollIntervalms = MAX_POLL_INTERVAL_MS;
+    }
+  }
+  slave->nextPollCommand = (slaveDirty(*slave) || slave->nextPollStates == OUTPUT_TARGET_STATES
+                            || millis() - slave->confirmedTime >= STATES_VERIFY_INTERVAL_MS) ? COMMAND_CURRENT_OUTPUT : COMMAND_ALIVE;
+  slave->nextPollTime = millis() + slave->pollIntervalms;
+}
+
+// keep at most one poll in the transaction queue, so that other commands aren't held up behind a batch of polls.
+// The most overdue slave is polled next, which gives round-robin order for slaves with the same interval.
+void tickBusPoller()
+{
+  if (pollInProgress || pollingPaused) return;
+  unsigned long timenow = millis();
+  SlaveRecord *mostOverdue = NULL;
+  for (int i = 0; i < MAX_SLAVES; ++i) {
+    SlaveRecord &slave = slaveTable[i];
+    if (!slave.inUse || (long)(timenow - slave.nextPollTime) < 0) continue;
+    if (mostOverdue == NULL || (long)(slave.nextPollTime - mostOverdue->nextPollTime) < 0) {
+      mostOverdue = &slave;
+    }
+  }
+  if (mostOverdue == NULL) return;
+  unsigned long dwordparameter = (mostOverdue->nextPollCommand == COMMAND_CURRENT_OUTPUT) ? mostOverdue->nextPollStates : 0;
+  int slot = queueTransaction(mostOverdue->byteid, mostOverdue->nextPollCommand, dwordparameter, pollComplete, NULL);
+  if (slot != NO_TRANSACTION) pollInProgress = true;
+}
+
+void pausePolling(bool paused)
+{
+  pollingPaused = paused;
+}
+
+void printPollSchedule(Print &dest)
+{
+  unsigned long timenow = millis();
+  dest.println(F("id interval(ms) due(ms) next errors polls state"));
+  for (int i = 0; i < MAX_SLAVES; ++i) {
+    SlaveRecord &slave = slaveTable[i];
+    if (!slave.inUse) continue;
+    long due = (long)(slave.nextPollTime - timenow);
+    dest.print(slave.byteid, HEX); dest.print(' ');
+    dest.print(slave.pollIntervalms); dest.print(' ');
+    dest.print(due < 0 ? 0 : due); dest.print(' ');
+    dest.print(slave.nextPollCommand); dest.print(' ');
+    dest.print(slave.errorCount); dest.print(' ');
+    dest.print(slave.pollCount); dest.print(' ');
+    if (slave.consecutiveErrors >= OFFLINE_ERROR_COUNT) {
+      dest.println(F("offline"));
+    } else if (slave.consecutiveErrors > 0) {
+      dest.println(F("errors"));
+    } else if (slaveDirty(slave)) {
+      dest.println(F("changing"));
+    } else {
+      dest.println(F("stable"));
+    }
+  }
+  unsigned long elapsedms = timenow - pollRateStartTime;
+  dest.print(F("polls per second:"));
+  dest.println(elapsedms == 0 ? 0.0 : pollsCompleted * 1000.0 / elapsedms);
+  pollsCompleted = 0;
+  pollRateStartTime = timenow;
+}
@@ -0,0 +1,35 @@
+#ifndef BUSPOLLER_H
+#define BUSPOLLER_H
+#include <Arduino.h>
+
+// Polls each slave in the slave table, keeping its cached states and health up to date (see SlaveTable.h).  The target
+//   states are read once when polling starts; after that they are known from the output commands sent to the slave.
+// Dirty slaves (output changes in progress) get command 101 (current output) until their current states match the
+//   target.  The others only get command 100 (alive), progressively less often, plus a 101 every
+//   STATES_VERIFY_INTERVAL_MS to check that the cache still matches the slave (eg it hasn't been reset); if it doesn't,
+//   the target states are read again.  Slaves with recent errors are polled often.
+
+void setupBusPoller();
+void tickBusPoller();
+
+// start polling the given slave.  returns false if the slave table is full
+bool startPollingSlave(unsigned char byteid);
+
+// returns false if the slave wasn't being polled
+bool stopPollingSlave(unsigned char byteid);
+
+// read back the slave's current states as soon as possible (eg after sending it new outputs), then frequently while it
+//   is dirty
+// BROADCAST_BYTEID = all slaves
+void pollSlaveSoon(unsigned char byteid);
+
+// poll the dirty slaves as soon as possible (eg after a time beacon, which changes the slaves armed for it)
+void pollDirtySlavesSoon();
+
+// stop sending polls (eg while another module needs the bus to itself); the schedule is kept
+void pausePolling(bool paused);
+
+// print the poll schedule and the number of polls per second achieved since the last call
+void printPollSchedule(Print &dest);
+
+#endif
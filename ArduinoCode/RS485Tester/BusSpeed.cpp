@@ -0,0 +1,239 @@
+#include <Arduino.h>
+#include "BusSpeed.h"
+#include "BusTransactions.h"
+#include "BusPoller.h"
+#include "SlaveComms.h"
+#include "SlaveTable.h"
+#include "SystemStatus.h"
+#include "Turnaround.h"
+#include "Discovery.h"
+
+const byte MEASUREMENT_FRAMES = 16;
+const unsigned long SPEED_CHANGE_SETTLE_MS = 200;    // time for the slaves to finish processing the last frame
+const unsigned int FALLBACK_TIMEOUT_COUNT = 6;       // this many timeouts in a row above the base speed = the slaves have been lost
+
+enum SpeedChangeState {SPEED_IDLE, SPEED_MEASURE_BEFORE, SPEED_QUIET, SPEED_SWITCHING, SPEED_SETTLING, SPEED_CONFIRMING,
+                       SPEED_MEASURE_AFTER};
+
+SpeedChangeState speedChangeState = SPEED_IDLE;
+unsigned long newBaudRate;
+unsigned long settleStartTime;   // SPEED_QUIET and SPEED_SETTLING give the slaves time to get ready for the next frame
+bool fallbackPending = false;
+
+int speedSlaveIdx;           // the slave table entry currently being measured or confirmed
+byte measuredFrames;
+byte measuredReplies;
+unsigned long measureStartTime;
+float framesPerSecondBefore = 0;
+float framesPerSecondAfter = 0;
+unsigned long fallbackCount = 0;
+
+void setupBusSpeed()
+{
+  speedChangeState = SPEED_IDLE;
+  fallbackPending = false;
+}
+
+bool busSpeedChangeInProgress()
+{
+  return speedChangeState != SPEED_IDLE;
+}
+
+// returns the speed code for the given baud rate, or -1 if not valid
+int busSpeedCode(unsigned long baud)
+{
+  for (byte code = 0; code <= MAX_BUS_SPEED_CODE; ++code) {
+    if ((BUS_BASE_BAUD_RATE << code) == baud) return code;
+  }
+  return -1;
+}
+
+// the next slave in the table after speedSlaveIdx; returns false if there are no more.  wrap = start again at the beginning
+bool nextSpeedSlave(bool wrap)
+{
+  for (int i = 1; i <= MAX_SLAVES; ++i) {
+    int idx = speedSlaveIdx + i;
+    if (idx >= MAX_SLAVES) {
+      if (!wrap) return false;
+      idx -= MAX_SLAVES;
+    }
+    if (slaveTable[idx].inUse) {
+      speedSlaveIdx = idx;
+      return true;
+    }
+  }
+  return false;
+}
+
+void restoreBaseSpeed()
+{
+  setBusBaudRate(BUS_BASE_BAUD_RATE);
+  fallbackPending = false;
+  pollSlaveSoon(BROADCAST_BYTEID);
+}
+
+void fallbackSent(const Transaction &)
+{
+  restoreBaseSpeed();
+}
+
+// tell any slaves which are still listening to go back to the base speed, then change the master back too.
+// Slaves which miss the broadcast will fall back by themselves after a while.
+void fallBackToBaseSpeed()
+{
+  ++fallbackCount;
+  fallbackPending = true;
+  if (queueTransaction(BROADCAST_BYTEID, COMMAND_SET_BUS_SPEED, 0, fallbackSent, NULL) == NO_TRANSACTION) {
+    restoreBaseSpeed();
+  }
+}
+
+void speedChangeFinished()
+{
+  speedChangeState = SPEED_IDLE;
+  pausePolling(false);
+}
+
+void speedChangeFailed(const __FlashStringHelper *reason)
+{
+  console->print(F("bus speed change failed: ")); console->println(reason);
+  if (getBusBaudRate() != BUS_BASE_BAUD_RATE) {
+    console->print(F("falling back to ")); console->println(BUS_BASE_BAUD_RATE);
+    fallBackToBaseSpeed();
+  }
+  speedChangeFinished();
+}
+
+void measurementComplete(const Transaction &transaction);
+
+void queueMeasurementFrame()
+{
+  nextSpeedSlave(true);
+  if (queueTransaction(slaveTable[speedSlaveIdx].byteid, COMMAND_ALIVE, 0, measurementComplete, NULL, 0) == NO_TRANSACTION) {
+    speedChangeFailed(F("transaction queue full"));
+  }
+}
+
+void startMeasurement()
+{
+  measuredFrames = 0;
+  measuredReplies = 0;
+  measureStartTime = millis();
+  queueMeasurementFrame();
+}
+
+void switchSent(const Transaction &)
+{
+  setBusBaudRate(newBaudRate);
+  settleStartTime = millis();
+  speedChangeState = SPEED_SETTLING;
+}
+
+void measurementComplete(const Transaction &transaction)
+{
+  ++measuredFrames;
+  if (transaction.outcome == TXN_SUCCESS) ++measuredReplies;
+  if (measuredFrames < MEASUREMENT_FRAMES) {
+    queueMeasurementFrame();
+    return;
+  }
+  unsigned long elapsed = millis() - measureStartTime;
+  float framesPerSecond = (elapsed == 0) ? 0 : measuredReplies * 1000.0 / elapsed;
+  if (speedChangeState == SPEED_MEASURE_BEFORE) {
+    framesPerSecondBefore = framesPerSecond;
+    settleStartTime = millis();
+    speedChangeState = SPEED_QUIET;  // a slave which has just replied won't hear the broadcast until it has released the bus
+  } else {
+    framesPerSecondAfter = framesPerSecond;
+    speedChangeFinished();
+    printBusSpeed(*console);
+  }
+}
+
+void confirmComplete(const Transaction &transaction);
+
+// confirm the next slave, or start the final measurement once they have all replied
+void confirmNextSlave()
+{
+  if (!nextSpeedSlave(false)) {
+    speedChangeState = SPEED_MEASURE_AFTER;
+    startMeasurement();
+    return;
+  }
+  if (queueTransaction(slaveTable[speedSlaveIdx].byteid, COMMAND_ALIVE, 0, confirmComplete, NULL) == NO_TRANSACTION) {
+    speedChangeFailed(F("transaction queue full"));
+  }
+}
+
+void confirmComplete(const Transaction &transaction)
+{
+  if (transaction.outcome != TXN_SUCCESS) {
+    console->print(F("slave ")); console->print(transaction.byteid, HEX); console->println(F(" didn't confirm the new speed"));
+    speedChangeFailed(F("not all slaves confirmed"));
+    return;
+  }
+  confirmNextSlave();
+}
+
+bool changeBusSpeed(unsigned long baud)
+{
+  if (busSpeedCode(baud) < 0 || slaveCount() == 0 || speedChangeState != SPEED_IDLE || fallbackPending
+      || turnaroundTuningInProgress() || discoveryInProgress()) return false;
+  newBaudRate = baud;
+  framesPerSecondBefore = 0;
+  framesPerSecondAfter = 0;
+  pausePolling(true);
+  speedSlaveIdx = -1;
+  speedChangeState = SPEED_MEASURE_BEFORE;
+  startMeasurement();
+  return true;
+}
+
+void tickBusSpeed()
+{
+  switch (speedChangeState) {
+    case SPEED_IDLE: {
+      if (!fallbackPending && getBusBaudRate() != BUS_BASE_BAUD_RATE && consecutiveTimeouts() >= FALLBACK_TIMEOUT_COUNT) {
+        console->println(F("slaves not answering: bus speed falling back"));
+        fallBackToBaseSpeed();
+      }
+      break;
+    }
+    case SPEED_QUIET: {
+      if (millis() - settleStartTime >= SPEED_CHANGE_SETTLE_MS) {
+        speedChangeState = SPEED_SWITCHING;
+        if (queueTransaction(BROADCAST_BYTEID, COMMAND_SET_BUS_SPEED, busSpeedCode(newBaudRate), switchSent, NULL) == NO_TRANSACTION) {
+          speedChangeFailed(F("transaction queue full"));
+        }
+      }
+      break;
+    }
+    case SPEED_SETTLING: {
+      if (millis() - settleStartTime >= SPEED_CHANGE_SETTLE_MS) {
+        speedChangeState = SPEED_CONFIRMING;
+        speedSlaveIdx = -1;
+        confirmNextSlave();
+      }
+      break;
+    }
+    case SPEED_MEASURE_BEFORE:
+    case SPEED_SWITCHING:
+    case SPEED_CONFIRMING:
+    case SPEED_MEASURE_AFTER: {
+      break;  // waiting for a transaction to complete
+    }
+    default: {
+      assertFailureCode = ASSERT_INVALID_SWITCH;
+      speedChangeState = SPEED_IDLE;
+      break;
+    }
+  }
+}
+
+void printBusSpeed(Print &dest)
+{
+  dest.print(F("bus baud:")); dest.println(getBusBaudRate());
+  dest.print(F("frames/sec before:")); dest.print(framesPerSecondBefore);
+  dest.print(F(" after:")); dest.println(framesPerSecondAfter);
+  dest.print(F("fallbacks:")); dest.println(fallbackCount);
+}
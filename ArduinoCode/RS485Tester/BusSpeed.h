@@ -0,0 +1,26 @@
+#ifndef BUSSPEED_H
+#define BUSSPEED_H
+#include <Arduino.h>
+
+// Changes the baud rate of the bus.  All the slaves in the slave table are moved together:
+// 1) measure the frames per second achieved at the current speed
+// 2) broadcast command 104 (change bus speed) to all slaves, then change the master's speed
+// 3) confirm that every slave in the table replies at the new speed
+// 4) measure the frames per second at the new speed
+// If any slave fails to confirm, the bus falls back to BUS_BASE_BAUD_RATE.  It also falls back if the slaves stop
+//   answering later on.  The slaves fall back by themselves if they hear nothing at the new speed.
+
+void setupBusSpeed();
+void tickBusSpeed();
+
+// start changing the bus to the given baud rate (must be BUS_BASE_BAUD_RATE * 2^n for n = 0 .. MAX_BUS_SPEED_CODE)
+// returns false if the baud rate is invalid, there are no slaves in the table, or a change (or turnaround tuning, or a
+//   discovery scan) is already in progress
+bool changeBusSpeed(unsigned long baud);
+
+bool busSpeedChangeInProgress();
+
+// print the current speed and the results of the last change
+void printBusSpeed(Print &dest);
+
+#endif
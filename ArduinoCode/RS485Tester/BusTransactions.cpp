@@ -0,0 +1,285 @@
+#include <Arduino.h>
+#include "BusTransactions.h"
+#include "SlaveComms.h"
+#include "SystemStatus.h"
+#include "DataLog.h"
+#include "SlaveTable.h"
+
+enum SlotState {SLOT_FREE, SLOT_QUEUED, SLOT_AWAITING_REPLY};
+
+struct TransactionSlot {
+  SlotState state;
+  unsigned int ticket;          // slots are sent in order of ticket
+  bool expectReply;
+  byte retriesLeft;
+  unsigned int timeoutms;
+  unsigned long sendTime;
+  TransactionCallback callback;
+  Transaction transaction;
+};
+
+const int TRANSACTION_POOL_SIZE = 6;
+TransactionSlot transactionPool[TRANSACTION_POOL_SIZE];
+unsigned int nextTicket = 0;
+int activeSlot = NO_TRANSACTION;  // the slot which currently owns the bus
+unsigned int consecutiveTimeoutCount = 0;
+bool transactionsHeld = false;
+byte nextSequence = 1;                // for the slaves which aren't in the slave table, and the first one for each which is
+unsigned long lostRequestCount = 0;   // attempts whose request didn't reach the slave (or arrived corrupted)
+unsigned long lostReplyCount = 0;     // transactions which got a replayed reply: the reply to an earlier attempt was lost
+SlaveReplyCallback unsolicitedReplyCallback = NULL;
+
+void transactionReplyReceived(const SlaveReply &reply);
+
+void setupBusTransactions()
+{
+  for (int i = 0; i < TRANSACTION_POOL_SIZE; ++i) {
+    transactionPool[i].state = SLOT_FREE;
+  }
+  activeSlot = NO_TRANSACTION;
+  transactionsHeld = false;
+  setSlaveReplyCallback(transactionReplyReceived);
+}
+
+// the sequence numbers of each slave in the table follow on from its last one, so that two requests in a row to the
+//   same slave never have the same sequence number (a global counter could come round to it again after 255 others)
+byte allocateSequence(unsigned char byteid)
+{
+  SlaveRecord *slave = findSlave(byteid);
+  if (slave != NULL && slave->lastSequence != NO_SEQUENCE) {
+    slave->lastSequence = (slave->lastSequence == 255) ? 1 : slave->lastSequence + 1;
+    return slave->lastSequence;
+  }
+  byte sequence = nextSequence;
+  nextSequence = (nextSequence == 255) ? 1 : nextSequence + 1;
+  if (slave != NULL) slave->lastSequence = sequence;
+  return sequence;
+}
+
+int queueTransaction(unsigned char byteid, unsigned char bytecommand, unsigned long dwordparameter,
+                     TransactionCallback callback, void *context,
+                     byte retries, unsigned int timeoutms)
+{
+  for (int i = 0; i < TRANSACTION_POOL_SIZE; ++i) {
+    TransactionSlot &slot = transactionPool[i];
+    if (slot.state == SLOT_FREE) {
+      slot.state = SLOT_QUEUED;
+      slot.ticket = nextTicket++;
+      slot.expectReply = commandExpectsReply(byteid, bytecommand);
+      slot.retriesLeft = slot.expectReply ? retries : 0;
+      slot.timeoutms = slot.expectReply ? timeoutms : UNACKNOWLEDGED_FRAME_GAP_MS;
+      slot.callback = callback;
+      slot.transaction.byteid = byteid;
+      slot.transaction.bytecommand = bytecommand;
+      slot.transaction.dwordparameter = dwordparameter;
+      slot.transaction.dwordstatus = 0;
+      slot.transaction.outcome = TXN_PENDING;
+      slot.transaction.sequence = NO_SEQUENCE;
+      slot.transaction.replayed = false;
+      if (slot.expectReply) slot.transaction.sequence = allocateSequence(byteid);
+      slot.transaction.attempts = 0;
+      slot.transaction.latencyms = 0;
+      slot.transaction.context = context;
+      return i;
+    }
+  }
+  return NO_TRANSACTION;
+}
+
+int queueBroadcastOutput(unsigned long outputs, TransactionCallback callback, void *context)
+{
+  return queueTransaction(BROADCAST_BYTEID, COMMAND_CHANGE_OUTPUT, outputs, callback, context);
+}
+
+int queueMulticastOutputs(unsigned char firstbyteid, const byte outputs[], TransactionCallback callback, void *context)
+{
+  unsigned long dwordparameter = 0;
+  for (int i = MULTICAST_GROUP_SIZE - 1; i >= 0; --i) {
+    dwordparameter = (dwordparameter << 8) | outputs[i];
+  }
+  return queueTransaction(firstbyteid, COMMAND_MULTICAST_OUTPUT, dwordparameter, callback, context);
+}
+
+int queueSetRelays(unsigned char byteid, unsigned long mask, TransactionCallback callback, void *context)
+{
+  return queueTransaction(byteid, COMMAND_SET_RELAYS, mask, callback, context);
+}
+
+int queueClearRelays(unsigned char byteid, unsigned long mask, TransactionCallback callback, void *context)
+{
+  return queueTransaction(byteid, COMMAND_CLEAR_RELAYS, mask, callback, context);
+}
+
+int queueToggleRelays(unsigned char byteid, unsigned long mask, TransactionCallback callback, void *context)
+{
+  return queueTransaction(byteid, COMMAND_TOGGLE_RELAYS, mask, callback, context);
+}
+
+byte transactionsInFlight()
+{
+  byte count = 0;
+  for (int i = 0; i < TRANSACTION_POOL_SIZE; ++i) {
+    if (transactionPool[i].state != SLOT_FREE) ++count;
+  }
+  return count;
+}
+
+void holdBusTransactions(bool hold)
+{
+  transactionsHeld = hold;
+}
+
+bool busTransactionsHeld()
+{
+  return transactionsHeld && activeSlot == NO_TRANSACTION;
+}
+
+void setUnsolicitedReplyCallback(SlaveReplyCallback callback)
+{
+  unsolicitedReplyCallback = callback;
+}
+
+// free the slot then tell the caller; the slot is freed first so that the callback can queue a new transaction
+void completeTransaction(int slotidx, TransactionOutcome outcome)
+{
+  TransactionSlot &slot = transactionPool[slotidx];
+  Transaction finished = slot.transaction;
+  TransactionCallback callback = slot.callback;
+  finished.outcome = outcome;
+  if (outcome == TXN_TIMEOUT) {
+    ++consecutiveTimeoutCount;
+  } else if (slot.expectReply && (outcome == TXN_SUCCESS || outcome == TXN_INVALID_COMMAND)) {
+    consecutiveTimeoutCount = 0;
+    // a fresh reply means that none of the earlier attempts reached the slave
+    if (finished.replayed) {
+      ++lostReplyCount;
+    } else {
+      lostRequestCount += finished.attempts - 1;
+    }
+  }
+  slot.state = SLOT_FREE;
+  if (activeSlot == slotidx) activeSlot = NO_TRANSACTION;
+  logTransaction(finished);
+  if (outcome == TXN_SUCCESS && (commandChangesOutputs(finished.bytecommand) || commandStagesOutputs(finished.bytecommand))) {
+    recordOutputCommand(finished);
+  }
+  if (callback != NULL) {
+    callback(finished);
+  }
+}
+
+void transactionReplyReceived(const SlaveReply &reply)
+{
+  if (activeSlot == NO_TRANSACTION  // unsolicited or late reply
+      || reply.byteid != transactionPool[activeSlot].transaction.byteid
+      || (reply.bytecommand != transactionPool[activeSlot].transaction.bytecommand && reply.bytecommand != COMMAND_INVALID_REPLY)
+      || (reply.sequence != NO_SEQUENCE && reply.sequence != transactionPool[activeSlot].transaction.sequence)) {
+    if (unsolicitedReplyCallback != NULL) unsolicitedReplyCallback(reply);
+    return;
+  }
+  TransactionSlot &slot = transactionPool[activeSlot];
+
+  slot.transaction.dwordstatus = reply.dwordstatus;
+  slot.transaction.replayed = reply.replayed;
+  slot.transaction.latencyms = millis() - slot.sendTime;
+  if (reply.bytecommand != COMMAND_RELAY_BENCH) {  // the bench reply is deliberately delayed
+    recordSlaveLatency(reply.byteid, slot.transaction.latencyms);
+  }
+  completeTransaction(activeSlot, (reply.bytecommand == COMMAND_INVALID_REPLY) ? TXN_INVALID_COMMAND : TXN_SUCCESS);
+}
+
+// send the given slot's command; returns false if the transmission failed
+bool sendTransaction(int slotidx)
+{
+  TransactionSlot &slot = transactionPool[slotidx];
+  ++slot.transaction.attempts;
+  slot.state = SLOT_AWAITING_REPLY;
+  slot.sendTime = millis();
+  activeSlot = slotidx;
+  return sendCommand(slot.transaction.byteid, slot.transaction.bytecommand, slot.transaction.dwordparameter,
+                     slot.transaction.sequence);
+}
+
+void tickBusTransactions()
+{
+  if (activeSlot != NO_TRANSACTION) {
+    TransactionSlot &slot = transactionPool[activeSlot];
+    if (millis() - slot.sendTime < slot.timeoutms) return;  // still waiting for the reply
+    if (!slot.expectReply) {
+      completeTransaction(activeSlot, TXN_SUCCESS);
+      return;
+    }
+    if (slot.retriesLeft == 0) {
+      completeTransaction(activeSlot, TXN_TIMEOUT);
+    } else {
+      --slot.retriesLeft;
+      if (!sendTransaction(activeSlot)) {
+        completeTransaction(activeSlot, TXN_SEND_FAILED);
+      }
+      return;
+    }
+  }
+
+  if (transactionsHeld || busSending()) return;  // another module has the bus, or the previous frame is still going out
+
+  int oldest = NO_TRANSACTION;
+  for (int i = 0; i < TRANSACTION_POOL_SIZE; ++i) {
+    if (transactionPool[i].state == SLOT_QUEUED
+        && (oldest == NO_TRANSACTION || (int16_t)(uint16_t)(transactionPool[i].ticket - transactionPool[oldest].ticket) < 0)) {
+      oldest = i;
+    }
+  }
+  if (oldest == NO_TRANSACTION) return;
+  if (!sendTransaction(oldest)) {
+    completeTransaction(oldest, TXN_SEND_FAILED);
+  }
+}
+
+void printBusTransactionStats(Print &dest)
+{
+  dest.print(F("requests lost:")); dest.println(lostRequestCount);
+  dest.print(F("replies lost:")); dest.println(lostReplyCount);
+}
+
+unsigned int consecutiveTimeouts()
+{
+  return consecutiveTimeoutCount;
+}
+
+void printTransaction(Print &dest, const Transaction &transaction)
+{
+  dest.print(F("id:")); dest.print(transaction.byteid, HEX);
+  dest.print(F(" cmd:")); dest.print(transaction.bytecommand, HEX);
+  switch (transaction.outcome) {
+    case TXN_SUCCESS: {
+      if (!commandExpectsReply(transaction.byteid, transaction.bytecommand)) {
+        dest.println(F(" sent"));
+        break;
+      }
+      dest.print(F(" status:")); dest.print(transaction.dwordstatus, HEX);
+      dest.print(F(" latency(ms):")); dest.print(transaction.latencyms);
+      if (transaction.attempts > 1) {
+        dest.print(F(" attempts:")); dest.print(transaction.attempts);
+        dest.print(transaction.replayed ? F(" (reply lost)") : F(" (request lost)"));
+      }
+      dest.println();
+      break;
+    }
+    case TXN_TIMEOUT: {
+      dest.print(F(" no reply after attempts:")); dest.println(transaction.attempts);
+      break;
+    }
+    case TXN_INVALID_COMMAND: {
+      dest.println(F(" rejected as invalid by slave"));
+      break;
+    }
+    case TXN_SEND_FAILED: {
+      dest.println(F(" transmission failed"));
+      break;
+    }
+    default: {
+      dest.println(F(" pending"));
+      break;
+    }
+  }
+}
@@ -0,0 +1,83 @@
+#ifndef BUSTRANSACTIONS_H
+#define BUSTRANSACTIONS_H
+#include <Arduino.h>
+#include "SlaveComms.h"
+
+// A transaction is one command sent to a slave plus the wait for its reply, retried if the reply doesn't arrive in time.
+// Broadcast and multicast commands don't get a reply; they are complete (TXN_SUCCESS) once sent.
+// Each transaction which expects a reply gets its own sequence number, and the retries are sent with the same one: if
+//   the slave received an earlier attempt, it repeats its reply without acting on the command again (so it is safe to
+//   retry any command), and the master can tell whether the request or the reply went missing.
+// The sequence numbers are counted per slave (see SlaveRecord::lastSequence), so the next request to a slave never
+//   has the same number as the one before it, however many transactions went to other slaves in between.
+// Transactions are queued into a fixed-size pool and sent one at a time (the bus is half duplex); the caller is
+//   notified via a callback when the transaction is complete, so the main loop keeps running in the meantime.
+
+enum TransactionOutcome {TXN_PENDING, TXN_SUCCESS, TXN_TIMEOUT, TXN_INVALID_COMMAND, TXN_SEND_FAILED};
+
+struct Transaction {
+  unsigned char byteid;
+  unsigned char bytecommand;
+  unsigned long dwordparameter;
+  unsigned long dwordstatus;     // the reply from the slave (only valid if outcome is TXN_SUCCESS)
+  TransactionOutcome outcome;
+  byte attempts;                 // number of times the command was sent
+  byte sequence;                 // NO_SEQUENCE for broadcast and multicast
+  bool replayed;                 // the reply was repeated by the slave: an earlier attempt's reply was lost
+  unsigned long latencyms;       // time from the last send to the reply
+  void *context;                 // supplied by the caller when queuing
+};
+
+typedef void (*TransactionCallback)(const Transaction &transaction);
+
+const int NO_TRANSACTION = -1;
+const byte DEFAULT_TRANSACTION_RETRIES = 2;
+const unsigned int DEFAULT_TRANSACTION_TIMEOUT_MS = 250;
+const unsigned int UNACKNOWLEDGED_FRAME_GAP_MS = 20;  // after a broadcast/multicast: give the slaves time to process the frame
+
+void setupBusTransactions();
+
+// call frequently; sends the next queued command when the bus is free and checks for reply timeouts
+void tickBusTransactions();
+
+// queue a command for sending to a slave.  callback may be NULL.
+// returns the slot used, or NO_TRANSACTION if the pool is full
+int queueTransaction(unsigned char byteid, unsigned char bytecommand, unsigned long dwordparameter,
+                     TransactionCallback callback, void *context,
+                     byte retries = DEFAULT_TRANSACTION_RETRIES, unsigned int timeoutms = DEFAULT_TRANSACTION_TIMEOUT_MS);
+
+// queue a broadcast to set the outputs of all slaves to the same value
+int queueBroadcastOutput(unsigned long outputs, TransactionCallback callback, void *context);
+
+// queue a multicast to set the outputs of the slaves firstbyteid .. firstbyteid + MULTICAST_GROUP_SIZE - 1
+//  outputs[0] is for firstbyteid, outputs[1] for firstbyteid+1, etc
+int queueMulticastOutputs(unsigned char firstbyteid, const byte outputs[], TransactionCallback callback, void *context);
+
+// queue a command to turn on / turn off / switch over the relays in mask (bit n = relay n), leaving the others as they
+//   are.  byteid may be BROADCAST_BYTEID
+int queueSetRelays(unsigned char byteid, unsigned long mask, TransactionCallback callback, void *context);
+int queueClearRelays(unsigned char byteid, unsigned long mask, TransactionCallback callback, void *context);
+int queueToggleRelays(unsigned char byteid, unsigned long mask, TransactionCallback callback, void *context);
+
+// number of transactions queued or waiting for a reply
+byte transactionsInFlight();
+
+// stop sending queued transactions, so that another module can send its own frames with sendCommand; the queue is kept.
+// The bus is free once busTransactionsHeld() returns true (the transaction in progress, if any, has finished)
+void holdBusTransactions(bool hold);
+bool busTransactionsHeld();
+
+// replies which don't belong to the transaction in progress (eg replies to frames sent with sendCommand while the
+//   transactions are held) are passed to callback.  NULL = ignore them
+void setUnsolicitedReplyCallback(SlaveReplyCallback callback);
+
+// print the number of retries caused by lost requests and by lost replies
+void printBusTransactionStats(Print &dest);
+
+// number of transactions in a row which have timed out, across all slaves (reset by any reply)
+unsigned int consecutiveTimeouts();
+
+// print a one-line description of the outcome of the transaction
+void printTransaction(Print &dest, const Transaction &transaction);
+
+#endif
@@ -0,0 +1,217 @@
+#include <Arduino.h>
+#include <SoftwareSerial.h>
+#include <DigitalIO.h>
+#include "BusTransport.h"
+
+const int RS485_RX_PIN = 10;
+const int RS485_TX_PIN = 11;
+const int RS485_SENDMODE_PIN = 12;
+
+DigitalPin<RS485_SENDMODE_PIN> pinSendMode;
+
+//------------------------------------------------------------------------------------------------
+SoftwareSerial rs485serial(RS485_RX_PIN, RS485_TX_PIN);
+SoftwareSerialTransport softwareSerialTransport;
+
+void SoftwareSerialTransport::begin(unsigned long baud)
+{
+  pinMode(RS485_RX_PIN, INPUT);
+  pinMode(RS485_TX_PIN, OUTPUT);
+  pinSendMode.mode(OUTPUT);
+  pinSendMode.write(LOW);
+  rs485serial.begin(baud);
+}
+
+void SoftwareSerialTransport::end()
+{
+  rs485serial.end();
+}
+
+int SoftwareSerialTransport::available()
+{
+  return rs485serial.available();
+}
+
+int SoftwareSerialTransport::read()
+{
+  return rs485serial.read();
+}
+
+// SoftwareSerial::write returns after the stop bit, so the driver can be released straight away
+bool SoftwareSerialTransport::sendFrame(const unsigned char frame[], byte length)
+{
+  pinSendMode.write(HIGH);
+  int byteswritten = rs485serial.write(frame, length);
+  pinSendMode.write(LOW);
+  return (byteswritten == length);
+}
+
+bool SoftwareSerialTransport::overflow()
+{
+  return rs485serial.overflow();
+}
+
+//------------------------------------------------------------------------------------------------
+#if defined(HARDWARE_UART_TRANSPORT_AVAILABLE)
+
+const byte UART_TX_BUFFER_SIZE = 16;  // must hold a complete frame
+const byte UART_RX_BUFFER_SIZE = 64;  // power of 2
+
+volatile unsigned char uartTxBuffer[UART_TX_BUFFER_SIZE];
+volatile byte uartTxIdx;
+volatile byte uartTxLength;
+volatile bool uartSending = false;
+
+volatile unsigned char uartRxBuffer[UART_RX_BUFFER_SIZE];
+volatile byte uartRxHead = 0;  // next byte to be written by the ISR
+volatile byte uartRxTail = 0;  // next byte to be read
+volatile bool uartRxOverflow = false;
+
+HardwareUartTransport hardwareUartTransport;
+
+void HardwareUartTransport::begin(unsigned long baud)
+{
+  pinSendMode.mode(OUTPUT);
+  pinSendMode.write(LOW);
+  uartSending = false;
+  uartRxHead = 0;
+  uartRxTail = 0;
+  unsigned int ubrr = (F_CPU / 4 / baud - 1) / 2;  // double speed mode, rounded
+  UCSR1A = _BV(U2X1);
+  UBRR1H = ubrr >> 8;
+  UBRR1L = ubrr & 0xff;
+  UCSR1C = _BV(UCSZ11) | _BV(UCSZ10);  // 8N1
+  UCSR1B = _BV(RXEN1) | _BV(TXEN1) | _BV(RXCIE1);
+}
+
+void HardwareUartTransport::end()
+{
+  UCSR1B = 0;
+  uartSending = false;
+  pinSendMode.write(LOW);
+}
+
+int HardwareUartTransport::available()
+{
+  return (byte)(uartRxHead - uartRxTail) % UART_RX_BUFFER_SIZE;
+}
+
+int HardwareUartTransport::read()
+{
+  if (uartRxHead == uartRxTail) return -1;
+  unsigned char c = uartRxBuffer[uartRxTail];
+  uartRxTail = (uartRxTail + 1) % UART_RX_BUFFER_SIZE;
+  return c;
+}
+
+// copy the frame, enable the driver and let the data register empty interrupt send it
+bool HardwareUartTransport::sendFrame(const unsigned char frame[], byte length)
+{
+  if (uartSending || length > UART_TX_BUFFER_SIZE) return false;
+  for (int i = 0; i < length; ++i) {
+    uartTxBuffer[i] = frame[i];
+  }
+  uartTxIdx = 0;
+  uartTxLength = length;
+  uartSending = true;
+  pinSendMode.write(HIGH);
+  UCSR1A |= _BV(TXC1);  // writing 1 clears any old transmit complete flag
+  UCSR1B |= _BV(UDRIE1) | _BV(TXCIE1);
+  return true;
+}
+
+bool HardwareUartTransport::sending()
+{
+  return uartSending;
+}
+
+bool HardwareUartTransport::overflow()
+{
+  bool overflowed = uartRxOverflow;
+  uartRxOverflow = false;
+  return overflowed;
+}
+
+ISR(USART1_RX_vect)
+{
+  unsigned char c = UDR1;
+  byte nexthead = (uartRxHead + 1) % UART_RX_BUFFER_SIZE;
+  if (nexthead == uartRxTail) {
+    uartRxOverflow = true;
+    return;
+  }
+  uartRxBuffer[uartRxHead] = c;
+  uartRxHead = nexthead;
+}
+
+ISR(USART1_UDRE_vect)
+{
+  UDR1 = uartTxBuffer[uartTxIdx++];
+  if (uartTxIdx >= uartTxLength) {
+    UCSR1B &= ~_BV(UDRIE1);
+  }
+}
+
+// the last stop bit has left the shift register: release the bus for the slave's reply
+ISR(USART1_TX_vect)
+{
+  pinSendMode.write(LOW);
+  UCSR1B &= ~_BV(TXCIE1);
+  uartSending = false;
+}
+
+#endif
+
+//------------------------------------------------------------------------------------------------
+const byte LOOPBACK_BUFFER_SIZE = 64;
+unsigned char loopbackBuffer[LOOPBACK_BUFFER_SIZE];
+byte loopbackHead = 0;
+byte loopbackCount = 0;
+bool loopbackOverflow = false;
+
+LoopbackTransport loopbackTransport;
+
+void LoopbackTransport::begin(unsigned long)
+{
+  loopbackHead = 0;
+  loopbackCount = 0;
+}
+
+int LoopbackTransport::available()
+{
+  return loopbackCount;
+}
+
+int LoopbackTransport::read()
+{
+  if (loopbackCount == 0) return -1;
+  unsigned char c = loopbackBuffer[loopbackHead];
+  loopbackHead = (loopbackHead + 1) % LOOPBACK_BUFFER_SIZE;
+  --loopbackCount;
+  return c;
+}
+
+bool LoopbackTransport::sendFrame(const unsigned char frame[], byte length)
+{
+  return injectReceived(frame, length);
+}
+
+bool LoopbackTransport::overflow()
+{
+  bool overflowed = loopbackOverflow;
+  loopbackOverflow = false;
+  return overflowed;
+}
+
+bool LoopbackTransport::injectReceived(const unsigned char data[], byte length)
+{
+  if (loopbackCount + length > LOOPBACK_BUFFER_SIZE) {
+    loopbackOverflow = true;
+    return false;
+  }
+  for (int i = 0; i < length; ++i) {
+    loopbackBuffer[(loopbackHead + loopbackCount) % LOOPBACK_BUFFER_SIZE] = data[i];
+    ++loopbackCount;
+  }
+  return true;
+}
@@ -0,0 +1,75 @@
+#ifndef BUSTRANSPORT_H
+#define BUSTRANSPORT_H
+#include <Arduino.h>
+
+// The connection between the master and the half-duplex RS485 bus.
+// A transport sends whole frames: it enables the RS485 driver (DE pin) for the frame, and releases it again once the
+//   last stop bit has left, so that the slave can reply.  sendFrame may return before the frame has been sent.
+
+class BusTransport {
+public:
+  virtual void begin(unsigned long baud) = 0;
+  virtual void end() {}
+  virtual const __FlashStringHelper *name() = 0;
+
+  virtual int available() = 0;
+  virtual int read() = 0;
+
+  // start sending the frame.  returns false if the transport can't accept it (eg the previous frame is still being sent)
+  virtual bool sendFrame(const unsigned char frame[], byte length) = 0;
+
+  // true while a frame is still being sent
+  virtual bool sending() { return false; }
+
+  // true if received bytes have been lost since the last call
+  virtual bool overflow() { return false; }
+};
+
+// SoftwareSerial on pins 10 (RX) and 11 (TX).  Blocks while sending, and disables interrupts for each byte.
+class SoftwareSerialTransport : public BusTransport {
+public:
+  virtual void begin(unsigned long baud);
+  virtual void end();
+  virtual const __FlashStringHelper *name() { return F("softwareserial"); }
+  virtual int available();
+  virtual int read();
+  virtual bool sendFrame(const unsigned char frame[], byte length);
+  virtual bool overflow();
+};
+
+extern SoftwareSerialTransport softwareSerialTransport;
+
+#if defined(UBRR1H)
+// Hardware UART 1 (eg pins 19 (RX1) and 18 (TX1) on a Mega).  Interrupt driven: sendFrame returns immediately,
+//   and the TX complete interrupt releases the RS485 driver exactly when the last stop bit has gone.
+class HardwareUartTransport : public BusTransport {
+public:
+  virtual void begin(unsigned long baud);
+  virtual void end();
+  virtual const __FlashStringHelper *name() { return F("hardwareuart"); }
+  virtual int available();
+  virtual int read();
+  virtual bool sendFrame(const unsigned char frame[], byte length);
+  virtual bool sending();
+  virtual bool overflow();
+};
+
+extern HardwareUartTransport hardwareUartTransport;
+#define HARDWARE_UART_TRANSPORT_AVAILABLE
+#endif
+
+// Everything sent is received straight back; injectReceived adds bytes as if received from the bus.  For testing.
+class LoopbackTransport : public BusTransport {
+public:
+  virtual void begin(unsigned long baud);
+  virtual const __FlashStringHelper *name() { return F("loopback"); }
+  virtual int available();
+  virtual int read();
+  virtual bool sendFrame(const unsigned char frame[], byte length);
+  virtual bool overflow();
+  bool injectReceived(const unsigned char data[], byte length);
+};
+
+extern LoopbackTransport loopbackTransport;
+
+#endif
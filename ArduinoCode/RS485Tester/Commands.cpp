@@ -2,24 +2,55 @@
 #include <SoftwareSerial.h>
 #include "Commands.h"
 #include "SystemStatus.h"
+#include "PulseTrain.h"
+#include "Profiler.h"
 #include "SlaveComms.h"
+#include "Crc16.h"
+#include "BusTransactions.h"
+#include "BusPoller.h"
+#include "SlaveTable.h"
+#if defined(RS485_HOST_BUILD)
+#include "BusSimulator.h"
+#endif
+#include "BusSpeed.h"
+#include "HostLink.h"
+#include "Macros.h"
+#include "Schedule.h"
+#include "DataLog.h"
+#include "Probes.h"
+#include "RelayBench.h"
+#include "Turnaround.h"
+#include "Discovery.h"
+#include "TimeSync.h"
 
-const int MAX_COMMAND_LENGTH = 30;
 const int COMMAND_BUFFER_SIZE = MAX_COMMAND_LENGTH + 2;  // if buffer fills to max size, truncation occurs
-int commandBufferIdx = -1;
-char commandBuffer[COMMAND_BUFFER_SIZE];  
 const char COMMAND_START_CHAR = '!';
 
-long timedelay = 1000; // default time (ms) for each transition
-const int C_PIN = 3;
-const int D_PIN = 4;
-const int L_PIN = 5;
+// Incoming commands are collected into a ring of buffers, so that the next commands can arrive while the current one runs.
+// Each command is executed in place from its buffer.  There is no separate tokenizer: collectCommands collapses the
+//   whitespace as the characters arrive, and each command parses its own arguments (parseLongFromString etc).
+const int COMMAND_RING_SIZE = 4;
+// If the ring is full, input is left in the hardware serial buffer until there is room.
+const int CONSOLE_RX_BUFFER_SIZE = 64;  // the hardware serial buffer
+char commandRing[COMMAND_RING_SIZE][COMMAND_BUFFER_SIZE];
+byte commandRingHead = 0;    // the oldest command (the one executing, if any)
+byte commandRingCount = 0;   // number of complete commands in the ring, including the one executing
+int commandBufferIdx = -1;   // position in the buffer being filled (after the last complete command); -1 = waiting for COMMAND_START_CHAR
+
+unsigned long commandsQueuedCount = 0;
+unsigned long commandRingFullCount = 0;     // times input was held back because the ring had filled up
+unsigned long commandsTooLongCount = 0;
+unsigned long consoleRxFullCount = 0;       // times the serial buffer was found to have filled up: input has probably been lost
+bool commandRingWasFull = false;            // the counts above are of the changes to full, not of the loops spent full
+bool consoleRxWasFull = false;
+
+unsigned long timedelayus = 1000000UL; // default time (us) for each transition
+const unsigned long MIN_TIME_DELAY_US = MIN_PULSETRAIN_STEP_US;   // the shortest step which polling can time (see PulseTrain.h)
+const unsigned long MAX_TIME_DELAY_US = 10000000UL;
 // currently doesn't do anything in particular
 void setupCommands()
 {
-  pinMode(C_PIN, OUTPUT);
-  pinMode(D_PIN, OUTPUT);
-  pinMode(L_PIN, OUTPUT);
+  setupPulseTrain();
 }
 
 // parse a long from the given string, returns in retval.  Also returns the ptr to the next character which wasn't parsed
@@ -47,7 +78,7 @@ bool parseULongFromHexString(const char *buffer, const char * &nextUnparsedChar,
   nextUnparsedChar = buffer;
   if (!isdigit(*buffer) && !(*buffer >= 'a' && *buffer <='f') && !(*buffer >= 'A' && *buffer <='F')) return false;
   char *forceNonConst = (char *)nextUnparsedChar;
-  retval = strtol(buffer, &forceNonConst, 16);
+  retval = strtoul(buffer, &forceNonConst, 16);   // strtol stops at 7FFFFFFF
   nextUnparsedChar = (const char *)forceNonConst;
   return true;
 }
@@ -68,32 +99,560 @@ bool parseFloatFromString(const char *buffer, const char * &nextUnparsedChar, fl
 }
 
 
-// output a pulse train on pins C, D, L.  
-//  each char corresponds to a pin 
-// c = c low
-// C = c high
-// d = d low
-// D = d high
-// l = l low
-// L = l high
-// delayms = duration of each pulse
-void pulsetrain(char command [], long delayms) {
-  int i;
-  for (i = 0; i < strlen(command); ++i) {
-    switch(command[i]) {
-      case 'c': digitalWrite(C_PIN,  LOW); break;    
-      case 'C': digitalWrite(C_PIN,  HIGH); break;    
-      case 'd': digitalWrite(D_PIN,  LOW); break;    
-      case 'D': digitalWrite(D_PIN,  HIGH); break;    
-      case 'l': digitalWrite(L_PIN,  LOW); break;    
-      case 'L': digitalWrite(L_PIN,  HIGH); break;    
+// queue a pulse train on pins C, D, L; see PulseTrain.h
+void pulsetrain(char command [], unsigned long delayus) {
+  if (!queuePulseTrain(command, delayus)) {
+    console->println(F("pulse train queue full; try again later or !a to abort")); 
+  }
+}
+
+// report the result of a command sent to a slave using !r
+void printCompletedTransaction(const Transaction &transaction)
+{
+  printTransaction(*console, transaction);
+}
+
+// turn on (+), turn off (-) or switch over (^) the relays in the mask, leaving the others alone, then poll to confirm
+//   e.g. "+{mask}".  byteid may be BROADCAST_BYTEID
+void changeRelays(unsigned char byteid, const char *command)
+{
+  char operation = *command;
+  unsigned long mask;
+  const char *nextUnparsedChar;
+  if (!parseULongFromHexString(command + 1, nextUnparsedChar, mask)) {
+    console->println(F("invalid parameters; type !? for help")); 
+    return;
+  }
+  int slot;
+  switch (operation) {
+    case '+': slot = queueSetRelays(byteid, mask, printCompletedTransaction, NULL); break;
+    case '-': slot = queueClearRelays(byteid, mask, printCompletedTransaction, NULL); break;
+    case '^': slot = queueToggleRelays(byteid, mask, printCompletedTransaction, NULL); break;
+    default: {
+      assertFailureCode = ASSERT_INVALID_SWITCH;
+      return;
+    }
+  }
+  if (slot == NO_TRANSACTION) {
+    console->println(F("too many commands in progress")); 
+    return;
+  }
+  pollSlaveSoon(byteid);
+}
+
+// send outputs to several slaves in a single frame, then poll them to confirm
+//  "* {output}" = the same output to all slaves (relays 0-31)
+//  "{firstByteID} {out0} {out1} {out2} {out3}" = individual outputs to four slaves (relays 0-7)
+//  "{byteID or *} +{mask}" / "-{mask}" / "^{mask}" = turn on / turn off / switch over some of the relays (see changeRelays)
+void multicastOutputs(const char *command)
+{
+  const char *nextUnparsedChar = command;
+  while (isspace(*nextUnparsedChar)) {
+    ++nextUnparsedChar;
+  }
+  bool broadcast = (*nextUnparsedChar == BROADCAST_BYTEID);
+  unsigned char firstbyteid = BROADCAST_BYTEID;
+  unsigned long broadcastOutput = 0;
+  unsigned long retval;
+  bool success = true;
+  if (broadcast) {
+    ++nextUnparsedChar;
+    while (isspace(*nextUnparsedChar)) {
+      ++nextUnparsedChar;
+    }
+    if (*nextUnparsedChar == '+' || *nextUnparsedChar == '-' || *nextUnparsedChar == '^') {
+      changeRelays(BROADCAST_BYTEID, nextUnparsedChar);
+      return;
+    }
+    success = parseULongFromHexString(nextUnparsedChar, nextUnparsedChar, broadcastOutput);
+  } else {
+    success = parseULongFromHexString(nextUnparsedChar, nextUnparsedChar, retval) && retval <= 0xFF;
+    firstbyteid = (unsigned char)retval;
+  }
+  if (success && !broadcast) {
+    while (isspace(*nextUnparsedChar)) {
+      ++nextUnparsedChar;
+    }
+    if (*nextUnparsedChar == '+' || *nextUnparsedChar == '-' || *nextUnparsedChar == '^') {
+      changeRelays(firstbyteid, nextUnparsedChar);
+      return;
+    }
+  }
+  byte outputs[MULTICAST_GROUP_SIZE];
+  for (int i = 0; success && !broadcast && i < MULTICAST_GROUP_SIZE; ++i) {
+    success = parseULongFromHexString(nextUnparsedChar, nextUnparsedChar, retval) && retval <= 0xFF;
+    outputs[i] = (byte)retval;
+  }
+  if (!success) {
+    console->println(F("invalid parameters; type !? for help")); 
+    return;
+  }
+  int slot = broadcast ? queueBroadcastOutput(broadcastOutput, printCompletedTransaction, NULL)
+                       : queueMulticastOutputs(firstbyteid, outputs, printCompletedTransaction, NULL);
+  if (slot == NO_TRANSACTION) {
+    console->println(F("too many commands in progress")); 
+    return;
+  }
+  if (broadcast) {
+    pollSlaveSoon(BROADCAST_BYTEID);
+  } else {
+    for (int i = 0; i < MULTICAST_GROUP_SIZE; ++i) {
+      pollSlaveSoon(firstbyteid + i);
+    }
+  }
+}
+
+#if defined(RS485_HOST_BUILD)
+// the bus simulator is only in the host build (see ../HostBuild)
+// "" = print the simulation statistics
+// "0" = stop simulating
+// "{count} {firstByteID}" = simulate count slaves and start polling them
+// "+{byteID}" = add another simulated slave, without polling it
+// "b {byteID} {boards}" = the number of relay modules (1 - 4) fitted to a simulated slave
+// "l {request loss %} {reply loss %}" = lose some of the frames at random
+void simulateBus(const char *command)
+{
+  long count;
+  unsigned long firstbyteid;
+  const char *nextUnparsedChar;
+  if (*command == 'l') {
+    long requestPercent, replyPercent;
+    if (!parseLongFromString(command+1, nextUnparsedChar, requestPercent) || requestPercent < 0 || requestPercent > 100
+        || !parseLongFromString(nextUnparsedChar, nextUnparsedChar, replyPercent) || replyPercent < 0 || replyPercent > 100) {
+      console->println(F("invalid parameters; type !? for help")); 
+      return;
+    }
+    setSimulatedLoss(requestPercent, replyPercent);
+    return;
+  }
+  if (*command == 'b') {
+    unsigned long byteid;
+    long boards;
+    if (!parseULongFromHexString(command+1, nextUnparsedChar, byteid) || byteid > 0xFF
+        || !parseLongFromString(nextUnparsedChar, nextUnparsedChar, boards) || boards < 1 || boards > 4) {
+      console->println(F("invalid parameters; type !? for help")); 
+      return;
+    }
+    if (!setSimulatedRelayBoards(byteid, boards)) {
+      console->println(F("no such simulated slave")); 
+      return;
+    }
+    console->print(F("relay modules fitted:")); console->println(boards);
+    return;
+  }
+  if (*command == '+') {
+    if (!parseULongFromHexString(command+1, nextUnparsedChar, firstbyteid) || firstbyteid > 0xFF) {
+      console->println(F("invalid parameters; type !? for help")); 
+      return;
+    }
+    if (!addSimulatedSlave(firstbyteid)) {
+      console->println(F("bus simulator not running, or no room for another slave")); 
+      return;
+    }
+    console->print(F("added simulated slave:")); console->println(firstbyteid, HEX);
+    return;
+  }
+  if (!parseLongFromString(command, nextUnparsedChar, count)) {
+    printBusSimulatorStats(*console);
+    return;
+  }
+  if (count == 0) {
+    stopBusSimulator();
+    console->println(F("using the real bus")); 
+    return;
+  }
+  if (count < 0 || !parseULongFromHexString(nextUnparsedChar, nextUnparsedChar, firstbyteid) || firstbyteid > 0xFF) {
+    console->println(F("invalid parameters; type !? for help")); 
+    return;
+  }
+  count = startBusSimulator(count > 0xFF ? 0xFF : count, firstbyteid);
+  for (int i = 0; i < count; ++i) {
+    if (!startPollingSlave(firstbyteid + i)) {
+      console->println(F("slave table full")); 
+      break;
+    }
+  }
+  console->print(F("simulated slaves:")); console->println(count);
+}
+#endif
+
+// select the transport used for the bus: "s" = SoftwareSerial, "h" = hardware UART, "l" = loopback
+// "" = show the current transport
+void selectBusTransport(const char *command)
+{
+  while (isspace(*command)) {
+    ++command;
+  }
+  BusTransport *transport = NULL;
+  switch (*command) {
+    case '\0': break;
+    case 's': transport = &softwareSerialTransport; break;
+#if defined(HARDWARE_UART_TRANSPORT_AVAILABLE)
+    case 'h': transport = &hardwareUartTransport; break;
+#endif
+    case 'l': transport = &loopbackTransport; break;
+    default: {
+      console->println(F("invalid or unavailable transport; type !? for help")); 
+      return;
+    }
+  }
+  if (transport != NULL) {
+#if defined(RS485_HOST_BUILD)
+    if (busSimulatorRunning()) stopBusSimulator();
+#endif
+    setBusTransport(transport);
+  }
+  console->print(F("bus transport:")); console->println(getBusTransport()->name());
+}
+
+// !f = show the bus speed.  !f {baud} = change the bus speed
+void busSpeed(const char *command)
+{
+  long baud;
+  const char *nextUnparsedChar;
+  if (!parseLongFromString(command, nextUnparsedChar, baud)) {
+    printBusSpeed(*console);
+    return;
+  }
+  if (!changeBusSpeed(baud)) {
+    console->println(F("invalid baud rate, no slaves being polled, or speed change in progress")); 
+    return;
+  }
+  console->println(F("changing bus speed...")); 
+}
+
+// !x = switch the console to binary mode.  !x {baud} = also change the console baud rate
+void binaryMode(const char *command)
+{
+  long baud = 0;
+  const char *nextUnparsedChar;
+  bool baudGiven = parseLongFromString(command, nextUnparsedChar, baud);
+  if ((baudGiven && baud <= 0) || (!baudGiven && *nextUnparsedChar != '\0')) {
+    console->println(F("invalid baud rate")); 
+    return;
+  }
+  console->println(F("binary mode; send HOST_EXIT to return")); 
+  startHostLink(baud);
+}
+
+// !m = list macros.  !m+ {name} = record, !m w {ms} = delay, !m. = save, !m> {name} = run, !m- {name} = delete, !mx = stop all
+void macroCommand(const char *command)
+{
+  while (isspace(*command)) {
+    ++command;
+  }
+  switch (command[0]) {
+    case '\0': {
+      printMacros(*console);
+      break;
+    }
+    case '+': {
+      if (!startMacroRecording(command+1)) {
+        console->println(F("invalid name, already recording, or no room for another macro")); 
+        break;
+      }
+      console->println(F("recording: !r and pulse train commands are saved instead of executed.  !m. to finish")); 
+      break;
+    }
+    case 'w': {
+      long delayms;
+      const char *nextUnparsedChar;
+      if (!macroRecording() || !parseLongFromString(command+1, nextUnparsedChar, delayms) || delayms < 0) {
+        console->println(F("not recording, or invalid delay")); 
+        break;
+      }
+      addMacroDelay(delayms);
+      break;
+    }
+    case '.': {
+      finishMacroRecording();
+      printMacros(*console);
+      break;
+    }
+    case '>': {
+      if (!runMacro(command+1)) {
+        console->println(F("macro not found, or too many macros running")); 
+      }
+      break;
+    }
+    case '-': {
+      if (!deleteMacro(command+1)) {
+        console->println(F("macro not found")); 
+      }
+      break;
+    }
+    case 'x': {
+      stopAllMacros();
+      break;
+    }
+    default: {
+      console->println(F("invalid macro command; type !? for help")); 
+      break;
+    }
+  }
+}
+
+// parse a time of day hh:mm or hh:mm:ss, returns the seconds since midnight in secondOfDay
+// returns false if not a valid time
+bool parseTimeOfDay(const char *buffer, const char * &nextUnparsedChar, unsigned long &secondOfDay)
+{
+  long hours, minutes, seconds = 0;
+  if (!parseLongFromString(buffer, nextUnparsedChar, hours) || *nextUnparsedChar != ':') return false;
+  if (!parseLongFromString(nextUnparsedChar + 1, nextUnparsedChar, minutes)) return false;
+  if (*nextUnparsedChar == ':' && !parseLongFromString(nextUnparsedChar + 1, nextUnparsedChar, seconds)) return false;
+  if (hours < 0 || hours > 23 || minutes < 0 || minutes > 59 || seconds < 0 || seconds > 59) return false;
+  secondOfDay = hours * 3600UL + minutes * 60UL + seconds;
+  return true;
+}
+
+// !w = show schedule.  !w t {day} {hh:mm[:ss]} = set clock, !w+ {byteID} {relay} {days} {hh:mm} {minutes} = add rule, !w- {rule} = delete rule
+void scheduleCommand(const char *command)
+{
+  while (isspace(*command)) {
+    ++command;
+  }
+  const char *nextUnparsedChar;
+  switch (command[0]) {
+    case '\0': {
+      printSchedule(*console);
+      break;
+    }
+    case 't': {
+      long day;
+      unsigned long secondOfDay;
+      if (!parseLongFromString(command+1, nextUnparsedChar, day) || day < 0 || day > 6
+          || !parseTimeOfDay(nextUnparsedChar, nextUnparsedChar, secondOfDay)) {
+        console->println(F("expected !w t {day 0=Mon - 6=Sun} {hh:mm[:ss]}")); 
+        break;
+      }
+      setScheduleClock(day, secondOfDay);
+      printSchedule(*console);
+      break;
+    }
+    case '+': {
+      unsigned long byteid, days, startSecond;
+      long relay, duration;
+      bool success = parseULongFromHexString(command+1, nextUnparsedChar, byteid) && byteid <= 0xFF
+                     && parseLongFromString(nextUnparsedChar, nextUnparsedChar, relay) && relay >= 0 && relay < MAX_RELAYS
+                     && parseULongFromHexString(nextUnparsedChar, nextUnparsedChar, days) && days <= ALL_DAYS
+                     && parseTimeOfDay(nextUnparsedChar, nextUnparsedChar, startSecond)
+                     && parseLongFromString(nextUnparsedChar, nextUnparsedChar, duration) && duration > 0 && duration <= (long)MINUTES_PER_DAY;
+      ScheduleRule rule;
+      if (success) {
+        rule.byteid = byteid;
+        rule.relay = relay;
+        rule.days = days;
+        rule.startMinute = startSecond / 60;
+        rule.durationMinutes = duration;
+        success = addScheduleRule(rule);
+      }
+      if (!success) {
+        console->println(F("invalid rule, or too many rules")); 
+        break;
+      }
+      printSchedule(*console);
+      break;
+    }
+    case '-': {
+      long ruleNumber;
+      if (!parseLongFromString(command+1, nextUnparsedChar, ruleNumber) || ruleNumber < 0 || !deleteScheduleRule(ruleNumber)) {
+        console->println(F("rule not found")); 
+        break;
+      }
+      printSchedule(*console);
+      break;
+    }
+    default: {
+      console->println(F("invalid schedule command; type !? for help")); 
+      break;
+    }
+  }
+}
+
+// !g = dump the transaction log, !gx = stop the dump, !g- = clear the log
+void dataLogCommand(const char *command)
+{
+  while (isspace(*command)) {
+    ++command;
+  }
+  switch (command[0]) {
+    case '\0': startDataLogDump(); break;
+    case 'x': stopDataLogDump(); break;
+    case '-': clearDataLog(); break;
+    default: console->println(F("invalid log command; type !? for help")); break;
+  }
+}
+
+// !e = show the last discovery scan, !e s = scan all byte ids, !e s {firstByteID} {lastByteID} = scan some, !ex = abort
+void discoveryCommand(const char *command)
+{
+  while (isspace(*command)) {
+    ++command;
+  }
+  switch (command[0]) {
+    case '\0': {
+      printDiscovery(*console);
+      break;
+    }
+    case 's': {
+      unsigned long firstbyteid = 0;
+      unsigned long lastbyteid = 0xFF;
+      const char *nextUnparsedChar;
+      if (parseULongFromHexString(command+1, nextUnparsedChar, firstbyteid)
+          && (!parseULongFromHexString(nextUnparsedChar, nextUnparsedChar, lastbyteid) || firstbyteid > lastbyteid || lastbyteid > 0xFF)) {
+        console->println(F("expected !e s {firstByteID} {lastByteID}")); 
+        break;
+      }
+      if (!startDiscovery(firstbyteid, lastbyteid)) {
+        console->println(F("discovery, turnaround tuning or bus speed change already in progress")); 
+        break;
+      }
+      console->println(F("scanning...")); 
+      break;
+    }
+    case 'x': {
+      abortDiscovery();
+      break;
+    }
+    default: {
+      console->println(F("invalid discovery command; type !? for help")); 
+      break;
+    }
+  }
+}
+
+// !n = show turnaround and latency, !n {byteID} = tune the slave's turnaround, !n * = tune all slaves in the table
+void turnaround(const char *command)
+{
+  while (isspace(*command)) {
+    ++command;
+  }
+  if (*command == '\0') {
+    printTurnaround(*console);
+    return;
+  }
+  unsigned long byteid = BROADCAST_BYTEID;
+  const char *nextUnparsedChar;
+  if (*command != BROADCAST_BYTEID && (!parseULongFromHexString(command, nextUnparsedChar, byteid) || byteid > 0xFF)) {
+    console->println(F("expected !n {byteID} or !n *")); 
+    return;
+  }
+  if (!startTurnaroundTuning(byteid)) {
+    console->println(F("slave not polled (see !q), or tuning or bus speed change already in progress")); 
+  }
+}
+
+// !y = show the bus tick, !y {byteID or *} {output} = stage outputs, !y {byteID or *} @{delay ms} = arm the staged outputs
+void timeSync(const char *command)
+{
+  while (isspace(*command)) {
+    ++command;
+  }
+  if (*command == '\0') {
+    printTimeSync(*console);
+    return;
+  }
+  unsigned long byteid = BROADCAST_BYTEID;
+  const char *nextUnparsedChar = command + 1;
+  if (*command != BROADCAST_BYTEID && (!parseULongFromHexString(command, nextUnparsedChar, byteid) || byteid > 0xFF)) {
+    console->println(F("expected !y {byteID or *} {output} or !y {byteID or *} @{delay ms}")); 
+    return;
+  }
+  while (isspace(*nextUnparsedChar)) {
+    ++nextUnparsedChar;
+  }
+  if (*nextUnparsedChar == '@') {
+    long delayms;
+    if (!parseLongFromString(nextUnparsedChar + 1, nextUnparsedChar, delayms) || delayms < 0 || delayms > 600000L) {
+      console->println(F("expected !y {byteID or *} @{delay ms 0-600000}")); 
+      return;
+    }
+    unsigned int tick = busTickNow() + (delayms + BUS_TICK_MS - 1) / BUS_TICK_MS;
+    if (!armStagedOutput(byteid, tick, printCompletedTransaction, NULL)) {
+      console->println(F("too many commands in progress, or too many ticks armed")); 
+      return;
     }
-    console->print(command[i]);
-    delay(timedelay);
+    console->print(F("armed for tick ")); 
+    console->println(tick);
+    return;
+  }
+  unsigned long outputs;
+  if (!parseULongFromHexString(nextUnparsedChar, nextUnparsedChar, outputs)) {
+    console->println(F("expected !y {byteID or *} {output} or !y {byteID or *} @{delay ms}")); 
+    return;
+  }
+  if (queueStageOutput(byteid, outputs, printCompletedTransaction, NULL) == NO_TRANSACTION) {
+    console->println(F("too many commands in progress")); 
   }
-  console->println("");
 }
 
+// !z = show the cached relay states of all polled slaves, !z {byteID} = one slave.  Doesn't use the bus
+void slaveStates(const char *command)
+{
+  while (isspace(*command)) {
+    ++command;
+  }
+  unsigned long byteid = BROADCAST_BYTEID;
+  const char *nextUnparsedChar;
+  if (*command != '\0' && (!parseULongFromHexString(command, nextUnparsedChar, byteid) || byteid > 0xFF)) {
+    console->println(F("expected !z or !z {byteID}")); 
+    return;
+  }
+  if (!printSlaveStates(*console, byteid)) {
+    console->println(F("slave not polled (see !q)")); 
+  }
+}
+
+// !k {byteID} {count} = benchmark the slave's relay module writes
+void relayBench(const char *command)
+{
+  unsigned long byteid;
+  long count;
+  const char *nextUnparsedChar;
+  if (!parseULongFromHexString(command, nextUnparsedChar, byteid) || byteid > 0xFF
+      || !parseLongFromString(nextUnparsedChar, nextUnparsedChar, count) || count < 1 || count > MAX_RELAY_BENCH_REPETITIONS) {
+    console->println(F("expected !k {byteID} {count 1-250}")); 
+    return;
+  }
+  if (!startRelayBench(byteid, count)) {
+    console->println(F("relay bench already running, or transaction queue full")); 
+  }
+}
+
+// !v = show probes, !v s {probe} {level} {noise} {spike interval} = synthetic samples, !vx = stop synthetic samples
+void probeCommand(const char *command)
+{
+  while (isspace(*command)) {
+    ++command;
+  }
+  switch (command[0]) {
+    case '\0': {
+      printProbes(*console);
+      break;
+    }
+    case 's': {
+      long probe, level, noise, spikeInterval;
+      const char *nextUnparsedChar;
+      if (!parseLongFromString(command+1, nextUnparsedChar, probe) || probe < 0 || probe >= NUMBER_OF_PROBES
+          || !parseLongFromString(nextUnparsedChar, nextUnparsedChar, level) || level < 0 || level > 1023
+          || !parseLongFromString(nextUnparsedChar, nextUnparsedChar, noise) || noise < 0 || noise > 1023
+          || !parseLongFromString(nextUnparsedChar, nextUnparsedChar, spikeInterval) || spikeInterval < 0 || spikeInterval > 10000) {
+        console->println(F("expected !v s {probe} {level 0-1023} {noise} {spike interval, 0 = none}")); 
+        break;
+      }
+      simulateProbe(probe, level, noise, spikeInterval);
+      break;
+    }
+    case 'x': {
+      stopProbeSimulation();
+      break;
+    }
+    default: {
+      console->println(F("invalid probe command; type !? for help")); 
+      break;
+    }
+  }
+}
 
 // execute the command encoded in commandString.  Null-terminated
 void executeCommand(char command[]) 
@@ -102,11 +661,38 @@ void executeCommand(char command[])
   switch (command[0]) {
     case '?': {
       commandIsValid = true;
-      console->println("commands (turn CR+LF on):");
-      console->println("!t {time} = set command delay time (ms)");
-      console->println("!cCdDlL = output train on pins C, D, L respectively.  c = low C = high etc.  Example: cDdCDd = cLo Dhi Dlo CHi Dhi Dlo");
-      console->println("!r {byteID} {byteCommand} {dwordParameter}.  = Send to RS485 Example !r 5A 34 FF03 ");
-      console->println("!s = send ! to RS485");
+      console->println(F("commands (turn CR+LF on):"));
+      console->println(F("!t {time} = set command delay time (ms).  !t {time}u = set command delay time (us).  At least 25 ms"));
+      console->println(F("!cCdDlL = output train on pins C, D, L respectively.  c = low C = high etc.  Example: cDdCDd = cLo Dhi Dlo CHi Dhi Dlo"));
+      console->println(F("!a = abort the pulse train in progress"));
+      console->println(F("!p = print the loop and command timing statistics, then reset them"));
+      console->println(F("!r {byteID} {byteCommand} {dwordParameter}.  = Send to RS485 Example !r 5A 34 FF03 "));
+      console->println(F("!o * {output} = broadcast output (relays 0-31) to all slaves.  !o {firstByteID} {out0} {out1} {out2} {out3} = multicast outputs (relays 0-7) to four slaves"));
+      console->println(F("!o {byteID or *} +{mask} / -{mask} / ^{mask} = turn on / turn off / switch over the relays in the mask, leaving the others alone"));
+      console->println(F("!s = send ! to RS485"));
+      console->println(F("!q = show the slave poll schedule.  !q+ {byteID} = start polling slave, !q- {byteID} = stop polling slave"));
+#if defined(RS485_HOST_BUILD)
+      console->println(F("!h {count} {firstByteID} = replace the bus with count simulated slaves and poll them.  !h 0 = use the real bus.  !h = show simulation"));
+      console->println(F("!h+ {byteID} = add another simulated slave, without polling it (eg a duplicate byte id)"));
+      console->println(F("!hl {request loss %} {reply loss %} = lose some of the simulated frames at random"));
+      console->println(F("!hb {byteID} {boards} = fit 1 - 4 relay modules to a simulated slave (default 4)"));
+#endif
+      console->println(F("!u = show the bus transport.  !u s = SoftwareSerial, !u h = hardware UART, !u l = loopback (testing)"));
+      console->println(F("!m = list macros.  !m+ {name} = start recording, !m w {ms} = add delay before next step, !m. = finish recording"));
+      console->println(F("!m> {name} = run macro, !m- {name} = delete macro, !mx = stop all running macros"));
+      console->println(F("!w = show watering schedule.  !w t {day 0=Mon-6=Sun} {hh:mm[:ss]} = set clock, !w- {rule} = delete rule"));
+      console->println(F("!w+ {byteID} {relay} {days bitmask, 1=Mon 40=Sun} {hh:mm} {minutes} = add rule.  Example !w+ 5A 3 7F 6:30 15"));
+      console->println(F("!g = dump the transaction log.  !gx = stop the dump, !g- = clear the log"));
+      console->println(F("!v = show soil probes.  !v s {probe} {level} {noise} {spike interval} = synthetic samples instead of ADC, !vx = stop synthetic samples"));
+      console->println(F("!x = switch to binary host protocol (see HostLink.h).  !x {baud} = also change the console baud rate"));
+      console->println(F("!f = show bus speed.  !f {baud} = change bus speed of master and polled slaves (4800, 9600, 19200, 38400)"));
+      console->println(F("!i = print status information"));
+      console->println(F("!b = check and benchmark the CRC16 calculation"));
+      console->println(F("!e = show the last discovery scan.  !e s = find the slaves on the bus, !e s {firstByteID} {lastByteID} = scan some byte ids, !ex = abort"));
+      console->println(F("!n = show slave turnaround and latency.  !n {byteID} = tune the slave's turnaround, !n * = tune all polled slaves"));
+      console->println(F("!k {byteID} {count} = time count writes of the slave's relay module (its relays must be off)"));
+      console->println(F("!z = show the cached relay states of the polled slaves.  !z {byteID} = one slave"));
+      console->println(F("!y = show bus tick.  !y {byteID or *} {output} = stage outputs (relays 0-31), !y {byteID or *} @{delay ms} = apply the staged outputs together after the delay"));
       break;
     }
     case 'C':
@@ -116,7 +702,13 @@ void executeCommand(char command[])
     case 'D':
     case 'd': {
       commandIsValid = true;
-      pulsetrain(command, timedelay);
+      if (macroRecording()) {
+        if (!recordPulseTrainStep(command, timedelayus)) {
+          console->println(F("macro full")); 
+        }
+      } else {
+        pulsetrain(command, timedelayus);
+      }
       break;
     }
     case 't': {
@@ -124,14 +716,34 @@ void executeCommand(char command[])
       long retval;
       const char *nextUnparsedChar;
       bool success = parseLongFromString(command+1, nextUnparsedChar, retval);
-      if (success) {
-        timedelay = retval;
-        if (timedelay < 10) timedelay = 10;
-        if (timedelay > 10000) timedelay = 10000;
-        console->print("time delay set to: ");
-        console->println(timedelay); 
+      if (success && retval >= 0) {
+        if (*nextUnparsedChar == 'u') {
+          timedelayus = retval;
+        } else {
+          timedelayus = (retval > (long)(MAX_TIME_DELAY_US / 1000)) ? MAX_TIME_DELAY_US : retval * 1000UL;
+        }
+        if (timedelayus < MIN_TIME_DELAY_US) timedelayus = MIN_TIME_DELAY_US;
+        if (timedelayus > MAX_TIME_DELAY_US) timedelayus = MAX_TIME_DELAY_US;
+        console->print(F("time delay set to (us): "));
+        console->println(timedelayus); 
       } else {
-        console->println("invalid time delay specified"); 
+        console->println(F("invalid time delay specified")); 
+      }
+      break;
+    }
+    case 'p': {
+      commandIsValid = true; 
+      printProfile(*console);
+      console->print(F("pulse train steps late:")); console->println(pulseTrainLateSteps);
+      pulseTrainLateSteps = 0;
+      break;
+    }
+    case 'a': {
+      commandIsValid = true; 
+      if (abortPulseTrain()) {
+        console->println(F("pulse train aborted")); 
+      } else {
+        console->println(F("no pulse train in progress")); 
       }
       break;
     }
@@ -143,76 +755,237 @@ void executeCommand(char command[])
       unsigned long dwordparameter;
       
       const char *nextUnparsedChar;
-      bool success = parseULongFromHexString(command+1, nextUnparsedChar, retval);
-      if (success && retval <= 0xFF) {
+      bool success = parseULongFromHexString(command+1, nextUnparsedChar, retval) && retval <= 0xFF;
+      if (success) {
         byteid = (unsigned char)retval;
-        success = parseULongFromHexString(nextUnparsedChar, nextUnparsedChar, retval);
+        success = parseULongFromHexString(nextUnparsedChar, nextUnparsedChar, retval) && retval <= 0xFF;
       }
-      if (success && retval <= 0xFF) {
+      if (success) {
         bytecommand = (unsigned char)retval;
         success = parseULongFromHexString(nextUnparsedChar, nextUnparsedChar, retval);
       }
-      if (success) {
+      if (success && macroRecording()) {
+        if (!recordBusCommandStep(byteid, bytecommand, retval)) {
+          console->println(F("macro full")); 
+        }
+      } else if (success) {
         dwordparameter = retval;
-        success = sendCommand(byteid, bytecommand, dwordparameter);
-        if (!success) {
-          console->println("transmission failed"); 
+        int slot = queueTransaction(byteid, bytecommand, dwordparameter, printCompletedTransaction, NULL);
+        if (slot == NO_TRANSACTION) {
+          console->println(F("too many commands in progress")); 
+        }
+        if (commandChangesOutputs(bytecommand)) {
+          pollSlaveSoon(byteid);
         }
       } else {
-        console->println("invalid parameters; type !? for help"); 
+        console->println(F("invalid parameters; type !? for help")); 
       }
       break;
     }
+    case 'o': {
+      commandIsValid = true; 
+      multicastOutputs(command+1);
+      break;
+    }
     case 's': {
       commandIsValid = true; 
       bool success = sendCommandTestChar();
-      console->print("bytes written:");
+      console->print(F("bytes written:"));
       console->println(success);
       if (!success) {
-        console->println("transmission failed"); 
+        console->println(F("transmission failed")); 
+      }
+      break;
+    }
+    case 'q': {
+      commandIsValid = true; 
+      if (command[1] != '+' && command[1] != '-') {
+        printPollSchedule(*console);
+        break;
+      }
+      unsigned long retval;
+      const char *nextUnparsedChar;
+      bool success = parseULongFromHexString(command+2, nextUnparsedChar, retval);
+      if (!success || retval > 0xFF) {
+        console->println(F("invalid parameters; type !? for help")); 
+      } else if (command[1] == '+') {
+        if (!startPollingSlave((unsigned char)retval)) console->println(F("slave table full")); 
+      } else {
+        if (!stopPollingSlave((unsigned char)retval)) console->println(F("slave not found")); 
       }
       break;
     }
+#if defined(RS485_HOST_BUILD)
+    case 'h': {
+      commandIsValid = true; 
+      simulateBus(command+1);
+      break;
+    }
+#endif
+    case 'u': {
+      commandIsValid = true; 
+      selectBusTransport(command+1);
+      break;
+    }
+    case 'f': {
+      commandIsValid = true; 
+      busSpeed(command+1);
+      break;
+    }
+    case 'x': {
+      commandIsValid = true; 
+      binaryMode(command+1);
+      break;
+    }
+    case 'm': {
+      commandIsValid = true; 
+      macroCommand(command+1);
+      break;
+    }
+    case 'w': {
+      commandIsValid = true; 
+      scheduleCommand(command+1);
+      break;
+    }
+    case 'g': {
+      commandIsValid = true; 
+      dataLogCommand(command+1);
+      break;
+    }
+    case 'v': {
+      commandIsValid = true; 
+      probeCommand(command+1);
+      break;
+    }
+    case 'e': {
+      commandIsValid = true; 
+      discoveryCommand(command+1);
+      break;
+    }
+    case 'n': {
+      commandIsValid = true; 
+      turnaround(command+1);
+      break;
+    }
+    case 'k': {
+      commandIsValid = true; 
+      relayBench(command+1);
+      break;
+    }
+    case 'y': {
+      commandIsValid = true; 
+      timeSync(command+1);
+      break;
+    }
+    case 'z': {
+      commandIsValid = true; 
+      slaveStates(command+1);
+      break;
+    }
+    case 'i': {
+      commandIsValid = true; 
+      printDebugInfo(*console);
+      printSlaveCommsStats(*console);
+      printBusTransactionStats(*console);
+      printHostLinkStats(*console);
+      printCommandStats(*console);
+      printDataLogStats(*console);
+      break;
+    }
+    case 'b': {
+      commandIsValid = true; 
+      benchmarkCrc16(*console);
+      break;
+    }
     default: {
       break;
     }
   }
 
   if (!commandIsValid) {
-    console->print("unknown command:");
+    console->print(F("unknown command:"));
     console->println(command);
-    console->println("use ? for help");
+    console->println(F("use ? for help"));
   }
 }
 
-// look for incoming serial input (commands); collect the command and execute it when the entire command has arrived.
-void tickCommands()
+// move any incoming serial input into the command ring.  Doesn't execute anything, so it can be called from within a
+//   command which takes a long time.
+// Whitespace is collapsed to single spaces and carriage returns are dropped as the characters arrive.
+void collectCommands()
 {
+  if (hostLinkActive()) return;
+  bool consoleRxFull = (consoleInput->available() >= CONSOLE_RX_BUFFER_SIZE - 1);
+  if (consoleRxFull && !consoleRxWasFull) ++consoleRxFullCount;
+  consoleRxWasFull = consoleRxFull;
   while (consoleInput->available()) {
-    if (commandBufferIdx < -1  || commandBufferIdx > COMMAND_BUFFER_SIZE) {
+    if (commandRingCount >= COMMAND_RING_SIZE) {
+      if (!commandRingWasFull) ++commandRingFullCount;
+      commandRingWasFull = true;
+      return;
+    }
+    commandRingWasFull = false;
+    if (commandBufferIdx < -1 || commandBufferIdx > COMMAND_BUFFER_SIZE) {
       assertFailureCode = ASSERT_INDEX_OUT_OF_BOUNDS;
       commandBufferIdx = -1;
     }
+    char *commandBuffer = commandRing[(commandRingHead + commandRingCount) % COMMAND_RING_SIZE];
     int nextChar = consoleInput->read();
     if (nextChar == COMMAND_START_CHAR) {
-      commandBufferIdx = 0;        
+      commandBufferIdx = 0;
     } else if (nextChar == '\n') {
       if (commandBufferIdx == -1) {
-        console->println("Type !? for help");
+        console->println(F("Type !? for help"));
       } else if (commandBufferIdx > 0) {
         if (commandBufferIdx > MAX_COMMAND_LENGTH) {
           commandBuffer[MAX_COMMAND_LENGTH] = '\0';
-          console->print("Command too long:"); console->println(commandBuffer);
+          ++commandsTooLongCount;
+          console->print(F("Command too long:")); console->println(commandBuffer);
         } else {
-          commandBuffer[commandBufferIdx++] = '\0';
-          executeCommand(commandBuffer);
-        } 
-        commandBufferIdx = -1; 
+          if (commandBuffer[commandBufferIdx-1] == ' ') --commandBufferIdx;
+          commandBuffer[commandBufferIdx] = '\0';
+          ++commandRingCount;
+          ++commandsQueuedCount;
+        }
       }
+      commandBufferIdx = -1;
+    } else if (nextChar == '\r') {
+      // ignore
     } else {
+      if (isspace(nextChar)) {
+        nextChar = ' ';
+        if (commandBufferIdx == 0 || (commandBufferIdx > 0 && commandBuffer[commandBufferIdx-1] == ' ')) continue;
+      }
       if (commandBufferIdx >= 0 && commandBufferIdx < COMMAND_BUFFER_SIZE) {
         commandBuffer[commandBufferIdx++] = nextChar;
       }
     }
   }
 }
+
+// continue any pulse train in progress, then
+// look for incoming serial input (commands); collect the commands and execute the oldest one.
+void tickCommands()
+{
+  tickPulseTrain();
+  if (hostLinkActive()) {
+    tickHostLink();
+    return;
+  }
+  collectCommands();
+  if (commandRingCount == 0) return;
+  char *command = commandRing[commandRingHead];
+  unsigned long starttime = micros();
+  executeCommand(command);
+  profileCommand(command, starttime);
+  commandRingHead = (commandRingHead + 1) % COMMAND_RING_SIZE;
+  --commandRingCount;
+}
+
+void printCommandStats(Print &dest)
+{
+  dest.print(F("commands queued:")); dest.println(commandsQueuedCount);
+  dest.print(F("command queue full:")); dest.println(commandRingFullCount);
+  dest.print(F("commands too long:")); dest.println(commandsTooLongCount);
+  dest.print(F("console rx buffer full:")); dest.println(consoleRxFullCount);
+}
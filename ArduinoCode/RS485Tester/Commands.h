@@ -2,6 +2,8 @@
 #define COMMANDS_H  
 #include <Arduino.h>
 
+const int MAX_COMMAND_LENGTH = 30;
+
 // prepare for receiving/executing commands
 void setupCommands();
 
@@ -11,5 +13,10 @@ void executeCommand(char command[]);
 //call at frequent intervals (eg 100 ms) to check for new commands or continue the processing of any command currently in progress
 void tickCommands();
 
+// collect any incoming commands without executing them (call this while waiting inside a long command)
+void collectCommands();
+
+void printCommandStats(Print &dest);
+
 
 #endif
@@ -0,0 +1,38 @@
+#ifndef CRC16_H
+#define CRC16_H
+#include <Arduino.h>
+
+// CRC16 (CCITT polynomial 0x1021, initial value 0xFFFF, no final xor) - same as calculatecrc16 in RelayControlModule.bas
+// Incremental use:
+//   unsigned short crc = crc16Init();
+//   crc = crc16Update(crc, nextbyte);  // for each byte, as it arrives
+//   checksum = crc16Finalize(crc);
+
+extern const unsigned short CRC16_TABLE[256] PROGMEM;
+
+inline unsigned short crc16Init()
+{
+  return 0xFFFF;
+}
+
+inline unsigned short crc16Update(unsigned short crc, unsigned char databyte)
+{
+  return (crc << 8) ^ pgm_read_word(&CRC16_TABLE[(unsigned char)(crc >> 8) ^ databyte]);
+}
+
+inline unsigned short crc16Finalize(unsigned short crc)
+{
+  return crc;
+}
+
+// calculate a CRC16 checksum of the given message
+unsigned short crc16(const unsigned char* data_p, unsigned char length);
+
+// the original bit-shuffling calculation, kept as a reference for checking the table
+unsigned short crc16Bitwise(const unsigned char* data_p, unsigned char length);
+
+// check the table-driven crc16 against the reference, and measure the speed of each.
+// prints the results to dest.  returns true if the two calculations agree.
+bool benchmarkCrc16(Print &dest);
+
+#endif
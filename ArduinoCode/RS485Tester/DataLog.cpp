@@ -0,0 +1,125 @@
+#include <Arduino.h>
+#include "DataLog.h"
+#include "SystemStatus.h"
+
+struct LogRecord {
+  unsigned long timems;          // millis() when the transaction was complete
+  unsigned long dwordparameter;
+  unsigned char byteid;
+  unsigned char bytecommand;
+  byte outcome;                  // TransactionOutcome
+  byte attempts;
+  unsigned int latencyms;        // limited to 0xFFFF
+};
+
+const int DATALOG_SIZE = 32;     // must be a power of two
+const int DATALOG_INDEX_MASK = DATALOG_SIZE - 1;
+const int DATALOG_LINE_LENGTH = 40;   // longest dump line, including CR LF
+const byte DATALOG_MAX_LINES_PER_TICK = 2;
+
+LogRecord dataLog[DATALOG_SIZE];
+unsigned long dataLogWriteCount = 0;   // total number of records ever written; the next record goes at this % DATALOG_SIZE
+unsigned long dataLogClearedAt = 0;    // the value of dataLogWriteCount when the log was last cleared
+
+bool dumpRunning = false;
+unsigned long dumpNextRecord;    // the next record to print (counting the same way as dataLogWriteCount)
+unsigned long dumpEndRecord;
+unsigned long dataLogLostCount = 0;    // records which were overwritten before they could be dumped
+
+void setupDataLog()
+{
+  dataLogWriteCount = 0;
+  dataLogClearedAt = 0;
+  dumpRunning = false;
+}
+
+void logTransaction(const Transaction &transaction)
+{
+  LogRecord &record = dataLog[dataLogWriteCount & DATALOG_INDEX_MASK];
+  record.timems = millis();
+  record.dwordparameter = transaction.dwordparameter;
+  record.byteid = transaction.byteid;
+  record.bytecommand = transaction.bytecommand;
+  record.outcome = transaction.outcome;
+  record.attempts = transaction.attempts;
+  record.latencyms = (transaction.latencyms > 0xFFFF) ? 0xFFFF : transaction.latencyms;
+  ++dataLogWriteCount;
+}
+
+// the oldest record which is still in the log
+unsigned long oldestLogRecord()
+{
+  unsigned long oldest = dataLogClearedAt;
+  if (dataLogWriteCount - oldest > DATALOG_SIZE) oldest = dataLogWriteCount - DATALOG_SIZE;
+  return oldest;
+}
+
+void clearDataLog()
+{
+  dumpRunning = false;
+  dataLogClearedAt = dataLogWriteCount;
+}
+
+void startDataLogDump()
+{
+  clearErrorFlag(ERRORCODE_DATALOG);
+  dumpNextRecord = oldestLogRecord();
+  dumpEndRecord = dataLogWriteCount;
+  dumpRunning = true;
+  console->print(F("records:")); console->println(dumpEndRecord - dumpNextRecord);
+  console->println(F("time(ms) id cmd parameter outcome attempts latency(ms)"));
+}
+
+void stopDataLogDump()
+{
+  dumpRunning = false;
+}
+
+void printLogRecord(Print &dest, const LogRecord &record)
+{
+  dest.print(record.timems); dest.print(' ');
+  dest.print(record.byteid, HEX); dest.print(' ');
+  dest.print(record.bytecommand, HEX); dest.print(' ');
+  dest.print(record.dwordparameter, HEX); dest.print(' ');
+  switch (record.outcome) {
+    case TXN_SUCCESS: dest.print(F("ok")); break;
+    case TXN_TIMEOUT: dest.print(F("timeout")); break;
+    case TXN_INVALID_COMMAND: dest.print(F("invalid")); break;
+    case TXN_SEND_FAILED: dest.print(F("sendfail")); break;
+    default: dest.print(record.outcome); break;
+  }
+  dest.print(' ');
+  dest.print(record.attempts); dest.print(' ');
+  dest.println(record.latencyms);
+}
+
+// print the next few records of the dump, if the console has room for them
+void tickDataLog()
+{
+  if (!dumpRunning) return;
+  for (byte lines = 0; lines < DATALOG_MAX_LINES_PER_TICK; ++lines) {
+    if (dumpNextRecord == dumpEndRecord) {
+      console->println(F("end of log"));
+      dumpRunning = false;
+      return;
+    }
+    unsigned long oldest = oldestLogRecord();
+    if ((long)(dumpNextRecord - oldest) < 0) {
+      dataLogLostCount += oldest - dumpNextRecord;
+      setErrorFlag(ERRORCODE_DATALOG);
+      console->print(F("records lost:")); console->println(oldest - dumpNextRecord);
+      dumpNextRecord = oldest;
+      if ((long)(dumpEndRecord - oldest) < 0) dumpEndRecord = oldest;
+      return;
+    }
+    if (console->availableForWrite() < DATALOG_LINE_LENGTH) return;
+    printLogRecord(*console, dataLog[dumpNextRecord & DATALOG_INDEX_MASK]);
+    ++dumpNextRecord;
+  }
+}
+
+void printDataLogStats(Print &dest)
+{
+  dest.print(F("log records written:")); dest.println(dataLogWriteCount);
+  dest.print(F("log records lost by dump:")); dest.println(dataLogLostCount);
+}
@@ -0,0 +1,28 @@
+#ifndef DATALOG_H
+#define DATALOG_H
+#include <Arduino.h>
+#include "BusTransactions.h"
+
+// Transaction log: a circular buffer of compact binary records, one for each completed bus transaction (including
+//   every output change sent to the slaves).  When full, the oldest records are overwritten.
+// Appending a record is a fixed-size copy; the records are only formatted when they are dumped.
+// A dump streams the records to the console a few at a time from tickDataLog, only writing as much as the console
+//   can accept without blocking, so the main loop keeps running.  If the dump falls so far behind that records are
+//   overwritten before being printed, ERRORCODE_DATALOG is shown until the next dump is started.
+
+void setupDataLog();
+void tickDataLog();
+
+// called by BusTransactions when a transaction is complete
+void logTransaction(const Transaction &transaction);
+
+// start streaming the log (oldest first) to the console; the dump ends at the last record in the log when it was started
+void startDataLogDump();
+void stopDataLogDump();
+
+// discard all records
+void clearDataLog();
+
+void printDataLogStats(Print &dest);
+
+#endif
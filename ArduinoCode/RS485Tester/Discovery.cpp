@@ -0,0 +1,343 @@
+#include <Arduino.h>
+#include "Discovery.h"
+#include "BusTransactions.h"
+#include "BusPoller.h"
+#include "BusSpeed.h"
+#include "SlaveComms.h"
+#include "SlaveTable.h"
+#include "SystemStatus.h"
+#include "Turnaround.h"
+
+const byte MAX_DISCOVERY_BURST = 16;
+const unsigned long DISCOVERY_PROBE_GAP_MS = 5;       // between probes, and so between the replies, for the slaves' timing errors
+const unsigned long DISCOVERY_BURST_MARGIN_MS = 5;    // the last probe of a burst must be finished this long before the first reply
+const unsigned long DISCOVERY_REPLY_SLACK_MS = 10;    // keep listening this long after the last reply is due
+const byte DISCOVERY_CONFIRM_PROBES = 3;              // a suspected duplicate is probed on its own up to this many times
+const byte DISCOVERY_DUPLICATE_GARBLES = 2;           // a duplicate if this many of those replies are garbled
+const unsigned long FRAME_BITS = (1+1+1+4+1+2) * 10;  // a probe (and its reply): 10 bytes of start bit + 8 data bits + stop bit
+const unsigned long DISCOVERY_TURNAROUND_MS = DEFAULT_REPLY_DELAY_MS + DEFAULT_DRIVER_SWITCH_DELAY_MS;
+const int BYTEID_BITMAP_SIZE = 256 / 8;
+
+enum DiscoveryState {DISCOVERY_IDLE, DISCOVERY_WAITING_FOR_BUS, DISCOVERY_RESETTING_TURNAROUND,
+                     DISCOVERY_SENDING, DISCOVERY_LISTENING};
+enum DiscoveryPhase {PHASE_SWEEP, PHASE_CONFIRM};
+
+DiscoveryState discoveryState = DISCOVERY_IDLE;
+DiscoveryPhase discoveryPhase;
+bool discoveryAborted;
+bool turnaroundsReset;            // the broadcast to reset the turnarounds has been sent
+unsigned char discoveryFirstByteid;
+unsigned int discoveryLastByteid;
+unsigned int nextByteid;          // unsigned int so that it can go past 0xFF
+unsigned char confirmByteid;      // the suspect being probed on its own
+byte confirmProbes;
+byte confirmGarbles;
+
+unsigned char burstByteids[MAX_DISCOVERY_BURST];
+unsigned long burstReplyDue[MAX_DISCOVERY_BURST];   // ms from the start of the burst
+bool burstReplied[MAX_DISCOVERY_BURST];
+bool burstGarbled[MAX_DISCOVERY_BURST];
+byte burstCount;
+unsigned long burstStartTime;
+unsigned long garbledCount;
+unsigned long discoveryWaitUntil;
+
+byte foundByteids[BYTEID_BITMAP_SIZE];
+byte suspectByteids[BYTEID_BITMAP_SIZE];
+byte duplicateByteids[BYTEID_BITMAP_SIZE];
+bool discoveryResults = false;    // true once a scan has been run
+unsigned long discoveryStartTime;
+unsigned long discoveryDurationms;
+unsigned int probesSent;
+
+bool byteidInBitmap(const byte bitmap[], unsigned char byteid)
+{
+  return (bitmap[byteid >> 3] & (1 << (byteid & 7))) != 0;
+}
+
+void addByteidToBitmap(byte bitmap[], unsigned char byteid)
+{
+  bitmap[byteid >> 3] |= (1 << (byteid & 7));
+}
+
+void printBitmap(Print &dest, const byte bitmap[])
+{
+  for (int i = 0; i < 256; ++i) {
+    if (!byteidInBitmap(bitmap, i)) continue;
+    dest.print(' '); dest.print(i, HEX);
+  }
+  dest.println();
+}
+
+unsigned long frameTimems()
+{
+  return (FRAME_BITS * 1000UL + getBusBaudRate() - 1) / getBusBaudRate();
+}
+
+// the time from the start of the burst at which the next probe can be sent
+unsigned long nextProbeTimems()
+{
+  return burstCount * (frameTimems() + DISCOVERY_PROBE_GAP_MS);
+}
+
+void setupDiscovery()
+{
+  discoveryState = DISCOVERY_IDLE;
+  discoveryResults = false;
+}
+
+void discoveryReplyReceived(const SlaveReply &reply)
+{
+  if (discoveryState != DISCOVERY_SENDING && discoveryState != DISCOVERY_LISTENING) return;
+  if (reply.bytecommand != COMMAND_ALIVE) return;
+  for (byte i = 0; i < burstCount; ++i) {
+    if (burstByteids[i] == reply.byteid) burstReplied[i] = true;
+  }
+}
+
+bool startDiscovery(unsigned char firstbyteid, unsigned char lastbyteid)
+{
+  if (discoveryState != DISCOVERY_IDLE || turnaroundTuningInProgress() || busSpeedChangeInProgress()) return false;
+  memset(foundByteids, 0, sizeof(foundByteids));
+  memset(suspectByteids, 0, sizeof(suspectByteids));
+  memset(duplicateByteids, 0, sizeof(duplicateByteids));
+  discoveryFirstByteid = firstbyteid;
+  discoveryLastByteid = lastbyteid;
+  nextByteid = firstbyteid;
+  discoveryPhase = PHASE_SWEEP;
+  discoveryAborted = false;
+  turnaroundsReset = false;
+  discoveryResults = true;
+  probesSent = 0;
+  discoveryStartTime = millis();
+  pausePolling(true);
+  holdBusTransactions(true);
+  setUnsolicitedReplyCallback(discoveryReplyReceived);
+  discoveryState = DISCOVERY_WAITING_FOR_BUS;
+  return true;
+}
+
+void discoveryFinished()
+{
+  discoveryDurationms = millis() - discoveryStartTime;
+  discoveryState = DISCOVERY_IDLE;
+  setUnsolicitedReplyCallback(NULL);
+  holdBusTransactions(false);
+
+  if (turnaroundsReset) {
+    for (int i = 0; i < MAX_SLAVES; ++i) {
+      slaveTable[i].replyDelayms = DEFAULT_REPLY_DELAY_MS;
+    }
+    resetSlaveLatencies();
+  }
+  bool tableFull = false;
+  bool duplicates = false;
+  for (int i = 0; i < 256; ++i) {
+    if (byteidInBitmap(duplicateByteids, i)) duplicates = true;
+    if (byteidInBitmap(foundByteids, i) && !startPollingSlave(i)) tableFull = true;
+  }
+  if (duplicates) {
+    setErrorFlag(ERRORCODE_DUPLICATE_BYTEID);
+  } else {
+    clearErrorFlag(ERRORCODE_DUPLICATE_BYTEID);
+  }
+  pausePolling(false);
+  pollSlaveSoon(BROADCAST_BYTEID);
+
+  printDiscovery(*console);
+  if (tableFull) console->println(F("slave table full: not all the slaves found are being polled"));
+}
+
+void startBurst()
+{
+  burstCount = 0;
+  garbledCount = rxGarbledCount();
+  discoveryState = DISCOVERY_SENDING;
+}
+
+// the byte id for the next probe of the burst; false = the burst is complete
+bool nextBurstByteid(unsigned char &byteid)
+{
+  if (discoveryPhase == PHASE_CONFIRM) {
+    byteid = confirmByteid;
+    return burstCount == 0;
+  }
+  if (burstCount >= MAX_DISCOVERY_BURST) return false;
+  if (burstCount > 0 && millis() - burstStartTime + DISCOVERY_BURST_MARGIN_MS > DISCOVERY_TURNAROUND_MS) return false;
+  while (nextByteid <= discoveryLastByteid) {
+    byteid = nextByteid++;
+    if (byteid != BROADCAST_BYTEID) return true;
+  }
+  return false;
+}
+
+// send the probes of the burst one after another, spaced out by a gap, then listen for the replies
+void tickSendProbes()
+{
+  if (busSending() || (burstCount > 0 && millis() - burstStartTime < nextProbeTimems())) return;
+  unsigned char byteid;
+  if (!nextBurstByteid(byteid)) {
+    discoveryWaitUntil = (burstCount == 0) ? millis()
+                         : burstStartTime + burstReplyDue[burstCount - 1] + frameTimems() + DISCOVERY_REPLY_SLACK_MS;
+    discoveryState = DISCOVERY_LISTENING;
+    return;
+  }
+  if (burstCount == 0) burstStartTime = millis();
+  burstByteids[burstCount] = byteid;
+  burstReplyDue[burstCount] = millis() - burstStartTime + frameTimems() + DISCOVERY_TURNAROUND_MS;
+  burstReplied[burstCount] = false;
+  burstGarbled[burstCount] = false;
+  ++burstCount;
+  ++probesSent;
+  sendCommand(byteid, COMMAND_ALIVE, 0);
+}
+
+// if garbled bytes have arrived, suspect the probe whose reply was due at the time, and the one before (a garbled reply
+//   may only be noticed once the next one starts).  Before the first reply is due, suspect all the probes sent so far
+void checkForGarbledReplies()
+{
+  unsigned long count = rxGarbledCount();
+  if (count == garbledCount || burstCount == 0) return;
+  garbledCount = count;
+  unsigned long elapsedms = millis() - burstStartTime;
+  byte last = 0;
+  while (last + 1 < burstCount && burstReplyDue[last + 1] <= elapsedms) {
+    ++last;
+  }
+  byte first = (elapsedms < burstReplyDue[0]) ? 0 : ((last > 0) ? last - 1 : 0);
+  for (byte i = first; i <= last; ++i) {
+    burstGarbled[i] = true;
+  }
+}
+
+// move on to the next suspected duplicate; returns false if there are no more
+bool nextSuspect()
+{
+  while (nextByteid <= discoveryLastByteid) {
+    confirmByteid = nextByteid++;
+    if (byteidInBitmap(suspectByteids, confirmByteid)) {
+      confirmProbes = 0;
+      confirmGarbles = 0;
+      return true;
+    }
+  }
+  return false;
+}
+
+// all the replies to the burst are in (or are never coming)
+void burstComplete()
+{
+  checkForGarbledReplies();
+  if (discoveryAborted) {
+    discoveryFinished();
+    return;
+  }
+  if (discoveryPhase == PHASE_SWEEP) {
+    for (byte i = 0; i < burstCount; ++i) {
+      if (burstReplied[i]) {
+        addByteidToBitmap(foundByteids, burstByteids[i]);
+      } else if (burstGarbled[i]) {
+        addByteidToBitmap(suspectByteids, burstByteids[i]);
+      }
+    }
+    if (nextByteid <= discoveryLastByteid) {
+      startBurst();
+      return;
+    }
+    discoveryPhase = PHASE_CONFIRM;
+    nextByteid = discoveryFirstByteid;
+  } else {
+    ++confirmProbes;
+    if (burstReplied[0]) {
+      addByteidToBitmap(foundByteids, confirmByteid);
+    } else {
+      if (burstGarbled[0]) ++confirmGarbles;
+      if (confirmGarbles >= DISCOVERY_DUPLICATE_GARBLES) {
+        addByteidToBitmap(duplicateByteids, confirmByteid);
+      } else if (confirmProbes < DISCOVERY_CONFIRM_PROBES) {
+        startBurst();
+        return;
+      }
+    }
+  }
+  if (!nextSuspect()) {
+    discoveryFinished();
+    return;
+  }
+  startBurst();
+}
+
+void tickDiscovery()
+{
+  switch (discoveryState) {
+    case DISCOVERY_IDLE: {
+      break;
+    }
+    case DISCOVERY_WAITING_FOR_BUS: {
+      if (!busTransactionsHeld() || busSending()) break;
+      if (discoveryAborted) {
+        discoveryFinished();
+        break;
+      }
+      turnaroundsReset = true;
+      sendCommand(BROADCAST_BYTEID, COMMAND_SET_TURNAROUND,
+                  DEFAULT_REPLY_DELAY_MS | ((unsigned int)DEFAULT_DRIVER_SWITCH_DELAY_MS << 8));
+      discoveryWaitUntil = millis() + frameTimems() + UNACKNOWLEDGED_FRAME_GAP_MS;
+      discoveryState = DISCOVERY_RESETTING_TURNAROUND;
+      break;
+    }
+    case DISCOVERY_RESETTING_TURNAROUND: {
+      if ((long)(millis() - discoveryWaitUntil) < 0) break;
+      if (discoveryAborted) {
+        discoveryFinished();
+        break;
+      }
+      startBurst();
+      break;
+    }
+    case DISCOVERY_SENDING: {
+      checkForGarbledReplies();
+      tickSendProbes();
+      break;
+    }
+    case DISCOVERY_LISTENING: {
+      checkForGarbledReplies();
+      if ((long)(millis() - discoveryWaitUntil) >= 0) burstComplete();
+      break;
+    }
+    default: {
+      assertFailureCode = ASSERT_INVALID_SWITCH;
+      discoveryFinished();
+      break;
+    }
+  }
+}
+
+void abortDiscovery()
+{
+  if (discoveryState != DISCOVERY_IDLE) discoveryAborted = true;
+}
+
+bool discoveryInProgress()
+{
+  return discoveryState != DISCOVERY_IDLE;
+}
+
+void printDiscovery(Print &dest)
+{
+  if (!discoveryResults) {
+    dest.println(F("no discovery scan yet"));
+    return;
+  }
+  dest.print(F("discovery of byte ids ")); dest.print(discoveryFirstByteid, HEX);
+  dest.print('-'); dest.print(discoveryLastByteid, HEX);
+  if (discoveryState != DISCOVERY_IDLE) {
+    dest.print(F(" in progress, next:")); dest.println(nextByteid, HEX);
+    return;
+  }
+  dest.print(discoveryAborted ? F(" aborted") : F(" complete"));
+  dest.print(F(" probes:")); dest.print(probesSent);
+  dest.print(F(" time(ms):")); dest.println(discoveryDurationms);
+  dest.print(F("found:")); printBitmap(dest, foundByteids);
+  dest.print(F("duplicate byte ids:")); printBitmap(dest, duplicateByteids);
+}
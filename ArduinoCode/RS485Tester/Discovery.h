@@ -0,0 +1,29 @@
+#ifndef DISCOVERY_H
+#define DISCOVERY_H
+#include <Arduino.h>
+
+// Finds the slaves on the bus by sending alive (100) to each byte id in turn, and starts polling the ones which reply.
+// The probes are pipelined: a slave pauses for its turnaround before replying, so the master sends a burst of probes to
+//   consecutive byte ids during that time, then listens while the replies come back one after another in the same
+//   order, spaced out like the probes.  Before the scan, the turnaround of all the slaves is put back to the default
+//   with a broadcast (command 108) so that they all reply at the same delay.  All 255 byte ids take about 13 seconds
+//   at 4800 baud and 5 seconds at 38400 (one probe at a time, waiting for each reply or timeout, takes over a minute).
+// If two slaves have the same byte id, their replies collide and arrive garbled.  After the sweep, each byte id which
+//   didn't reply in a burst with garbled replies is probed again on its own; if its replies are still garbled, it is
+//   reported as a duplicate and ERRORCODE_DUPLICATE_BYTEID is shown until a scan finds no duplicates.
+// Polling and all other bus transactions are held during the scan.  Only slaves at the current bus speed are found.
+
+void setupDiscovery();
+void tickDiscovery();
+
+// scan byte ids firstbyteid .. lastbyteid (except BROADCAST_BYTEID).
+// returns false if a scan, turnaround tuning or bus speed change is already in progress
+bool startDiscovery(unsigned char firstbyteid, unsigned char lastbyteid);
+// the scan stops once the replies to the probes already sent are in, so that they don't collide with polling
+void abortDiscovery();
+bool discoveryInProgress();
+
+// print the slaves and duplicate byte ids found by the last scan
+void printDiscovery(Print &dest);
+
+#endif
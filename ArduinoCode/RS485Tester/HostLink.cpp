@@ -0,0 +1,368 @@
+#include <Arduino.h>
+#include "HostLink.h"
+#include "Commands.h"
+#include "BusTransactions.h"
+#include "SlaveTable.h"
+#include "Crc16.h"
+#include "SystemStatus.h"
+#include "RS485Tester.h"
+
+const unsigned long HOST_INTERBYTE_TIMEOUT_MS = 100;
+const unsigned long CONSOLE_BAUD_RATE = 9600;
+const byte HOST_HEADER_LENGTH = 2;   // TAG and TYPE
+const byte HOST_BATCH_REQUEST_ENTRY_LENGTH = 1+1+4;
+const byte HOST_BATCH_RESULT_ENTRY_LENGTH = 1+1+1+4+2;
+const byte HOST_STATES_ENTRY_LENGTH = 1+4+4+1+2;
+const int HOST_TEXT_BUFFER_SIZE = 32;
+
+// Sends the console output to the host as HOST_TEXT frames, one per line (or per HOST_TEXT_BUFFER_SIZE characters)
+class HostTextOutput : public Print {
+public:
+  virtual size_t write(uint8_t c);
+  virtual int availableForWrite();
+  using Print::write;
+  void sendText();
+  byte tag;
+private:
+  byte buffer[HOST_TEXT_BUFFER_SIZE];
+  byte length;
+};
+
+HostTextOutput hostTextOutput;
+bool hostLinkRunning = false;
+Print *hostSerial;   // the console from before binary mode: writes raw bytes to the host
+
+enum HostRxState {HOST_RX_WAIT_FOR_SYNC, HOST_RX_LENGTH, HOST_RX_BODY};
+HostRxState hostRxState = HOST_RX_WAIT_FOR_SYNC;
+byte hostRxLength;
+byte hostRxBuffer[HOST_HEADER_LENGTH + HOST_MAX_PAYLOAD + 2];  // TAG, TYPE, PAYLOAD, CRC16
+byte hostRxIdx;
+unsigned short hostRxCrc;
+unsigned long hostLastByteTime;
+
+struct HostBatchEntry {
+  unsigned char byteid;
+  unsigned char bytecommand;
+  unsigned long dwordparameter;
+  unsigned long dwordstatus;
+  TransactionOutcome outcome;
+  unsigned int latencyms;
+  bool queued;
+};
+
+HostBatchEntry hostBatch[HOST_MAX_BATCH];
+byte hostBatchCount = 0;      // 0 = no batch in progress
+byte hostBatchCompleted;
+byte hostBatchTag;
+
+unsigned long hostFramesCount = 0;
+unsigned long hostErrorsCount = 0;
+unsigned long hostBusCommandsCount = 0;
+
+void sendHostFrame(byte tag, byte type, const byte payload[], byte length)
+{
+  byte header[4] = {HOST_SYNC_BYTE, (byte)(length + HOST_HEADER_LENGTH), tag, type};
+  unsigned short crc = crc16Init();
+  for (int i = 1; i < 4; ++i) {
+    crc = crc16Update(crc, header[i]);
+  }
+  for (int i = 0; i < length; ++i) {
+    crc = crc16Update(crc, payload[i]);
+  }
+  crc = crc16Finalize(crc);
+  byte trailer[2] = {(byte)(crc & 0xff), (byte)((crc >> 8) & 0xff)};
+  hostSerial->write(header, 4);
+  hostSerial->write(payload, length);
+  hostSerial->write(trailer, 2);
+}
+
+void sendHostError(byte tag, HostError error)
+{
+  byte payload = error;
+  ++hostErrorsCount;
+  sendHostFrame(tag, HOST_ERROR, &payload, 1);
+}
+
+size_t HostTextOutput::write(uint8_t c)
+{
+  if (c == '\r') return 1;
+  if (c == '\n') {
+    sendText();
+    return 1;
+  }
+  buffer[length++] = c;
+  if (length >= HOST_TEXT_BUFFER_SIZE) sendText();
+  return 1;
+}
+
+// room for text without blocking, allowing for the frame around it
+int HostTextOutput::availableForWrite()
+{
+  int space = hostSerial->availableForWrite() - (4 + 2) - length;
+  return (space < 0) ? 0 : space;
+}
+
+void HostTextOutput::sendText()
+{
+  if (length == 0) return;
+  sendHostFrame(tag, HOST_TEXT, buffer, length);
+  length = 0;
+}
+
+void startHostLink(unsigned long baud)
+{
+  if (hostLinkRunning) return;
+  hostSerial = console;
+  if (baud != 0) {
+    Serial.flush();
+    Serial.begin(baud);
+  }
+  console = &hostTextOutput;
+  hostTextOutput.tag = 0;
+  hostRxState = HOST_RX_WAIT_FOR_SYNC;
+  hostBatchCount = 0;
+  hostLinkRunning = true;
+}
+
+void stopHostLink()
+{
+  hostTextOutput.sendText();
+  console = hostSerial;
+  Serial.flush();
+  Serial.begin(CONSOLE_BAUD_RATE);
+  hostLinkRunning = false;
+}
+
+bool hostLinkActive()
+{
+  return hostLinkRunning;
+}
+
+void hostBatchEntryComplete(const Transaction &transaction)
+{
+  HostBatchEntry &entry = *(HostBatchEntry *)transaction.context;
+  entry.outcome = transaction.outcome;
+  entry.dwordstatus = transaction.dwordstatus;
+  entry.latencyms = (transaction.latencyms > 0xFFFF) ? 0xFFFF : transaction.latencyms;
+  ++hostBatchCompleted;
+}
+
+void startHostBatch(byte tag, const byte payload[], byte length)
+{
+  if (hostBatchCount != 0) {
+    sendHostError(tag, HOST_ERROR_BUSY);
+    return;
+  }
+  byte count = (length < 1) ? 0 : payload[0];
+  if (count == 0 || count > HOST_MAX_BATCH || length != 1 + count * HOST_BATCH_REQUEST_ENTRY_LENGTH) {
+    sendHostError(tag, HOST_ERROR_LENGTH);
+    return;
+  }
+  const byte *nextentry = payload + 1;
+  for (int i = 0; i < count; ++i) {
+    HostBatchEntry &entry = hostBatch[i];
+    entry.byteid = nextentry[0];
+    entry.bytecommand = nextentry[1];
+    entry.dwordparameter = (unsigned long)nextentry[2]
+                           | ((unsigned long)nextentry[3] << 8)
+                           | ((unsigned long)nextentry[4] << 16)
+                           | ((unsigned long)nextentry[5] << 24);
+    entry.dwordstatus = 0;
+    entry.outcome = TXN_PENDING;
+    entry.latencyms = 0;
+    entry.queued = false;
+    nextentry += HOST_BATCH_REQUEST_ENTRY_LENGTH;
+  }
+  hostBatchTag = tag;
+  hostBatchCompleted = 0;
+  hostBatchCount = count;
+  hostBusCommandsCount += count;
+}
+
+// queue as many of the batch's commands as the transaction pool will take, in order; send the results once they are all done
+void tickHostBatch()
+{
+  if (hostBatchCount == 0) return;
+  for (int i = 0; i < hostBatchCount; ++i) {
+    HostBatchEntry &entry = hostBatch[i];
+    if (entry.queued) continue;
+    if (queueTransaction(entry.byteid, entry.bytecommand, entry.dwordparameter, hostBatchEntryComplete, &entry) == NO_TRANSACTION) break;
+    entry.queued = true;
+  }
+  if (hostBatchCompleted < hostBatchCount) return;
+
+  byte results[1 + HOST_MAX_BATCH * HOST_BATCH_RESULT_ENTRY_LENGTH];
+  byte *nextresult = results + 1;
+  results[0] = hostBatchCount;
+  for (int i = 0; i < hostBatchCount; ++i) {
+    HostBatchEntry &entry = hostBatch[i];
+    nextresult[0] = entry.byteid;
+    nextresult[1] = entry.bytecommand;
+    nextresult[2] = entry.outcome;
+    nextresult[3] = entry.dwordstatus & 0xff;
+    nextresult[4] = (entry.dwordstatus >> 8) & 0xff;
+    nextresult[5] = (entry.dwordstatus >> 16) & 0xff;
+    nextresult[6] = (entry.dwordstatus >> 24) & 0xff;
+    nextresult[7] = entry.latencyms & 0xff;
+    nextresult[8] = (entry.latencyms >> 8) & 0xff;
+    nextresult += HOST_BATCH_RESULT_ENTRY_LENGTH;
+  }
+  sendHostFrame(hostBatchTag, HOST_BUS_BATCH | HOST_RESPONSE_FLAG, results, nextresult - results);
+  hostBatchCount = 0;
+}
+
+void putHostDword(byte *dest, unsigned long value)
+{
+  dest[0] = value & 0xff;
+  dest[1] = (value >> 8) & 0xff;
+  dest[2] = (value >> 16) & 0xff;
+  dest[3] = (value >> 24) & 0xff;
+}
+
+// answer a query about some slaves' relay states from the slave table
+void sendHostSlaveStates(byte tag, const byte payload[], byte length)
+{
+  if (length == 0 || length > HOST_MAX_STATES_QUERY) {
+    sendHostError(tag, HOST_ERROR_LENGTH);
+    return;
+  }
+  byte results[HOST_MAX_STATES_QUERY * HOST_STATES_ENTRY_LENGTH];
+  byte *nextresult = results;
+  unsigned long timenow = millis();
+  for (int i = 0; i < length; ++i) {
+    memset(nextresult, 0, HOST_STATES_ENTRY_LENGTH);
+    nextresult[0] = payload[i];
+    const SlaveRecord *slave = findSlave(payload[i]);
+    unsigned long seenSecondsAgo = 0xFFFF;
+    if (slave == NULL) {
+      nextresult[9] = HOST_STATES_NOT_POLLED;
+    } else {
+      putHostDword(nextresult + 1, slave->currentStates);
+      putHostDword(nextresult + 5, slave->targetStates);
+      nextresult[9] = slaveHealth(*slave) | (slaveDirty(*slave) ? HOST_STATES_DIRTY : 0);
+      if (slave->seen && (timenow - slave->lastSeenTime) / 1000 < 0xFFFF) seenSecondsAgo = (timenow - slave->lastSeenTime) / 1000;
+    }
+    nextresult[10] = seenSecondsAgo & 0xff;
+    nextresult[11] = (seenSecondsAgo >> 8) & 0xff;
+    nextresult += HOST_STATES_ENTRY_LENGTH;
+  }
+  sendHostFrame(tag, HOST_SLAVE_STATES | HOST_RESPONSE_FLAG, results, nextresult - results);
+}
+
+// a frame with a valid CRC has arrived in hostRxBuffer
+void hostFrameReceived()
+{
+  ++hostFramesCount;
+  byte tag = hostRxBuffer[0];
+  byte type = hostRxBuffer[1];
+  byte *payload = hostRxBuffer + HOST_HEADER_LENGTH;
+  byte length = hostRxLength - HOST_HEADER_LENGTH;
+  switch (type) {
+    case HOST_PING: {
+      sendHostFrame(tag, type | HOST_RESPONSE_FLAG, (const byte *)RS485T_VERSION, strlen(RS485T_VERSION));
+      break;
+    }
+    case HOST_BUS_BATCH: {
+      startHostBatch(tag, payload, length);
+      break;
+    }
+    case HOST_TEXT_COMMAND: {
+      if (length > MAX_COMMAND_LENGTH) {
+        sendHostError(tag, HOST_ERROR_LENGTH);
+        break;
+      }
+      char command[MAX_COMMAND_LENGTH + 1];
+      memcpy(command, payload, length);
+      command[length] = '\0';
+      hostTextOutput.tag = tag;
+      executeCommand(command);
+      hostTextOutput.sendText();
+      hostTextOutput.tag = 0;
+      sendHostFrame(tag, type | HOST_RESPONSE_FLAG, NULL, 0);
+      break;
+    }
+    case HOST_SLAVE_STATES: {
+      sendHostSlaveStates(tag, payload, length);
+      break;
+    }
+    case HOST_EXIT: {
+      sendHostFrame(tag, type | HOST_RESPONSE_FLAG, NULL, 0);
+      stopHostLink();
+      break;
+    }
+    default: {
+      sendHostError(tag, HOST_ERROR_UNKNOWN_TYPE);
+      break;
+    }
+  }
+}
+
+// advance the frame state machine by one received byte
+void hostRxByte(byte c)
+{
+  switch (hostRxState) {
+    case HOST_RX_WAIT_FOR_SYNC: {
+      if (c == HOST_SYNC_BYTE) hostRxState = HOST_RX_LENGTH;
+      break;
+    }
+    case HOST_RX_LENGTH: {
+      if (c < HOST_HEADER_LENGTH || c > HOST_HEADER_LENGTH + HOST_MAX_PAYLOAD) {
+        sendHostError(0, HOST_ERROR_LENGTH);
+        hostRxState = HOST_RX_WAIT_FOR_SYNC;
+        break;
+      }
+      hostRxLength = c;
+      hostRxIdx = 0;
+      hostRxCrc = crc16Update(crc16Init(), c);
+      hostRxState = HOST_RX_BODY;
+      break;
+    }
+    case HOST_RX_BODY: {
+      if (hostRxIdx >= sizeof(hostRxBuffer)) {
+        assertFailureCode = ASSERT_INDEX_OUT_OF_BOUNDS;
+        hostRxState = HOST_RX_WAIT_FOR_SYNC;
+        break;
+      }
+      if (hostRxIdx < hostRxLength) {
+        hostRxCrc = crc16Update(hostRxCrc, c);
+      }
+      hostRxBuffer[hostRxIdx++] = c;
+      if (hostRxIdx < hostRxLength + 2) break;
+      hostRxState = HOST_RX_WAIT_FOR_SYNC;
+      unsigned short receivedCrc = hostRxBuffer[hostRxLength] | ((unsigned short)hostRxBuffer[hostRxLength + 1] << 8);
+      if (crc16Finalize(hostRxCrc) != receivedCrc) {
+        sendHostError(0, HOST_ERROR_CRC);
+        break;
+      }
+      hostFrameReceived();
+      break;
+    }
+    default: {
+      assertFailureCode = ASSERT_INVALID_SWITCH;
+      hostRxState = HOST_RX_WAIT_FOR_SYNC;
+      break;
+    }
+  }
+}
+
+void tickHostLink()
+{
+  if (!consoleInput->available()) {
+    if (hostRxState != HOST_RX_WAIT_FOR_SYNC && millis() - hostLastByteTime > HOST_INTERBYTE_TIMEOUT_MS) {
+      sendHostError(0, HOST_ERROR_TIMEOUT);
+      hostRxState = HOST_RX_WAIT_FOR_SYNC;
+    }
+  }
+  while (hostLinkRunning && consoleInput->available()) {
+    hostRxByte(consoleInput->read());
+    hostLastByteTime = millis();
+  }
+  if (hostLinkRunning) tickHostBatch();
+}
+
+void printHostLinkStats(Print &dest)
+{
+  dest.print(F("host frames:")); dest.println(hostFramesCount);
+  dest.print(F("host errors:")); dest.println(hostErrorsCount);
+  dest.print(F("host bus commands:")); dest.println(hostBusCommandsCount);
+}
@@ -0,0 +1,61 @@
+#ifndef HOSTLINK_H
+#define HOSTLINK_H
+#include <Arduino.h>
+
+// Binary host-control protocol on the console serial port, for a supervisory PC which needs more throughput than the
+//   text commands.  Entered with the text command !x; the host sends HOST_EXIT to return to text mode.
+//
+// Frames in both directions are:
+//   {HOST_SYNC_BYTE}{LEN}{TAG}{TYPE}{PAYLOAD}{CRC16}
+//   LEN = number of bytes in TAG, TYPE and PAYLOAD
+//   TAG is chosen by the host and copied into the response(s) to that frame
+//   CRC16 (see Crc16.h) covers LEN, TAG, TYPE and PAYLOAD, low byte first
+//
+// Host to master:
+//   HOST_PING: no payload.  Response = version string
+//   HOST_BUS_BATCH: {count} followed by count x {BYTEID}{BYTECOMMAND}{DWORDPARAMETER}.  The commands are sent on the bus
+//      in order; when they have all completed, response = {count} followed by count x
+//      {BYTEID}{BYTECOMMAND}{OUTCOME (TransactionOutcome)}{DWORDSTATUS}{WORDLATENCYMS}
+//   HOST_TEXT_COMMAND: a text command without the leading '!'.  Response = the command's output as HOST_TEXT frames,
+//      then an empty response
+//   HOST_SLAVE_STATES: 1 to HOST_MAX_STATES_QUERY x {BYTEID}.  Answered from the slave table without using the bus.
+//      Response = the same number of {BYTEID}{CURRENT}{TARGET}{FLAGS}{WORDSEENSECONDSAGO}: CURRENT and TARGET are
+//      dwords (bit n = relay n), FLAGS bits 0-1 = SlaveHealth (see SlaveTable.h) and HOST_STATES_DIRTY /
+//      HOST_STATES_NOT_POLLED; seen = 0xFFFF if never seen or longer ago
+//   HOST_EXIT: response = empty, then return to text mode
+// Responses have TYPE = the request type | HOST_RESPONSE_FLAG.  All multibyte values are little endian.
+// Master to host, unsolicited:
+//   HOST_TEXT: console output (tag 0 unless in response to HOST_TEXT_COMMAND)
+//   HOST_ERROR: {HostError} with the tag of the frame which caused it (0 if the frame was corrupt)
+
+const byte HOST_SYNC_BYTE = 0xA5;
+const byte HOST_MAX_PAYLOAD = 80;
+
+const byte HOST_PING = 1;
+const byte HOST_BUS_BATCH = 2;
+const byte HOST_TEXT_COMMAND = 3;
+const byte HOST_EXIT = 4;
+const byte HOST_SLAVE_STATES = 5;
+const byte HOST_RESPONSE_FLAG = 0x80;
+const byte HOST_TEXT = 0xFE;
+const byte HOST_ERROR = 0xFF;
+
+const byte HOST_MAX_BATCH = 8;
+const byte HOST_MAX_STATES_QUERY = 6;
+const byte HOST_STATES_DIRTY = 0x04;        // the target states aren't confirmed yet
+const byte HOST_STATES_NOT_POLLED = 0x80;   // the slave isn't in the slave table: the other fields are 0
+
+enum HostError {HOST_ERROR_CRC = 1, HOST_ERROR_LENGTH = 2, HOST_ERROR_UNKNOWN_TYPE = 3, HOST_ERROR_BUSY = 4,
+                HOST_ERROR_TIMEOUT = 5};
+
+// switch the console to binary mode.  baud = new baud rate for the console port, 0 = leave unchanged
+void startHostLink(unsigned long baud);
+bool hostLinkActive();
+
+// call frequently while hostLinkActive(); reads the console input and sends responses
+void tickHostLink();
+
+// print statistics for the binary mode
+void printHostLinkStats(Print &dest);
+
+#endif
@@ -0,0 +1,366 @@
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "Macros.h"
+#include "BusTransactions.h"
+#include "BusPoller.h"
+#include "PulseTrain.h"
+#include "SlaveComms.h"
+#include "SystemStatus.h"
+
+// EEPROM layout:
+//   MACRO_EEPROM_START: signature, version
+//   then the directory: MAX_MACROS x {name (MACRO_NAME_LENGTH chars, 0-padded) , length in bytes (0 = unused)}
+//   then the steps: MAX_MACROS x MACRO_SLOT_SIZE
+// Each step is {type}{delay before the step (WORD)} followed by:
+//   MACRO_STEP_BUS_COMMAND: {BYTEID}{BYTECOMMAND}{DWORDPARAMETER}
+//   MACRO_STEP_PULSE_TRAIN: {stepus (DWORD)}{count}{count step chars}
+// The delay is in ms, or in seconds if bit 15 is set.  Multibyte values are little endian.
+const int MACRO_EEPROM_START = 0;
+const byte MACRO_EEPROM_SIGNATURE = 0x4D;
+const byte MACRO_EEPROM_VERSION = 1;
+const byte MAX_MACROS = 8;
+const int MACRO_SLOT_SIZE = 96;
+const int MACRO_DIRECTORY_ENTRY_SIZE = MACRO_NAME_LENGTH + 1;
+const int MACRO_DIRECTORY_START = MACRO_EEPROM_START + 2;
+const int MACRO_SLOTS_START = MACRO_DIRECTORY_START + MAX_MACROS * MACRO_DIRECTORY_ENTRY_SIZE;
+static_assert(MACRO_SLOTS_START + MAX_MACROS * MACRO_SLOT_SIZE <= MACRO_EEPROM_END, "the macros overlap the schedule in EEPROM");
+
+const byte MACRO_STEP_BUS_COMMAND = 1;
+const byte MACRO_STEP_PULSE_TRAIN = 2;
+const byte MACRO_STEP_HEADER_LENGTH = 1+2;
+const byte MACRO_BUS_COMMAND_STEP_LENGTH = MACRO_STEP_HEADER_LENGTH + 1+1+4;
+const byte MACRO_PULSE_TRAIN_STEP_HEADER_LENGTH = MACRO_STEP_HEADER_LENGTH + 4+1;
+const byte MAX_MACRO_PULSE_TRAIN_STEPS = 32;
+const unsigned int MACRO_DELAY_IN_SECONDS = 0x8000;
+
+const byte NO_MACRO = 255;
+const byte MAX_RUNNING_MACROS = 4;
+
+struct MacroRunner {
+  byte macro;                 // NO_MACRO = not running
+  byte length;
+  byte offset;                // the next step
+  unsigned long stepDueTime;
+};
+
+MacroRunner macroRunners[MAX_RUNNING_MACROS];
+
+byte recordingMacro = NO_MACRO;   // the slot being recorded into
+byte recordingLength;
+char recordingName[MACRO_NAME_LENGTH];
+unsigned long recordingDelayms;
+
+unsigned long macroStepsRun = 0;
+unsigned long macroStepsFailed = 0;
+
+int macroDirectoryAddress(byte macro)
+{
+  return MACRO_DIRECTORY_START + macro * MACRO_DIRECTORY_ENTRY_SIZE;
+}
+
+int macroSlotAddress(byte macro)
+{
+  return MACRO_SLOTS_START + macro * MACRO_SLOT_SIZE;
+}
+
+byte macroLength(byte macro)
+{
+  return EEPROM.read(macroDirectoryAddress(macro) + MACRO_NAME_LENGTH);
+}
+
+unsigned long readEepromDword(int address)
+{
+  return (unsigned long)EEPROM.read(address)
+         | ((unsigned long)EEPROM.read(address + 1) << 8)
+         | ((unsigned long)EEPROM.read(address + 2) << 16)
+         | ((unsigned long)EEPROM.read(address + 3) << 24);
+}
+
+void writeEepromDword(int address, unsigned long value)
+{
+  for (int i = 0; i < 4; ++i) {
+    EEPROM.update(address + i, value & 0xff);
+    value >>= 8;
+  }
+}
+
+void setupMacros()
+{
+  for (int i = 0; i < MAX_RUNNING_MACROS; ++i) {
+    macroRunners[i].macro = NO_MACRO;
+  }
+  recordingMacro = NO_MACRO;
+  if (EEPROM.read(MACRO_EEPROM_START) != MACRO_EEPROM_SIGNATURE || EEPROM.read(MACRO_EEPROM_START + 1) != MACRO_EEPROM_VERSION) {
+    for (int i = 0; i < MAX_MACROS; ++i) {
+      EEPROM.update(macroDirectoryAddress(i) + MACRO_NAME_LENGTH, 0);
+    }
+    EEPROM.update(MACRO_EEPROM_START, MACRO_EEPROM_SIGNATURE);
+    EEPROM.update(MACRO_EEPROM_START + 1, MACRO_EEPROM_VERSION);
+  }
+}
+
+// copy the name into a zero-padded buffer; returns false if it is empty, too long, or has invalid characters
+bool parseMacroName(const char *name, char paddedName[MACRO_NAME_LENGTH])
+{
+  while (isspace(*name)) {
+    ++name;
+  }
+  int length = 0;
+  while (isalnum(name[length]) || name[length] == '_') {
+    if (length >= MACRO_NAME_LENGTH) return false;
+    paddedName[length] = name[length];
+    ++length;
+  }
+  if (length == 0 || (name[length] != '\0' && !isspace(name[length]))) return false;
+  for (int i = length; i < MACRO_NAME_LENGTH; ++i) {
+    paddedName[i] = '\0';
+  }
+  return true;
+}
+
+// returns the macro with the given name, or NO_MACRO
+byte findMacro(const char paddedName[MACRO_NAME_LENGTH])
+{
+  for (int i = 0; i < MAX_MACROS; ++i) {
+    if (macroLength(i) == 0) continue;
+    int address = macroDirectoryAddress(i);
+    int j;
+    for (j = 0; j < MACRO_NAME_LENGTH && EEPROM.read(address + j) == (byte)paddedName[j]; ++j) {
+    }
+    if (j == MACRO_NAME_LENGTH) return i;
+  }
+  return NO_MACRO;
+}
+
+bool macroRunning(byte macro)
+{
+  for (int i = 0; i < MAX_RUNNING_MACROS; ++i) {
+    if (macroRunners[i].macro == macro) return true;
+  }
+  return false;
+}
+
+bool startMacroRecording(const char *name)
+{
+  if (recordingMacro != NO_MACRO || !parseMacroName(name, recordingName)) return false;
+  for (int i = 0; i < MAX_MACROS; ++i) {
+    if (macroLength(i) == 0 && !macroRunning(i)) {
+      recordingMacro = i;
+      recordingLength = 0;
+      recordingDelayms = 0;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool macroRecording()
+{
+  return recordingMacro != NO_MACRO;
+}
+
+void addMacroDelay(unsigned long delayms)
+{
+  recordingDelayms += delayms;
+}
+
+// write the header for the next step, if there is room for a step of the given length.
+// returns the address for the rest of the step, or -1 if there is no room
+int recordStepHeader(byte type, byte steplength)
+{
+  if (recordingMacro == NO_MACRO || recordingLength + steplength > MACRO_SLOT_SIZE) return -1;
+  unsigned int delay;
+  if (recordingDelayms < MACRO_DELAY_IN_SECONDS) {
+    delay = recordingDelayms;
+  } else {
+    unsigned long delays = (recordingDelayms + 500) / 1000;
+    delay = MACRO_DELAY_IN_SECONDS | ((delays >= MACRO_DELAY_IN_SECONDS) ? MACRO_DELAY_IN_SECONDS - 1 : delays);
+  }
+  int address = macroSlotAddress(recordingMacro) + recordingLength;
+  EEPROM.update(address, type);
+  EEPROM.update(address + 1, delay & 0xff);
+  EEPROM.update(address + 2, (delay >> 8) & 0xff);
+  recordingLength += steplength;
+  recordingDelayms = 0;
+  return address + MACRO_STEP_HEADER_LENGTH;
+}
+
+bool recordBusCommandStep(unsigned char byteid, unsigned char bytecommand, unsigned long dwordparameter)
+{
+  int address = recordStepHeader(MACRO_STEP_BUS_COMMAND, MACRO_BUS_COMMAND_STEP_LENGTH);
+  if (address < 0) return false;
+  EEPROM.update(address, byteid);
+  EEPROM.update(address + 1, bytecommand);
+  writeEepromDword(address + 2, dwordparameter);
+  return true;
+}
+
+bool recordPulseTrainStep(const char steps[], unsigned long stepus)
+{
+  size_t count = strlen(steps);
+  if (count > MAX_MACRO_PULSE_TRAIN_STEPS) return false;
+  int address = recordStepHeader(MACRO_STEP_PULSE_TRAIN, MACRO_PULSE_TRAIN_STEP_HEADER_LENGTH + count);
+  if (address < 0) return false;
+  writeEepromDword(address, stepus);
+  EEPROM.update(address + 4, count);
+  for (size_t i = 0; i < count; ++i) {
+    EEPROM.update(address + 5 + i, steps[i]);
+  }
+  return true;
+}
+
+void deleteMacroSlot(byte macro)
+{
+  for (int i = 0; i < MAX_RUNNING_MACROS; ++i) {
+    if (macroRunners[i].macro == macro) macroRunners[i].macro = NO_MACRO;
+  }
+  EEPROM.update(macroDirectoryAddress(macro) + MACRO_NAME_LENGTH, 0);
+}
+
+void finishMacroRecording()
+{
+  if (recordingMacro == NO_MACRO) return;
+  if (recordingLength > 0) {
+    byte oldMacro = findMacro(recordingName);
+    if (oldMacro != NO_MACRO) deleteMacroSlot(oldMacro);
+    int address = macroDirectoryAddress(recordingMacro);
+    for (int i = 0; i < MACRO_NAME_LENGTH; ++i) {
+      EEPROM.update(address + i, recordingName[i]);
+    }
+    EEPROM.update(address + MACRO_NAME_LENGTH, recordingLength);
+  }
+  recordingMacro = NO_MACRO;
+}
+
+// the delay before the step at the runner's offset
+unsigned long macroStepDelayms(const MacroRunner &runner)
+{
+  int address = macroSlotAddress(runner.macro) + runner.offset + 1;
+  unsigned int delay = EEPROM.read(address) | ((unsigned int)EEPROM.read(address + 1) << 8);
+  if (delay & MACRO_DELAY_IN_SECONDS) {
+    return (delay & ~MACRO_DELAY_IN_SECONDS) * 1000UL;
+  }
+  return delay;
+}
+
+bool runMacro(const char *name)
+{
+  char paddedName[MACRO_NAME_LENGTH];
+  if (!parseMacroName(name, paddedName)) return false;
+  byte macro = findMacro(paddedName);
+  if (macro == NO_MACRO) return false;
+  for (int i = 0; i < MAX_RUNNING_MACROS; ++i) {
+    MacroRunner &runner = macroRunners[i];
+    if (runner.macro != NO_MACRO) continue;
+    runner.macro = macro;
+    runner.length = macroLength(macro);
+    runner.offset = 0;
+    runner.stepDueTime = millis() + macroStepDelayms(runner);
+    return true;
+  }
+  return false;
+}
+
+bool deleteMacro(const char *name)
+{
+  char paddedName[MACRO_NAME_LENGTH];
+  if (!parseMacroName(name, paddedName)) return false;
+  byte macro = findMacro(paddedName);
+  if (macro == NO_MACRO) return false;
+  deleteMacroSlot(macro);
+  return true;
+}
+
+void stopAllMacros()
+{
+  for (int i = 0; i < MAX_RUNNING_MACROS; ++i) {
+    macroRunners[i].macro = NO_MACRO;
+  }
+}
+
+void macroBusCommandComplete(const Transaction &transaction)
+{
+  if (transaction.outcome == TXN_SUCCESS) return;
+  ++macroStepsFailed;
+  console->print(F("macro step failed: "));
+  printTransaction(*console, transaction);
+}
+
+// execute the step at the runner's offset.  Returns the length of the step, or 0 if it can't be executed yet
+//   (eg the transaction queue is full)
+byte runMacroStep(const MacroRunner &runner)
+{
+  int address = macroSlotAddress(runner.macro) + runner.offset;
+  byte type = EEPROM.read(address);
+  address += MACRO_STEP_HEADER_LENGTH;
+  switch (type) {
+    case MACRO_STEP_BUS_COMMAND: {
+      unsigned char byteid = EEPROM.read(address);
+      unsigned char bytecommand = EEPROM.read(address + 1);
+      if (queueTransaction(byteid, bytecommand, readEepromDword(address + 2), macroBusCommandComplete, NULL) == NO_TRANSACTION) {
+        return 0;
+      }
+      if (commandChangesOutputs(bytecommand)) {
+        pollSlaveSoon(byteid);
+      }
+      return MACRO_BUS_COMMAND_STEP_LENGTH;
+    }
+    case MACRO_STEP_PULSE_TRAIN: {
+      char steps[MAX_MACRO_PULSE_TRAIN_STEPS + 1];
+      byte count = EEPROM.read(address + 4);
+      if (count > MAX_MACRO_PULSE_TRAIN_STEPS) count = MAX_MACRO_PULSE_TRAIN_STEPS;
+      for (int i = 0; i < count; ++i) {
+        steps[i] = EEPROM.read(address + 5 + i);
+      }
+      steps[count] = '\0';
+      if (!queuePulseTrain(steps, readEepromDword(address))) return 0;
+      return MACRO_PULSE_TRAIN_STEP_HEADER_LENGTH + count;
+    }
+    default: {
+      assertFailureCode = ASSERT_INVALID_SWITCH;
+      return runner.length - runner.offset;  // corrupt: skip the rest of the macro
+    }
+  }
+}
+
+// run the steps which have fallen due.  The delays are measured from when each step was due, not when it actually
+//   ran, so that a step which was held up doesn't delay the rest of the macro
+void tickMacros()
+{
+  unsigned long timenow = millis();
+  for (int i = 0; i < MAX_RUNNING_MACROS; ++i) {
+    MacroRunner &runner = macroRunners[i];
+    if (runner.macro == NO_MACRO || (long)(timenow - runner.stepDueTime) < 0) continue;
+    byte steplength = runMacroStep(runner);
+    if (steplength == 0) continue;  // try again next time
+    ++macroStepsRun;
+    runner.offset += steplength;
+    if (runner.offset >= runner.length) {
+      runner.macro = NO_MACRO;
+    } else {
+      runner.stepDueTime += macroStepDelayms(runner);
+    }
+  }
+}
+
+void printMacros(Print &dest)
+{
+  dest.println(F("name bytes running"));
+  for (int i = 0; i < MAX_MACROS; ++i) {
+    byte length = macroLength(i);
+    if (length == 0) continue;
+    int address = macroDirectoryAddress(i);
+    for (int j = 0; j < MACRO_NAME_LENGTH; ++j) {
+      char c = EEPROM.read(address + j);
+      if (c == '\0') break;
+      dest.print(c);
+    }
+    dest.print(' '); dest.print(length);
+    dest.print(' '); dest.println(macroRunning(i) ? F("yes") : F("no"));
+  }
+  if (recordingMacro != NO_MACRO) {
+    dest.print(F("recording, bytes used:")); dest.println(recordingLength);
+  }
+  dest.print(F("macro steps run:")); dest.print(macroStepsRun);
+  dest.print(F(" failed:")); dest.println(macroStepsFailed);
+}
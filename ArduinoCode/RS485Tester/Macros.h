@@ -0,0 +1,46 @@
+#ifndef MACROS_H
+#define MACROS_H
+#include <Arduino.h>
+
+// Named macros: a recorded series of bus commands (!r) and pulse trains (!cCdDlL), each with a delay before it.
+// The macros are stored in EEPROM already parsed into a compact binary form, so replay doesn't need to parse any text.
+// Several macros can be replayed at once; replay runs in the background from tickMacros.
+//
+// To record: startMacroRecording(name), then each !r or pulse train command is recorded instead of executed
+//   (see recordBusCommandStep, recordPulseTrainStep).  addMacroDelay sets the delay before the next step.
+//   finishMacroRecording saves the macro.
+
+const byte MACRO_NAME_LENGTH = 8;
+const int MACRO_EEPROM_END = 1024;   // the macros are stored in the EEPROM below this address, the schedule from it
+
+void setupMacros();
+void tickMacros();
+
+// returns false if the name is invalid, a macro is already being recorded, or there is no room for a new macro.
+// an existing macro of the same name is replaced when the recording is finished
+bool startMacroRecording(const char *name);
+bool macroRecording();
+
+// add delayms before the next step (relative to the previous step, or the start of the macro)
+void addMacroDelay(unsigned long delayms);
+
+// add a step to the macro being recorded.  Returns false if the macro is full
+bool recordBusCommandStep(unsigned char byteid, unsigned char bytecommand, unsigned long dwordparameter);
+bool recordPulseTrainStep(const char steps[], unsigned long stepus);
+
+// save the macro being recorded to EEPROM
+void finishMacroRecording();
+
+// start replaying the macro.  Returns false if not found or too many macros are already running
+bool runMacro(const char *name);
+
+// returns false if the macro wasn't found
+bool deleteMacro(const char *name);
+
+// stop all macros which are being replayed
+void stopAllMacros();
+
+// print the stored macros and the ones being replayed
+void printMacros(Print &dest);
+
+#endif
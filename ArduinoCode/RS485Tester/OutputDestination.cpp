@@ -14,3 +14,8 @@ size_t OutputDestinationSerial::write(const uint8_t *buf, size_t size)
 {
   return Serial.write(buf, size);
 }
+
+int OutputDestinationSerial::availableForWrite()
+{
+  return Serial.availableForWrite();
+}
@@ -7,6 +7,7 @@ public:
   virtual void begin();
   virtual size_t write(uint8_t);
   virtual size_t write(const uint8_t *buf, size_t size);
+  virtual int availableForWrite();
   using Print::write;
 };
 
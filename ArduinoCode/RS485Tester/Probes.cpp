@@ -0,0 +1,281 @@
+#include <Arduino.h>
+#include "Probes.h"
+#include "SystemStatus.h"
+
+const byte PROBE_OVERSAMPLE = 16;     // samples per block: 16 * 1023 still fits in an unsigned int
+const byte PROBE_TRIMMED_SAMPLES = PROBE_OVERSAMPLE - 2;   // the highest and lowest samples are rejected
+const byte PROBE_RING_SIZE = 8;
+const unsigned int PROBE_MIN_VALID = 8 << PROBE_FRACTION_BITS;     // readings outside this range = open or short circuit
+const unsigned int PROBE_MAX_VALID = 1015 << PROBE_FRACTION_BITS;
+const unsigned int PROBE_MAX_SPREAD = 64;     // highest - lowest sample of a block after rejecting the outliers, in ADC counts
+const byte PROBE_NOISY_BLOCKS = 8;            // faulty if this many blocks in a row are too spread out
+const unsigned long PROBE_STALE_MS = 500;     // faulty if no blocks arrive for this long
+const unsigned long PROBE_SIMULATION_INTERVAL_MS = 5;   // one block per simulated probe in each interval
+
+enum ProbeFault {PROBE_OK, PROBE_NO_READING, PROBE_OUT_OF_RANGE, PROBE_NOISY, PROBE_STALE};
+
+// the block being collected; only used by whichever supplies the probe's samples (the ADC interrupt or the simulation)
+struct ProbeAccumulator {
+  unsigned int sum;
+  unsigned int lowest;
+  unsigned int secondLowest;
+  unsigned int highest;
+  unsigned int secondHighest;
+  byte count;
+};
+
+struct ProbeBlock {
+  unsigned int trimmedSum;
+  unsigned int spread;
+};
+
+struct ProbeRing {
+  ProbeBlock blocks[PROBE_RING_SIZE];
+  volatile byte head;    // next block to be written by probeSampleInput
+  volatile byte tail;    // next block to be read by tickProbes
+  volatile bool overflow;
+};
+
+struct ProbeState {
+  unsigned int reading;
+  unsigned int spread;
+  ProbeFault fault;
+  byte noisyBlocks;
+  unsigned long lastBlockTime;
+  unsigned long blockCount;
+  unsigned long overflowCount;
+};
+
+struct ProbeSimulation {
+  unsigned int level;
+  unsigned int noise;
+  unsigned int spikeInterval;
+  unsigned int samplesSinceSpike;
+};
+
+ProbeAccumulator probeAccumulators[NUMBER_OF_PROBES];
+ProbeRing probeRings[NUMBER_OF_PROBES];
+ProbeState probeStates[NUMBER_OF_PROBES];
+ProbeSimulation probeSimulations[NUMBER_OF_PROBES];
+volatile bool probeSimulated[NUMBER_OF_PROBES];   // true = the ADC samples for this probe are ignored
+bool probeSimulationRunning = false;
+unsigned long lastSimulationTime;
+unsigned long simulationSeed = 1;
+
+void probeSampleInput(byte probe, unsigned int sample)
+{
+  if (probe >= NUMBER_OF_PROBES) return;
+  ProbeAccumulator &acc = probeAccumulators[probe];
+  if (acc.count == 0) {
+    acc.sum = 0;
+    acc.lowest = sample;
+    acc.secondLowest = 0xFFFF;
+    acc.highest = sample;
+    acc.secondHighest = 0;
+  } else {
+    if (sample < acc.lowest) {
+      acc.secondLowest = acc.lowest;
+      acc.lowest = sample;
+    } else if (sample < acc.secondLowest) {
+      acc.secondLowest = sample;
+    }
+    if (sample > acc.highest) {
+      acc.secondHighest = acc.highest;
+      acc.highest = sample;
+    } else if (sample > acc.secondHighest) {
+      acc.secondHighest = sample;
+    }
+  }
+  acc.sum += sample;
+  if (++acc.count < PROBE_OVERSAMPLE) return;
+  acc.count = 0;
+
+  ProbeRing &ring = probeRings[probe];
+  byte nexthead = (ring.head + 1) % PROBE_RING_SIZE;
+  if (nexthead == ring.tail) {
+    ring.overflow = true;
+    return;
+  }
+  ring.blocks[ring.head].trimmedSum = acc.sum - acc.lowest - acc.highest;
+  ring.blocks[ring.head].spread = acc.secondHighest - acc.secondLowest;
+  ring.head = nexthead;
+}
+
+#if defined(ADCSRA) && defined(ADC_vect)
+volatile byte adcProbe;   // the probe being converted
+
+void startProbeConversion()
+{
+  ADMUX = _BV(REFS0) | adcProbe;   // AVcc reference
+  ADCSRA |= _BV(ADSC);
+}
+
+void setupProbeAdc()
+{
+#if defined(MUX5)
+  ADCSRB &= ~_BV(MUX5);
+#endif
+  ADCSRA = _BV(ADEN) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);   // prescaler 128: 104 us per conversion
+  adcProbe = 0;
+  startProbeConversion();
+}
+
+ISR(ADC_vect)
+{
+  unsigned int sample = ADC;
+  if (!probeSimulated[adcProbe]) probeSampleInput(adcProbe, sample);
+  if (++adcProbe >= NUMBER_OF_PROBES) adcProbe = 0;
+  startProbeConversion();
+}
+#else
+// no ADC: synthetic samples only
+void setupProbeAdc()
+{
+}
+#endif
+
+void setupProbes()
+{
+  for (int i = 0; i < NUMBER_OF_PROBES; ++i) {
+    probeAccumulators[i].count = 0;
+    probeRings[i].head = 0;
+    probeRings[i].tail = 0;
+    probeRings[i].overflow = false;
+    probeStates[i].fault = PROBE_NO_READING;
+    probeStates[i].noisyBlocks = 0;
+    probeStates[i].lastBlockTime = millis();
+    probeStates[i].blockCount = 0;
+    probeStates[i].overflowCount = 0;
+    probeSimulated[i] = false;
+  }
+  probeSimulationRunning = false;
+  setupProbeAdc();
+}
+
+void simulateProbe(byte probe, unsigned int level, unsigned int noise, unsigned int spikeInterval)
+{
+  if (probe >= NUMBER_OF_PROBES) return;
+  ProbeSimulation &sim = probeSimulations[probe];
+  sim.level = level;
+  sim.noise = noise;
+  sim.spikeInterval = spikeInterval;
+  sim.samplesSinceSpike = 0;
+  noInterrupts();
+  probeSimulated[probe] = true;
+  probeAccumulators[probe].count = 0;   // discard the part of a block from the ADC
+  interrupts();
+  if (!probeSimulationRunning) lastSimulationTime = millis();
+  probeSimulationRunning = true;
+}
+
+void stopProbeSimulation()
+{
+  for (int i = 0; i < NUMBER_OF_PROBES; ++i) {
+    noInterrupts();
+    probeSimulated[i] = false;
+    probeAccumulators[i].count = 0;
+    interrupts();
+  }
+  probeSimulationRunning = false;
+}
+
+// a pseudo random number 0 .. range-1
+unsigned int simulationRandom(unsigned int range)
+{
+  simulationSeed = simulationSeed * 1103515245UL + 12345;
+  return (simulationSeed >> 16) % range;
+}
+
+void tickProbeSimulation()
+{
+  if (millis() - lastSimulationTime < PROBE_SIMULATION_INTERVAL_MS) return;
+  lastSimulationTime = millis();
+  for (int probe = 0; probe < NUMBER_OF_PROBES; ++probe) {
+    if (!probeSimulated[probe]) continue;
+    ProbeSimulation &sim = probeSimulations[probe];
+    for (int i = 0; i < PROBE_OVERSAMPLE; ++i) {
+      long sample = (long)sim.level + simulationRandom(2 * sim.noise + 1) - sim.noise;
+      if (sim.spikeInterval != 0 && ++sim.samplesSinceSpike >= sim.spikeInterval) {
+        sim.samplesSinceSpike = 0;
+        sample = 1023;
+      }
+      if (sample < 0) sample = 0;
+      if (sample > 1023) sample = 1023;
+      probeSampleInput(probe, sample);
+    }
+  }
+}
+
+ProbeFault checkProbe(const ProbeState &state, unsigned long timenow)
+{
+  if (timenow - state.lastBlockTime > PROBE_STALE_MS) return PROBE_STALE;
+  if (state.blockCount == 0) return PROBE_NO_READING;
+  if (state.reading < PROBE_MIN_VALID || state.reading > PROBE_MAX_VALID) return PROBE_OUT_OF_RANGE;
+  if (state.noisyBlocks >= PROBE_NOISY_BLOCKS) return PROBE_NOISY;
+  return PROBE_OK;
+}
+
+// convert the finished blocks into readings and check for faults
+void tickProbes()
+{
+  if (probeSimulationRunning) tickProbeSimulation();
+  unsigned long timenow = millis();
+  for (int probe = 0; probe < NUMBER_OF_PROBES; ++probe) {
+    ProbeRing &ring = probeRings[probe];
+    ProbeState &state = probeStates[probe];
+    while (ring.tail != ring.head) {
+      const ProbeBlock &block = ring.blocks[ring.tail];
+      state.reading = ((unsigned long)block.trimmedSum * (1 << PROBE_FRACTION_BITS) + PROBE_TRIMMED_SAMPLES / 2) / PROBE_TRIMMED_SAMPLES;
+      state.spread = block.spread;
+      if (block.spread <= PROBE_MAX_SPREAD) {
+        state.noisyBlocks = 0;
+      } else if (state.noisyBlocks < 255) {
+        ++state.noisyBlocks;
+      }
+      ring.tail = (ring.tail + 1) % PROBE_RING_SIZE;
+      state.lastBlockTime = timenow;
+      ++state.blockCount;
+    }
+    if (ring.overflow) {
+      ring.overflow = false;
+      ++state.overflowCount;
+    }
+    ProbeFault fault = checkProbe(state, timenow);
+    if (fault == state.fault) continue;
+    state.fault = fault;
+    if (fault == PROBE_OK || fault == PROBE_NO_READING) {
+      clearErrorFlag(ERRORCODE_PROBE + probe);
+    } else {
+      setErrorFlag(ERRORCODE_PROBE + probe);
+    }
+  }
+}
+
+bool probeReading(byte probe, unsigned int &reading)
+{
+  if (probe >= NUMBER_OF_PROBES || probeStates[probe].fault != PROBE_OK) return false;
+  reading = probeStates[probe].reading;
+  return true;
+}
+
+void printProbes(Print &dest)
+{
+  dest.println(F("probe reading spread blocks overflows source status"));
+  for (int probe = 0; probe < NUMBER_OF_PROBES; ++probe) {
+    const ProbeState &state = probeStates[probe];
+    dest.print(probe); dest.print(' ');
+    dest.print((float)state.reading / (1 << PROBE_FRACTION_BITS), 2); dest.print(' ');
+    dest.print(state.spread); dest.print(' ');
+    dest.print(state.blockCount); dest.print(' ');
+    dest.print(state.overflowCount); dest.print(' ');
+    dest.print(probeSimulated[probe] ? F("synthetic ") : F("adc "));
+    switch (state.fault) {
+      case PROBE_OK: dest.println(F("ok")); break;
+      case PROBE_NO_READING: dest.println(F("no reading")); break;
+      case PROBE_OUT_OF_RANGE: dest.println(F("out of range")); break;
+      case PROBE_NOISY: dest.println(F("noisy")); break;
+      case PROBE_STALE: dest.println(F("stale")); break;
+      default: dest.println(state.fault); break;
+    }
+  }
+}
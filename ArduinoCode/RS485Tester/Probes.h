@@ -0,0 +1,36 @@
+#ifndef PROBES_H
+#define PROBES_H
+#include <Arduino.h>
+
+// Soil moisture probes on analog inputs A0 .. A(NUMBER_OF_PROBES-1).
+// The ADC complete interrupt reads each probe in turn and starts the conversion of the next one.  Every sample goes to
+//   probeSampleInput, which collects PROBE_OVERSAMPLE samples per probe into a block, rejects the highest and lowest
+//   sample of the block as outliers and pushes the sum of the rest into the probe's ring buffer.  No division in the ISR.
+// tickProbes takes the finished blocks from the ring buffers and converts them into the reading: the trimmed mean, in
+//   fixed point 1/16ths of an ADC count (the oversampling gives the extra resolution).
+// A probe is faulty (shown as ERRORCODE_PROBE + probe on the status LED) if its reading is near either end of the range
+//   (open or short circuit), if its samples are too noisy for several blocks in a row, or if no blocks arrive.
+// For testing without probes (or on a host without an ADC), a probe can be fed with a synthetic sample stream instead
+//   of the ADC; the synthetic samples go through the same probeSampleInput.
+
+const byte NUMBER_OF_PROBES = 4;
+const byte PROBE_FRACTION_BITS = 4;   // readings are in 1/16ths of an ADC count
+
+void setupProbes();
+void tickProbes();
+
+// the latest reading of the probe in 1/16ths of an ADC count (0 - 1023 * 16).  Returns false if the probe is faulty
+//   or has no reading yet
+bool probeReading(byte probe, unsigned int &reading);
+
+// add one raw 10-bit sample for the probe.  Called from the ADC interrupt, or by the synthetic sample stream
+void probeSampleInput(byte probe, unsigned int sample);
+
+// feed the probe with synthetic samples instead of the ADC: level +/- noise, with a spike to full scale every
+//   spikeInterval samples (0 = no spikes)
+void simulateProbe(byte probe, unsigned int level, unsigned int noise, unsigned int spikeInterval);
+void stopProbeSimulation();
+
+void printProbes(Print &dest);
+
+#endif
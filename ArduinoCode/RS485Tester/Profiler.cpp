@@ -0,0 +1,124 @@
+#include <Arduino.h>
+#include "Profiler.h"
+
+const byte MAX_PROFILE_POINTS = 13;   // the commands and each tick in loop()
+const byte PROFILE_BUCKETS = 16;  // bucket n counts durations of less than 2^n us; the last bucket also counts all longer ones (> 16 ms)
+const int WORST_COMMAND_LENGTH = 16;
+const unsigned long TOTAL_US_SATURATED = 0xFFFFFFFFUL;
+
+struct ProfileStats {
+  const __FlashStringHelper *name;
+  unsigned long count;
+  unsigned long totalus;      // stops at TOTAL_US_SATURATED (71 minutes), after which only a lower bound of the mean is known
+  unsigned long minus;
+  unsigned long maxus;
+  unsigned int histogram[PROFILE_BUCKETS];
+};
+
+ProfileStats profileStats[MAX_PROFILE_POINTS];
+byte profilePointCount = 0;
+byte commandProfilePoint = NO_PROFILE_POINT;
+char worstCommand[WORST_COMMAND_LENGTH + 1];
+unsigned long worstCommandus;
+unsigned long profileStartTime = 0;
+
+void resetProfileStats(ProfileStats &stats)
+{
+  stats.count = 0;
+  stats.totalus = 0;
+  stats.minus = 0xFFFFFFFFUL;
+  stats.maxus = 0;
+  memset(stats.histogram, 0, sizeof(stats.histogram));
+}
+
+void setupProfiler()
+{
+  profilePointCount = 0;
+  commandProfilePoint = addProfilePoint(F("commands"));
+  resetProfile();
+}
+
+byte addProfilePoint(const __FlashStringHelper *name)
+{
+  if (profilePointCount >= MAX_PROFILE_POINTS) return NO_PROFILE_POINT;
+  profileStats[profilePointCount].name = name;
+  resetProfileStats(profileStats[profilePointCount]);
+  return profilePointCount++;
+}
+
+void resetProfile()
+{
+  for (int i = 0; i < profilePointCount; ++i) {
+    resetProfileStats(profileStats[i]);
+  }
+  worstCommand[0] = '\0';
+  worstCommandus = 0;
+  profileStartTime = millis();
+}
+
+unsigned long profileRecord(byte point, unsigned long starttime)
+{
+  unsigned long timenow = micros();
+  if (point >= profilePointCount) return timenow;
+  unsigned long elapsedus = timenow - starttime;
+  ProfileStats &stats = profileStats[point];
+  ++stats.count;
+  stats.totalus = (elapsedus > TOTAL_US_SATURATED - stats.totalus) ? TOTAL_US_SATURATED : stats.totalus + elapsedus;
+  if (elapsedus < stats.minus) stats.minus = elapsedus;
+  if (elapsedus > stats.maxus) stats.maxus = elapsedus;
+
+  byte bucket = 0;
+  while (elapsedus != 0 && bucket < PROFILE_BUCKETS - 1) {
+    elapsedus >>= 1;
+    ++bucket;
+  }
+  if (stats.histogram[bucket] != 0xFFFF) ++stats.histogram[bucket];
+  return timenow;
+}
+
+void profileCommand(const char command[], unsigned long starttime)
+{
+  unsigned long elapsedus = profileRecord(commandProfilePoint, starttime) - starttime;
+  if (elapsedus >= worstCommandus) {
+    worstCommandus = elapsedus;
+    strncpy(worstCommand, command, WORST_COMMAND_LENGTH);
+    worstCommand[WORST_COMMAND_LENGTH] = '\0';
+  }
+}
+
+void printProfile(Print &dest)
+{
+  dest.print(F("profile over (ms):")); dest.println(millis() - profileStartTime);
+  dest.println(F("name count min(us) mean(us) max(us) histogram {<2^n us:count}"));
+  byte worst = NO_PROFILE_POINT;
+  for (int i = 0; i < profilePointCount; ++i) {
+    ProfileStats &stats = profileStats[i];
+    dest.print(stats.name); dest.print(' ');
+    dest.print(stats.count); dest.print(' ');
+    if (stats.count == 0) {
+      dest.println(F("- - -"));
+      continue;
+    }
+    dest.print(stats.minus); dest.print(' ');
+    if (stats.totalus == TOTAL_US_SATURATED) dest.print('>');
+    dest.print(stats.totalus / stats.count); dest.print(' ');
+    dest.print(stats.maxus);
+    for (int bucket = 0; bucket < PROFILE_BUCKETS; ++bucket) {
+      if (stats.histogram[bucket] == 0) continue;
+      dest.print(' ');
+      if (bucket == PROFILE_BUCKETS - 1) dest.print('>');
+      dest.print(bucket); dest.print(':'); dest.print(stats.histogram[bucket]);
+    }
+    dest.println();
+    if (worst == NO_PROFILE_POINT || stats.maxus > profileStats[worst].maxus) worst = i;
+  }
+  if (worst != NO_PROFILE_POINT) {
+    dest.print(F("worst offender:")); dest.print(profileStats[worst].name);
+    dest.print(F(" max(us):")); dest.println(profileStats[worst].maxus);
+  }
+  if (worstCommandus != 0) {
+    dest.print(F("slowest command:")); dest.print(worstCommand);
+    dest.print(F(" (us):")); dest.println(worstCommandus);
+  }
+  resetProfile();
+}
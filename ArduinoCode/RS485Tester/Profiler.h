@@ -0,0 +1,31 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+#include <Arduino.h>
+
+// Lightweight timing of the functions called from loop(), and of each command executed.
+// For each profile point: count, min, max, mean, and a histogram of the durations (one bucket per power of 2 microseconds).
+//   The mean is printed as >{mean} if the total time at the point passed 2^32 us since the statistics were reset.
+// Typical use:
+//   unsigned long starttime = micros();
+//   tickSomething();
+//   starttime = profileRecord(profileTickSomething, starttime);  // returns micros() at the end, ready for the next one
+
+const byte NO_PROFILE_POINT = 255;
+
+void setupProfiler();
+
+// returns the profile point number to use with profileRecord, or NO_PROFILE_POINT if there are no points left.
+// the name must be in flash, eg addProfilePoint(F("tickSomething"))
+byte addProfilePoint(const __FlashStringHelper *name);
+
+// record the time elapsed since starttime (micros) against the given profile point.  Returns the current micros()
+unsigned long profileRecord(byte point, unsigned long starttime);
+
+// record the time taken to execute the given command (elapsed since starttime)
+void profileCommand(const char command[], unsigned long starttime);
+
+// print the statistics then reset them
+void printProfile(Print &dest);
+void resetProfile();
+
+#endif
@@ -0,0 +1,95 @@
+#include <Arduino.h>
+#include "PulseTrain.h"
+
+const int C_PIN = 3;
+const int D_PIN = 4;
+const int L_PIN = 5;
+
+struct PulseTrainStep {
+  char pinchar;
+  unsigned long durationus;
+};
+
+const int PULSETRAIN_QUEUE_LENGTH = 48;
+PulseTrainStep stepQueue[PULSETRAIN_QUEUE_LENGTH];
+byte stepQueueHead = 0;   // next step to be applied
+byte stepQueueCount = 0;
+bool stepInProgress = false;
+unsigned long stepStartTime;
+unsigned long stepDurationus;
+unsigned long pulseTrainLateSteps = 0;
+
+void setupPulseTrain()
+{
+  pinMode(C_PIN, OUTPUT);
+  pinMode(D_PIN, OUTPUT);
+  pinMode(L_PIN, OUTPUT);
+}
+
+bool queuePulseTrain(const char steps[], unsigned long stepus)
+{
+  int length = strlen(steps);
+  if (stepQueueCount + length > PULSETRAIN_QUEUE_LENGTH) return false;
+  for (int i = 0; i < length; ++i) {
+    PulseTrainStep &step = stepQueue[(stepQueueHead + stepQueueCount) % PULSETRAIN_QUEUE_LENGTH];
+    step.pinchar = steps[i];
+    step.durationus = stepus;
+    ++stepQueueCount;
+  }
+  return true;
+}
+
+bool abortPulseTrain()
+{
+  bool wasRunning = pulseTrainRunning();
+  stepQueueCount = 0;
+  stepInProgress = false;
+  return wasRunning;
+}
+
+bool pulseTrainRunning()
+{
+  return stepInProgress || stepQueueCount > 0;
+}
+
+void applyStep(char pinchar)
+{
+  switch(pinchar) {
+    case 'c': digitalWrite(C_PIN,  LOW); break;    
+    case 'C': digitalWrite(C_PIN,  HIGH); break;    
+    case 'd': digitalWrite(D_PIN,  LOW); break;    
+    case 'D': digitalWrite(D_PIN,  HIGH); break;    
+    case 'l': digitalWrite(L_PIN,  LOW); break;    
+    case 'L': digitalWrite(L_PIN,  HIGH); break;    
+  }
+}
+
+// apply the next step if its time has come (at most one per call).  The next step is timed from when the previous one
+//   was due, not from when it was actually applied, so that the usual jitter of loop() doesn't accumulate into drift.
+//   A step which ends up more than PULSETRAIN_LATE_US late (loop() was held up) is counted, and the next one is timed
+//   from now: the overdue steps aren't fired back to back to catch up
+void tickPulseTrain()
+{
+  unsigned long timenow = micros();
+  if (stepInProgress) {
+    unsigned long elapsedus = timenow - stepStartTime;
+    if (elapsedus < stepDurationus) return;
+    stepInProgress = false;
+    if (elapsedus - stepDurationus > PULSETRAIN_LATE_US) {
+      ++pulseTrainLateSteps;
+      stepStartTime = timenow;
+    } else {
+      stepStartTime += stepDurationus;
+    }
+  } else {
+    stepStartTime = timenow;
+  }
+  if (stepQueueCount == 0) return;
+
+  PulseTrainStep &step = stepQueue[stepQueueHead];
+  stepQueueHead = (stepQueueHead + 1) % PULSETRAIN_QUEUE_LENGTH;
+  --stepQueueCount;
+  applyStep(step.pinchar);
+  stepDurationus = step.durationus;
+  stepInProgress = true;
+}
@@ -1,27 +1,98 @@
 /********************************************************************/
 #include "RS485Tester.h"
 #include "Commands.h"
+#include "SlaveComms.h"
+#include "BusTransactions.h"
+#include "SlaveTable.h"
+#include "BusPoller.h"
+#include "BusSpeed.h"
+#include "Discovery.h"
+#include "TimeSync.h"
+#include "Macros.h"
+#include "Schedule.h"
+#include "DataLog.h"
+#include "Probes.h"
 #include "SystemStatus.h"
+#include "Profiler.h"
 #include <SoftwareSerial.h>
+#include <EEPROM.h>
 /********************************************************************/
 
+byte profileTickCommands;
+byte profileTickSlaveComms;
+byte profileTickBusPoller;
+byte profileTickBusTransactions;
+byte profileTickBusSpeed;
+byte profileTickDiscovery;
+byte profileTickTimeSync;
+byte profileTickMacros;
+byte profileTickSchedule;
+byte profileTickDataLog;
+byte profileTickProbes;
+byte profileTickSystemStatus;
+
 void setup(void) 
 { 
   // start serial port 
   Serial.begin(9600);
-  Serial.print("Version:");
+  Serial.print(F("Version:"));
   Serial.println(RS485T_VERSION); 
-  Serial.println("Setting up"); 
+  Serial.println(F("Setting up")); 
 
+  setupProfiler();
+  profileTickCommands = addProfilePoint(F("tickCommands"));
+  profileTickSlaveComms = addProfilePoint(F("tickSlaveComms"));
+  profileTickBusPoller = addProfilePoint(F("tickBusPoller"));
+  profileTickBusTransactions = addProfilePoint(F("tickBusTransactions"));
+  profileTickBusSpeed = addProfilePoint(F("tickBusSpeed"));
+  profileTickDiscovery = addProfilePoint(F("tickDiscovery"));
+  profileTickTimeSync = addProfilePoint(F("tickTimeSync"));
+  profileTickMacros = addProfilePoint(F("tickMacros"));
+  profileTickSchedule = addProfilePoint(F("tickSchedule"));
+  profileTickDataLog = addProfilePoint(F("tickDataLog"));
+  profileTickProbes = addProfilePoint(F("tickProbes"));
+  profileTickSystemStatus = addProfilePoint(F("tickSystemStatus"));
   setupSystemStatus();
   setupSlaveComms();
+  setupDataLog();
+  setupBusTransactions();
+  setupSlaveTable();
+  setupBusPoller();
+  setupBusSpeed();
+  setupDiscovery();
+  setupTimeSync();
+  setupMacros();
+  setupSchedule();
+  setupProbes();
   setupCommands();
-  Serial.println("Ready"); 
+  Serial.println(F("Ready")); 
 } 
 
 void loop(void) 
 { 
+  unsigned long starttime = micros();
   tickCommands();
+  starttime = profileRecord(profileTickCommands, starttime);
   tickSlaveComms();
+  starttime = profileRecord(profileTickSlaveComms, starttime);
+  tickBusPoller();
+  starttime = profileRecord(profileTickBusPoller, starttime);
+  tickBusTransactions();
+  starttime = profileRecord(profileTickBusTransactions, starttime);
+  tickBusSpeed();
+  starttime = profileRecord(profileTickBusSpeed, starttime);
+  tickDiscovery();
+  starttime = profileRecord(profileTickDiscovery, starttime);
+  tickTimeSync();
+  starttime = profileRecord(profileTickTimeSync, starttime);
+  tickMacros();
+  starttime = profileRecord(profileTickMacros, starttime);
+  tickSchedule();
+  starttime = profileRecord(profileTickSchedule, starttime);
+  tickDataLog();
+  starttime = profileRecord(profileTickDataLog, starttime);
+  tickProbes();
+  starttime = profileRecord(profileTickProbes, starttime);
   tickSystemStatus();
+  profileRecord(profileTickSystemStatus, starttime);
 }
@@ -0,0 +1,57 @@
+#include <Arduino.h>
+#include "RelayBench.h"
+#include "BusTransactions.h"
+#include "SlaveComms.h"
+#include "SystemStatus.h"
+
+bool benchRunning = false;
+byte benchRepetitions;
+unsigned long benchAliveLatencyms;
+
+void benchWritesDone(const Transaction &transaction)
+{
+  benchRunning = false;
+  if (transaction.outcome != TXN_SUCCESS) {
+    console->print(F("relay bench failed: "));
+    if (transaction.outcome == TXN_INVALID_COMMAND) {
+      console->println(F("slave's relays must be off, or slave doesn't support command 107"));
+    } else {
+      printTransaction(*console, transaction);
+    }
+    return;
+  }
+  long totalms = (long)transaction.latencyms - (long)benchAliveLatencyms;
+  byte mode = (transaction.dwordstatus >> 8) & 0xff;
+  console->print(F("id:")); console->print(transaction.byteid, HEX);
+  console->print(mode == RELAY_OUTPUT_FAST ? F(" fast") : F(" slow"));
+  console->print(F(" writes:")); console->print(benchRepetitions);
+  console->print(F(" total(ms):")); console->print(totalms);
+  console->print(F(" per write and latch(ms):")); console->println((float)totalms / benchRepetitions, 2);
+}
+
+void benchAliveDone(const Transaction &transaction)
+{
+  if (transaction.outcome != TXN_SUCCESS) {
+    benchRunning = false;
+    console->print(F("relay bench failed: "));
+    printTransaction(*console, transaction);
+    return;
+  }
+  benchAliveLatencyms = transaction.latencyms;
+  // allow for the extra time the slave spends before replying
+  unsigned int timeoutms = DEFAULT_TRANSACTION_TIMEOUT_MS + benchRepetitions * RELAY_SLOW_WRITE_MS;
+  if (queueTransaction(transaction.byteid, COMMAND_RELAY_BENCH, benchRepetitions, benchWritesDone, NULL, 0, timeoutms) == NO_TRANSACTION) {
+    benchRunning = false;
+    console->println(F("relay bench failed: transaction queue full"));
+    return;
+  }
+}
+
+bool startRelayBench(unsigned char byteid, byte repetitions)
+{
+  if (benchRunning || repetitions == 0 || repetitions > MAX_RELAY_BENCH_REPETITIONS) return false;
+  if (queueTransaction(byteid, COMMAND_ALIVE, 0, benchAliveDone, NULL, 0) == NO_TRANSACTION) return false;
+  benchRepetitions = repetitions;
+  benchRunning = true;
+  return true;
+}
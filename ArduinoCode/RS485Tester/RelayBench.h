@@ -0,0 +1,13 @@
+#ifndef RELAYBENCH_H
+#define RELAYBENCH_H
+#include <Arduino.h>
+
+// Time how long a slave takes to write and latch its relay module (command 107) in its current output mode.
+// The slave does the writes before it replies, so the time per write is the latency of the 107 reply minus the
+//   latency of a 100 (alive) reply, divided by the number of writes.  The slave only allows this while its relays are off.
+// The result is printed to the console when the commands are complete.
+
+// returns false if a bench is already running or the commands couldn't be queued
+bool startRelayBench(unsigned char byteid, byte repetitions);
+
+#endif
@@ -0,0 +1,462 @@
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "Schedule.h"
+#include "BusTransactions.h"
+#include "BusPoller.h"
+#include "SlaveComms.h"
+#include "SlaveTable.h"
+#include "SystemStatus.h"
+#include "Macros.h"
+
+#if SCHEDULE_AVAILABLE
+// EEPROM layout (after the macros, see Macros.cpp)
+//   SCHEDULE_EEPROM_START: signature, version, number of rules
+//   then the rules: MAX_SCHEDULE_RULES x {BYTEID}{relay}{days}{start minute (WORD)}{duration minutes (WORD)}
+//   then the timeline: number of events (WORD), then the events sorted by minute of the week: {minute (WORD)}{event}
+//     event bit 7 = 1 for on, 0 for off; bits 3-0 = rule (the slave and relay are looked up from the rule)
+// The off events for a minute are sorted before the on events, so back-to-back rules leave the relay on.
+const int SCHEDULE_EEPROM_START = MACRO_EEPROM_END;
+const byte SCHEDULE_EEPROM_SIGNATURE = 0x57;
+const byte SCHEDULE_EEPROM_VERSION = 1;
+const int SCHEDULE_RULE_SIZE = 1+1+1+2+2;
+const int SCHEDULE_RULES_START = SCHEDULE_EEPROM_START + 3;
+const int SCHEDULE_TIMELINE_START = SCHEDULE_RULES_START + MAX_SCHEDULE_RULES * SCHEDULE_RULE_SIZE;
+const int SCHEDULE_EVENTS_START = SCHEDULE_TIMELINE_START + 2;
+const int SCHEDULE_EVENT_SIZE = 2+1;
+
+const unsigned int MINUTES_PER_WEEK = 7 * MINUTES_PER_DAY;
+const int MAX_SCHEDULE_EVENTS = MAX_SCHEDULE_RULES * 7 * 2;
+const int SCHEDULE_EEPROM_END = SCHEDULE_EVENTS_START + MAX_SCHEDULE_EVENTS * SCHEDULE_EVENT_SIZE;
+static_assert(SCHEDULE_EEPROM_END <= E2END + 1, "the schedule doesn't fit in the EEPROM: change SCHEDULE_AVAILABLE");
+const byte SCHEDULE_EVENT_ON = 0x80;
+const byte MAX_SCHEDULE_SLAVES = 16;
+const unsigned long SCHEDULE_RETRY_MS = 5000;
+const unsigned long CLOCK_REBASE_MS = 3600000UL;   // see rebaseScheduleClock
+
+// the outputs which the schedule wants for each slave.  The schedule controls all the relays of the slaves it uses.
+struct ScheduleSlave {
+  unsigned char byteid;
+  unsigned long outputs;
+  bool sendPending;
+  bool sending;
+  unsigned long retryTime;
+};
+
+ScheduleRule scheduleRules[MAX_SCHEDULE_RULES];
+byte scheduleRuleCount = 0;
+ScheduleSlave scheduleSlaves[MAX_SCHEDULE_SLAVES];
+byte scheduleRuleSlaves[MAX_SCHEDULE_RULES];   // the schedule slave of each rule
+byte scheduleSlaveCount = 0;
+byte schedulePendingCount = 0;   // number of slaves with sendPending set
+int scheduleEventCount = 0;
+
+bool clockSet = false;
+unsigned long clockBaseMillis;
+unsigned long clockBaseSeconds;      // seconds since Monday 00:00 of the week the clock was set, at clockBaseMillis
+                                     //   (both moved on every hour, see rebaseScheduleClock)
+
+int nextEventIndex;
+unsigned long nextEventWeekStart;    // minutes since the clock base week began, for the week nextEventIndex is in
+unsigned long nextEventDueMillis;    // the time (millis()) when the next event is due
+
+unsigned long scheduleEventsApplied = 0;
+unsigned long scheduleFramesSent = 0;
+unsigned long scheduleFramesSkipped = 0;   // the slave table showed the slave already had the outputs
+unsigned long scheduleSendFailures = 0;
+
+unsigned int readEepromWord(int address)
+{
+  return EEPROM.read(address) | ((unsigned int)EEPROM.read(address + 1) << 8);
+}
+
+void writeEepromWord(int address, unsigned int value)
+{
+  EEPROM.update(address, value & 0xff);
+  EEPROM.update(address + 1, (value >> 8) & 0xff);
+}
+
+unsigned long scheduleSecondsNow()
+{
+  return clockBaseSeconds + (millis() - clockBaseMillis) / 1000;
+}
+
+// move the clock base on to the current second, so that millis() - clockBaseMillis stays small: it would overflow
+//   49.7 days after the clock was set.  The time of week doesn't change
+void rebaseScheduleClock()
+{
+  unsigned long elapsedSeconds = (millis() - clockBaseMillis) / 1000;
+  clockBaseMillis += elapsedSeconds * 1000;
+  clockBaseSeconds += elapsedSeconds;
+}
+
+// read the time of the event at nextEventIndex and work out when it is due
+void loadNextEvent()
+{
+  unsigned long minute = nextEventWeekStart + readEepromWord(SCHEDULE_EVENTS_START + nextEventIndex * SCHEDULE_EVENT_SIZE);
+  nextEventDueMillis = clockBaseMillis + (minute * 60 - clockBaseSeconds) * 1000;
+}
+
+void advanceNextEvent()
+{
+  if (++nextEventIndex >= scheduleEventCount) {
+    nextEventIndex = 0;
+    nextEventWeekStart += MINUTES_PER_WEEK;
+  }
+  loadNextEvent();
+}
+
+void markSchedulePending(ScheduleSlave &slave)
+{
+  if (slave.sendPending) return;
+  slave.sendPending = true;
+  ++schedulePendingCount;
+}
+
+// the schedule slave for the byteid, added if necessary
+byte scheduleSlaveIndex(unsigned char byteid)
+{
+  for (int i = 0; i < scheduleSlaveCount; ++i) {
+    if (scheduleSlaves[i].byteid == byteid) return i;
+  }
+  ScheduleSlave &slave = scheduleSlaves[scheduleSlaveCount];
+  slave.byteid = byteid;
+  slave.outputs = 0;
+  slave.sendPending = false;
+  slave.sending = false;
+  slave.retryTime = 0;
+  return scheduleSlaveCount++;
+}
+
+// sort key for an event: minute of the week, then off before on, then rule and day to make each key unique
+unsigned long scheduleEventKey(byte rule, byte day, bool on)
+{
+  const ScheduleRule &r = scheduleRules[rule];
+  unsigned long minute = (day * (unsigned long)MINUTES_PER_DAY + r.startMinute + (on ? 0 : r.durationMinutes)) % MINUTES_PER_WEEK;
+  return (minute << 16) | (on ? 0x8000 : 0) | (rule << 3) | day;
+}
+
+// compile the rules into the timeline, in order, by repeatedly finding the smallest event after the previous one.
+// This is slow (it only happens when the rules change) but needs no memory for sorting
+void compileSchedule()
+{
+  scheduleSlaveCount = 0;
+  schedulePendingCount = 0;
+  for (int i = 0; i < scheduleRuleCount; ++i) {
+    scheduleRuleSlaves[i] = scheduleSlaveIndex(scheduleRules[i].byteid);
+  }
+
+  int count = 0;
+  unsigned long lastKey = 0;
+  while (true) {
+    bool found = false;
+    unsigned long bestKey = 0;
+    for (byte rule = 0; rule < scheduleRuleCount; ++rule) {
+      for (byte day = 0; day < 7; ++day) {
+        if (!(scheduleRules[rule].days & (1 << day))) continue;
+        for (int on = 0; on < 2; ++on) {
+          unsigned long key = scheduleEventKey(rule, day, on);
+          if ((count == 0 || key > lastKey) && (!found || key < bestKey)) {
+            bestKey = key;
+            found = true;
+          }
+        }
+      }
+    }
+    if (!found || count >= MAX_SCHEDULE_EVENTS) break;
+    byte rule = (bestKey >> 3) & 0x0F;
+    byte event = ((bestKey & 0x8000) ? SCHEDULE_EVENT_ON : 0) | rule;
+    int address = SCHEDULE_EVENTS_START + count * SCHEDULE_EVENT_SIZE;
+    writeEepromWord(address, bestKey >> 16);
+    EEPROM.update(address + 2, event);
+    lastKey = bestKey;
+    ++count;
+  }
+  scheduleEventCount = count;
+  writeEepromWord(SCHEDULE_TIMELINE_START, count);
+}
+
+// work out what the outputs should be now, send them to all the slaves, and find the next event.
+// Called when the clock is set or the rules change.
+void restartSchedule()
+{
+  if (scheduleRuleCount > 0 && !clockSet) {
+    setErrorFlag(ERRORCODE_RTC);
+  } else {
+    clearErrorFlag(ERRORCODE_RTC);
+  }
+  if (!clockSet) return;
+
+  unsigned long minuteNow = scheduleSecondsNow() / 60;
+  unsigned int minuteOfWeek = minuteNow % MINUTES_PER_WEEK;
+  for (int i = 0; i < scheduleSlaveCount; ++i) {
+    scheduleSlaves[i].outputs = 0;
+  }
+  for (int rule = 0; rule < scheduleRuleCount; ++rule) {
+    const ScheduleRule &r = scheduleRules[rule];
+    for (byte day = 0; day < 7; ++day) {
+      if (!(r.days & (1 << day))) continue;
+      unsigned int start = day * MINUTES_PER_DAY + r.startMinute;
+      if ((minuteOfWeek + MINUTES_PER_WEEK - start) % MINUTES_PER_WEEK < r.durationMinutes) {
+        scheduleSlaves[scheduleSlaveIndex(r.byteid)].outputs |= (1UL << r.relay);
+      }
+    }
+  }
+  for (int i = 0; i < scheduleSlaveCount; ++i) {
+    markSchedulePending(scheduleSlaves[i]);
+  }
+
+  if (scheduleEventCount == 0) return;
+  // the first event after this minute (the events for this minute are already included above)
+  int low = 0;
+  int high = scheduleEventCount;
+  while (low < high) {
+    int mid = (low + high) / 2;
+    if (readEepromWord(SCHEDULE_EVENTS_START + mid * SCHEDULE_EVENT_SIZE) <= minuteOfWeek) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  nextEventWeekStart = minuteNow - minuteOfWeek;
+  nextEventIndex = low;
+  if (nextEventIndex >= scheduleEventCount) {
+    nextEventIndex = 0;
+    nextEventWeekStart += MINUTES_PER_WEEK;
+  }
+  loadNextEvent();
+}
+
+void saveScheduleRules()
+{
+  EEPROM.update(SCHEDULE_EEPROM_START + 2, scheduleRuleCount);
+  for (int i = 0; i < scheduleRuleCount; ++i) {
+    const ScheduleRule &rule = scheduleRules[i];
+    int address = SCHEDULE_RULES_START + i * SCHEDULE_RULE_SIZE;
+    EEPROM.update(address, rule.byteid);
+    EEPROM.update(address + 1, rule.relay);
+    EEPROM.update(address + 2, rule.days);
+    writeEepromWord(address + 3, rule.startMinute);
+    writeEepromWord(address + 5, rule.durationMinutes);
+  }
+}
+
+void setupSchedule()
+{
+  clockSet = false;
+  if (EEPROM.read(SCHEDULE_EEPROM_START) != SCHEDULE_EEPROM_SIGNATURE || EEPROM.read(SCHEDULE_EEPROM_START + 1) != SCHEDULE_EEPROM_VERSION) {
+    scheduleRuleCount = 0;
+    saveScheduleRules();
+    EEPROM.update(SCHEDULE_EEPROM_START, SCHEDULE_EEPROM_SIGNATURE);
+    EEPROM.update(SCHEDULE_EEPROM_START + 1, SCHEDULE_EEPROM_VERSION);
+  }
+  scheduleRuleCount = EEPROM.read(SCHEDULE_EEPROM_START + 2);
+  if (scheduleRuleCount > MAX_SCHEDULE_RULES) scheduleRuleCount = 0;
+  for (int i = 0; i < scheduleRuleCount; ++i) {
+    ScheduleRule &rule = scheduleRules[i];
+    int address = SCHEDULE_RULES_START + i * SCHEDULE_RULE_SIZE;
+    rule.byteid = EEPROM.read(address);
+    rule.relay = EEPROM.read(address + 1);
+    rule.days = EEPROM.read(address + 2);
+    rule.startMinute = readEepromWord(address + 3);
+    rule.durationMinutes = readEepromWord(address + 5);
+  }
+  compileSchedule();
+  restartSchedule();
+}
+
+void setScheduleClock(byte day, unsigned long secondOfDay)
+{
+  clockBaseMillis = millis();
+  clockBaseSeconds = day * MINUTES_PER_DAY * 60UL + secondOfDay;
+  clockSet = true;
+  restartSchedule();
+}
+
+bool scheduleClockSet()
+{
+  return clockSet;
+}
+
+bool addScheduleRule(const ScheduleRule &rule)
+{
+  if (scheduleRuleCount >= MAX_SCHEDULE_RULES || rule.relay >= MAX_RELAYS || (rule.days & ALL_DAYS) == 0
+      || rule.startMinute >= MINUTES_PER_DAY || rule.durationMinutes == 0 || rule.durationMinutes > MINUTES_PER_DAY) {
+    return false;
+  }
+  scheduleRules[scheduleRuleCount] = rule;
+  scheduleRules[scheduleRuleCount].days &= ALL_DAYS;
+  ++scheduleRuleCount;
+  saveScheduleRules();
+  compileSchedule();
+  restartSchedule();
+  return true;
+}
+
+bool deleteScheduleRule(byte ruleNumber)
+{
+  if (ruleNumber >= scheduleRuleCount) return false;
+  unsigned char byteid = scheduleRules[ruleNumber].byteid;
+  for (int i = ruleNumber; i < scheduleRuleCount - 1; ++i) {
+    scheduleRules[i] = scheduleRules[i + 1];
+  }
+  --scheduleRuleCount;
+  saveScheduleRules();
+  compileSchedule();
+  restartSchedule();
+
+  // if that was the last rule for the slave, it is no longer in the schedule: turn its relays off
+  for (int i = 0; i < scheduleSlaveCount; ++i) {
+    if (scheduleSlaves[i].byteid == byteid) return true;
+  }
+  if (slaveOutputsConfirmed(byteid, 0)) {
+    ++scheduleFramesSkipped;
+  } else if (queueTransaction(byteid, COMMAND_CHANGE_OUTPUT, 0, NULL, NULL) != NO_TRANSACTION) {
+    pollSlaveSoon(byteid);
+  }
+  return true;
+}
+
+void scheduleOutputSent(const Transaction &transaction)
+{
+  ScheduleSlave &slave = *(ScheduleSlave *)transaction.context;
+  slave.sending = false;
+  if (transaction.outcome != TXN_SUCCESS) {
+    ++scheduleSendFailures;
+    slave.retryTime = millis() + SCHEDULE_RETRY_MS;
+    markSchedulePending(slave);
+  }
+}
+
+// send a change output command to each slave whose outputs have changed (one command per slave however many relays
+//   changed), unless the slave table shows that the slave already has those outputs
+void sendScheduleOutputs()
+{
+  unsigned long timenow = millis();
+  for (int i = 0; i < scheduleSlaveCount; ++i) {
+    ScheduleSlave &slave = scheduleSlaves[i];
+    if (!slave.sendPending || slave.sending || (long)(timenow - slave.retryTime) < 0) continue;
+    if (slaveOutputsConfirmed(slave.byteid, slave.outputs)) {
+      ++scheduleFramesSkipped;
+      slave.sendPending = false;
+      --schedulePendingCount;
+      continue;
+    }
+    if (queueTransaction(slave.byteid, COMMAND_CHANGE_OUTPUT, slave.outputs, scheduleOutputSent, &slave) == NO_TRANSACTION) return;
+    ++scheduleFramesSent;
+    slave.sending = true;
+    slave.sendPending = false;
+    --schedulePendingCount;
+    pollSlaveSoon(slave.byteid);
+  }
+}
+
+// apply all the events which are due.  (If the loop was held up, several minutes' worth may be due at once)
+void tickSchedule()
+{
+  if (clockSet && millis() - clockBaseMillis >= CLOCK_REBASE_MS) rebaseScheduleClock();
+  if (clockSet && scheduleEventCount > 0 && (long)(millis() - nextEventDueMillis) >= 0) {
+    for (int i = 0; i < scheduleEventCount && (long)(millis() - nextEventDueMillis) >= 0; ++i) {
+      byte event = EEPROM.read(SCHEDULE_EVENTS_START + nextEventIndex * SCHEDULE_EVENT_SIZE + 2);
+      byte rule = event & 0x0F;
+      ScheduleSlave &slave = scheduleSlaves[scheduleRuleSlaves[rule]];
+      unsigned long bitmask = 1UL << scheduleRules[rule].relay;
+      unsigned long newOutputs = (event & SCHEDULE_EVENT_ON) ? (slave.outputs | bitmask) : (slave.outputs & ~bitmask);
+      if (newOutputs != slave.outputs) {
+        slave.outputs = newOutputs;
+        markSchedulePending(slave);
+      }
+      ++scheduleEventsApplied;
+      advanceNextEvent();
+    }
+  }
+  if (schedulePendingCount > 0) sendScheduleOutputs();
+}
+
+const char DAY_NAMES[] PROGMEM = "MonTueWedThuFriSatSun";
+
+void printDayAndTime(Print &dest, unsigned long minuteOfWeek)
+{
+  byte day = (minuteOfWeek / MINUTES_PER_DAY) % 7;
+  for (byte i = 0; i < 3; ++i) {
+    dest.print((char)pgm_read_byte(&DAY_NAMES[day * 3 + i]));
+  }
+  dest.print(' ');
+  unsigned int minuteOfDay = minuteOfWeek % MINUTES_PER_DAY;
+  dest.print(minuteOfDay / 60); dest.print(':');
+  if (minuteOfDay % 60 < 10) dest.print('0');
+  dest.print(minuteOfDay % 60);
+}
+
+void printSchedule(Print &dest)
+{
+  dest.print(F("clock:"));
+  if (clockSet) {
+    printDayAndTime(dest, (scheduleSecondsNow() / 60) % MINUTES_PER_WEEK);
+    dest.println();
+  } else {
+    dest.println(F("not set"));
+  }
+  dest.println(F("rule id relay days start minutes"));
+  for (int i = 0; i < scheduleRuleCount; ++i) {
+    const ScheduleRule &rule = scheduleRules[i];
+    dest.print(i); dest.print(' ');
+    dest.print(rule.byteid, HEX); dest.print(' ');
+    dest.print(rule.relay); dest.print(' ');
+    dest.print(rule.days, HEX); dest.print(' ');
+    dest.print(rule.startMinute / 60); dest.print(':');
+    if (rule.startMinute % 60 < 10) dest.print('0');
+    dest.print(rule.startMinute % 60); dest.print(' ');
+    dest.println(rule.durationMinutes);
+  }
+  dest.print(F("events:")); dest.println(scheduleEventCount);
+  if (clockSet && scheduleEventCount > 0) {
+    int address = SCHEDULE_EVENTS_START + nextEventIndex * SCHEDULE_EVENT_SIZE;
+    byte event = EEPROM.read(address + 2);
+    dest.print(F("next event:"));
+    printDayAndTime(dest, readEepromWord(address));
+    const ScheduleRule &rule = scheduleRules[event & 0x0F];
+    dest.print(F(" id:")); dest.print(rule.byteid, HEX);
+    dest.print(F(" relay:")); dest.print(rule.relay);
+    dest.println((event & SCHEDULE_EVENT_ON) ? F(" on") : F(" off"));
+  }
+  dest.print(F("events applied:")); dest.print(scheduleEventsApplied);
+  dest.print(F(" frames sent:")); dest.print(scheduleFramesSent);
+  dest.print(F(" skipped:")); dest.print(scheduleFramesSkipped);
+  dest.print(F(" send failures:")); dest.println(scheduleSendFailures);
+}
+
+#else
+// not enough EEPROM for the schedule (see Schedule.h): the rest of the sketch runs without it
+
+void setupSchedule()
+{
+}
+
+void tickSchedule()
+{
+}
+
+void setScheduleClock(byte, unsigned long)
+{
+}
+
+bool scheduleClockSet()
+{
+  return false;
+}
+
+bool addScheduleRule(const ScheduleRule &)
+{
+  return false;
+}
+
+bool deleteScheduleRule(byte)
+{
+  return false;
+}
+
+void printSchedule(Print &dest)
+{
+  dest.println(F("no schedule: it needs a board with at least 2 KB of EEPROM, such as a Mega"));
+}
+#endif
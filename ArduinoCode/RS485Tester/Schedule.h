@@ -0,0 +1,47 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+#include <Arduino.h>
+
+// Watering schedule: recurring rules which turn a relay on for a number of minutes at the same time on chosen days of
+//   the week.
+// The rules are stored in EEPROM and compiled into a timeline of on/off events sorted by time of week (also in EEPROM).
+//   tickSchedule only compares the time against the next event; when events fall due, all the events for the same
+//   minute are applied together and each slave with changed relays gets a single change output (102) command.
+// There is no real time clock: the time of week must be set with setScheduleClock after each reset, after which it
+//   runs from millis().  Until then the schedule doesn't run and ERRORCODE_RTC is shown.
+// The rules and the timeline take 789 bytes of EEPROM after the macros' 1 KB, so the schedule is only built for a
+//   board with at least 2 KB of EEPROM, such as the Mega (4 KB).  On a smaller one, such as the Uno, the rest of the
+//   sketch builds without it: the functions below do nothing, addScheduleRule returns false and printSchedule says so.
+// Overlapping rules for the same relay aren't merged: the relay turns off at the end of the first rule.
+
+#define SCHEDULE_AVAILABLE (E2END >= 2047)
+
+const byte MAX_SCHEDULE_RULES = 16;
+const unsigned int MINUTES_PER_DAY = 24 * 60;
+const byte ALL_DAYS = 0x7F;   // bit 0 = Monday, bit 6 = Sunday
+
+struct ScheduleRule {
+  unsigned char byteid;
+  byte relay;                  // 0 - 31
+  byte days;                   // bitmask, bit 0 = Monday
+  unsigned int startMinute;    // minute of the day
+  unsigned int durationMinutes;
+};
+
+void setupSchedule();
+void tickSchedule();
+
+// day = 0 (Monday) - 6 (Sunday)
+void setScheduleClock(byte day, unsigned long secondOfDay);
+bool scheduleClockSet();
+
+// returns false if the rule is invalid or there are already MAX_SCHEDULE_RULES rules
+bool addScheduleRule(const ScheduleRule &rule);
+
+// returns false if there is no such rule
+bool deleteScheduleRule(byte ruleNumber);
+
+// print the clock, the rules, and the next event
+void printSchedule(Print &dest);
+
+#endif
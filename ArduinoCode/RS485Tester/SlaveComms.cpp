@@ -1,89 +1,264 @@
 #include <Arduino.h>
-#include <SoftwareSerial.h>
-#include <DigitalIO.h>
 #include "SlaveComms.h"
+#include "BusTransport.h"
+#include "Crc16.h"
 #include "SystemStatus.h"
+#include "Commands.h"
 
-const int RS485_RX_PIN = 10;
-const int RS485_TX_PIN = 11;
-const int RS485_SENDMODE_PIN = 12;
-
-SoftwareSerial rs485serial(RS485_RX_PIN, RS485_TX_PIN);
+BusTransport *busTransport = &softwareSerialTransport;
+unsigned long busBaudRate = BUS_BASE_BAUD_RATE;
 
 void setupSlaveComms()
 {
-  pinMode(RS485_RX_PIN, INPUT);
-  pinMode(RS485_TX_PIN, OUTPUT);
-  pinMode(RS485_SENDMODE_PIN, OUTPUT);
-  digitalWrite(RS485_SENDMODE_PIN, LOW);
-  rs485serial.begin(4800);
+  busTransport->begin(busBaudRate);
+}
+
+const unsigned char COMMAND_ATTENTION_BYTE = '#';          // version 2
+const unsigned char V1_REPLY_ATTENTION_BYTE = '$';
+const unsigned char REPLY_ATTENTION_BYTE = '%';            // version 2
+const unsigned char REPLAYED_REPLY_ATTENTION_BYTE = '&';   // version 2, repeated from the slave's reply cache
+const int V1_REPLY_BASELEN = 1+1+4;
+const int REPLY_BASELEN = 1+1+4+1;
+const int REPLY_CRC16LEN = 2;
+const int REPLY_PAYLOADLEN = REPLY_BASELEN + REPLY_CRC16LEN;
+const unsigned long REPLY_INTERBYTE_TIMEOUT_MS = 20;  // 4800 baud = approx 2 ms per byte
+
+enum ReplyRxState {RX_WAIT_FOR_ATTENTION, RX_PAYLOAD};
+
+ReplyRxState replyRxState = RX_WAIT_FOR_ATTENTION;
+unsigned char replyBuffer[REPLY_PAYLOADLEN];
+unsigned char replyBufferIdx;
+unsigned char replyAttentionByte;
+unsigned char replyBaseLength;   // the bytes covered by the CRC: depends on the version
+unsigned short replyCrc;
+unsigned long replyLastByteTime;
+
+SlaveReplyCallback slaveReplyCallback = NULL;
+
+unsigned long rxRepliesCount = 0;
+unsigned long rxCrcErrorCount = 0;
+unsigned long rxTimeoutCount = 0;
+unsigned long rxDiscardedBytesCount = 0;
+unsigned long rxOverflowCount = 0;
+
+void setBusTransport(BusTransport *transport)
+{
+  busTransport->end();
+  busTransport = (transport == NULL) ? &softwareSerialTransport : transport;
+  busTransport->begin(busBaudRate);
+  replyRxState = RX_WAIT_FOR_ATTENTION;
+}
+
+void setBusBaudRate(unsigned long baud)
+{
+  busBaudRate = baud;
+  busTransport->end();
+  busTransport->begin(busBaudRate);
+  replyRxState = RX_WAIT_FOR_ATTENTION;
+}
+
+unsigned long getBusBaudRate()
+{
+  return busBaudRate;
+}
+
+BusTransport *getBusTransport()
+{
+  return busTransport;
+}
+
+bool busSending()
+{
+  return busTransport->sending();
+}
+
+void setSlaveReplyCallback(SlaveReplyCallback callback)
+{
+  slaveReplyCallback = callback;
+}
+
+void printReply(const SlaveReply &reply)
+{
+  console->print(F("reply from:")); console->print(reply.byteid, HEX);
+  console->print(F(" cmd:")); console->print(reply.bytecommand, HEX);
+  console->print(F(" status:")); console->print(reply.dwordstatus, HEX);
+  console->println(reply.replayed ? F(" (replayed)") : F(""));
+}
+
+void printSlaveCommsStats(Print &dest)
+{
+  dest.print(F("replies:")); dest.println(rxRepliesCount);
+  dest.print(F("crc errors:")); dest.println(rxCrcErrorCount);
+  dest.print(F("timeouts:")); dest.println(rxTimeoutCount);
+  dest.print(F("discarded bytes:")); dest.println(rxDiscardedBytesCount);
+  dest.print(F("rx overflows:")); dest.println(rxOverflowCount);
+}
+
+unsigned long rxGarbledCount()
+{
+  return rxCrcErrorCount + rxTimeoutCount + rxDiscardedBytesCount;
+}
+
+// the payload and CRC16 have all arrived; check the CRC and pass the reply on
+void replyComplete()
+{
+  unsigned short receivedCrc = replyBuffer[replyBaseLength] | ((unsigned short)replyBuffer[replyBaseLength+1] << 8);
+  if (crc16Finalize(replyCrc) != receivedCrc) {
+    ++rxCrcErrorCount;
+    return;
+  }
+  ++rxRepliesCount;
+  SlaveReply reply;
+  reply.byteid = replyBuffer[0];
+  reply.bytecommand = replyBuffer[1];
+  reply.dwordstatus = (unsigned long)replyBuffer[2]
+                      | ((unsigned long)replyBuffer[3] << 8)
+                      | ((unsigned long)replyBuffer[4] << 16)
+                      | ((unsigned long)replyBuffer[5] << 24);
+  reply.sequence = (replyAttentionByte == V1_REPLY_ATTENTION_BYTE) ? NO_SEQUENCE : replyBuffer[6];
+  reply.replayed = (replyAttentionByte == REPLAYED_REPLY_ATTENTION_BYTE);
+  if (slaveReplyCallback != NULL) {
+    slaveReplyCallback(reply);
+  } else {
+    printReply(reply);
+  }
+}
+
+// advance the reply state machine by one received byte
+void replyRxByte(unsigned char c)
+{
+  switch (replyRxState) {
+    case RX_WAIT_FOR_ATTENTION: {
+      if (c == REPLY_ATTENTION_BYTE || c == REPLAYED_REPLY_ATTENTION_BYTE || c == V1_REPLY_ATTENTION_BYTE) {
+        replyAttentionByte = c;
+        replyBaseLength = (c == V1_REPLY_ATTENTION_BYTE) ? V1_REPLY_BASELEN : REPLY_BASELEN;
+        replyBufferIdx = 0;
+        replyCrc = crc16Init();
+        replyRxState = RX_PAYLOAD;
+      } else {
+        ++rxDiscardedBytesCount;
+      }
+      break;
+    }
+    case RX_PAYLOAD: {
+      if (replyBufferIdx >= REPLY_PAYLOADLEN) {
+        assertFailureCode = ASSERT_INDEX_OUT_OF_BOUNDS;
+        replyRxState = RX_WAIT_FOR_ATTENTION;
+        break;
+      }
+      if (replyBufferIdx < replyBaseLength) {
+        replyCrc = crc16Update(replyCrc, c);
+      }
+      replyBuffer[replyBufferIdx++] = c;
+      if (replyBufferIdx == replyBaseLength + REPLY_CRC16LEN) {
+        replyRxState = RX_WAIT_FOR_ATTENTION;
+        replyComplete();
+      }
+      break;
+    }
+    default: {
+      assertFailureCode = ASSERT_INVALID_SWITCH;
+      replyRxState = RX_WAIT_FOR_ATTENTION;
+      break;
+    }
+  }
 }
 
+// Drain all received bytes through the reply state machine.
+// A partly-received reply is abandoned if the next byte doesn't arrive in time.
 void tickSlaveComms()
 {
-  if (rs485serial.available()) {
-    char c = rs485serial.read();
-    console->print(c, HEX);     
-  }  
+  if (busTransport->overflow()) {
+    ++rxOverflowCount;
+  }
+  if (!busTransport->available()) {
+    if (replyRxState != RX_WAIT_FOR_ATTENTION && millis() - replyLastByteTime > REPLY_INTERBYTE_TIMEOUT_MS) {
+      ++rxTimeoutCount;
+      replyRxState = RX_WAIT_FOR_ATTENTION;
+    }
+    return;
+  }
+  while (busTransport->available()) {
+    replyRxByte((unsigned char)busTransport->read());
+  }
+  replyLastByteTime = millis();
 }
 
 // Send the given command on the RS485 serial bus.
-// Puts the line into write mode, sends the command details including CRC16 checksum, then places line back into read mode
-// returns true for success, false otherwise
-bool sendCommand(unsigned char byteid, unsigned char bytecommand, unsigned long dwordparameter)
+// The transport puts the line into write mode, sends the command details including CRC16 checksum, then places line back into read mode
+// returns true for success, false otherwise (including if the previous frame hasn't finished sending yet)
+bool sendCommand(unsigned char byteid, unsigned char bytecommand, unsigned long dwordparameter, byte sequence)
 {
-  const int BASELEN = 1+1+4;
+  const int ATTENTIONLEN = 1;
+  const int BASELEN = 1+1+4+1;
   const int CRC16LEN = 2;
-  const int BUFFLEN = BASELEN + CRC16LEN;
+  const int BUFFLEN = ATTENTIONLEN + BASELEN + CRC16LEN;
   unsigned char writebuffer[BUFFLEN];
-  writebuffer[0] = byteid;
-  writebuffer[1] = bytecommand;
-  writebuffer[2] = dwordparameter & 0xff;
-  writebuffer[3] = (dwordparameter>>8) & 0xff;
-  writebuffer[4] = (dwordparameter>>16) & 0xff;
-  writebuffer[5] = (dwordparameter>>24) & 0xff;
+  unsigned char *payload = writebuffer + ATTENTIONLEN;
+  writebuffer[0] = COMMAND_ATTENTION_BYTE;
+  payload[0] = byteid;
+  payload[1] = bytecommand;
+  payload[2] = dwordparameter & 0xff;
+  payload[3] = (dwordparameter>>8) & 0xff;
+  payload[4] = (dwordparameter>>16) & 0xff;
+  payload[5] = (dwordparameter>>24) & 0xff;
+  payload[6] = sequence;
 
   unsigned short checksum;
-  checksum = crc16(writebuffer, BASELEN);
-  writebuffer[BASELEN] = checksum & 0xff;
-  writebuffer[BASELEN+1] = (checksum>>8) & 0xff;
+  checksum = crc16(payload, BASELEN);
+  payload[BASELEN] = checksum & 0xff;
+  payload[BASELEN+1] = (checksum>>8) & 0xff;
 
-  digitalWrite(RS485_SENDMODE_PIN, HIGH);
-  int byteswritten = rs485serial.write(writebuffer, BUFFLEN);
-  digitalWrite(RS485_SENDMODE_PIN, LOW);
-  return (byteswritten == BUFFLEN);
+  return busTransport->sendFrame(writebuffer, BUFFLEN);
 }
 
-unsigned short crc16(const unsigned char* data_p, unsigned char length){
-    unsigned char x;
-    unsigned short crc = 0xFFFF;
+bool commandExpectsReply(unsigned char byteid, unsigned char bytecommand)
+{
+  return byteid != BROADCAST_BYTEID && bytecommand != COMMAND_MULTICAST_OUTPUT;
+}
 
-    while (length--){
-        x = crc >> 8 ^ *data_p++;
-        x ^= x>>4;
-        crc = (crc << 8) ^ ((unsigned short)(x << 12)) ^ ((unsigned short)(x <<5)) ^ ((unsigned short)x);
+bool commandChangesOutputs(unsigned char bytecommand)
+{
+  return bytecommand == COMMAND_CHANGE_OUTPUT || bytecommand == COMMAND_MULTICAST_OUTPUT || isRelayMaskCommand(bytecommand);
+}
+
+bool commandStagesOutputs(unsigned char bytecommand)
+{
+  return bytecommand >= COMMAND_TIME_BEACON && bytecommand <= COMMAND_ARM_STAGED_OUTPUT;
+}
+
+bool isRelayMaskCommand(unsigned char bytecommand)
+{
+  return bytecommand >= COMMAND_SET_RELAYS && bytecommand <= COMMAND_TOGGLE_RELAYS;
+}
+
+unsigned long applyRelayMask(unsigned char bytecommand, unsigned long states, unsigned long mask)
+{
+  switch (bytecommand) {
+    case COMMAND_SET_RELAYS: return states | mask;
+    case COMMAND_CLEAR_RELAYS: return states & ~mask;
+    case COMMAND_TOGGLE_RELAYS: return states ^ mask;
+    default: {
+      assertFailureCode = ASSERT_INVALID_SWITCH;
+      return states;
     }
-    return crc;
+  }
 }
 
-// Send a test char on the RS485 serial bus.
+// Send a test char on the RS485 serial bus 1000 times.
 // Puts the line into write mode, sends the char, then places line back into read mode
 // returns true for success, false otherwise
 bool sendCommandTestChar()
 {
   bool success = true;
-  const int BASELEN = 1+1+4;
-  const int CRC16LEN = 2;
-  const int BUFFLEN = BASELEN + CRC16LEN;
-  unsigned char writebuffer[BUFFLEN];
-  writebuffer[0] = '!';
+  const unsigned char testchar = '!';
 
-  digitalWrite(RS485_SENDMODE_PIN, HIGH);
   for (int i = 0; i < 1000; ++i) {
-    int byteswritten = rs485serial.write(writebuffer, 1);
-    if (byteswritten != 1) success = false;
+    while (busTransport->sending()) {
+    }
+    if (!busTransport->sendFrame(&testchar, 1)) success = false;
+    collectCommands();  // this takes a couple of seconds; don't let the console input overflow meanwhile
   }  
-  digitalWrite(RS485_SENDMODE_PIN, LOW);
   return success;
 }
 
@@ -91,15 +266,62 @@ bool sendCommandTestChar()
 /*
  * Protocol for communicating with slave device is:
  * 
- * 1) Master sends !{BYTEID}{BYTECOMMAND}{DWORDCOMMANDPARAM}{CRC16} then releases bus and waits for reply
- * 2) Slave waits at least 100 ms then responds ${BYTEID}{BYTECOMMAND}{DWORDSTATUS}{CRC16} then releases bus
+ * 1) Master sends #{BYTEID}{BYTECOMMAND}{DWORDCOMMANDPARAM}{SEQUENCE}{CRC16} then releases bus and waits for reply
+ * 2) Slave waits (100 ms by default, see 108) then responds %{BYTEID}{BYTECOMMAND}{DWORDSTATUS}{SEQUENCE}{CRC16} then
+ *    releases bus
+ * 
+ * The attention byte gives the frame version.  This is version 2; version 1 frames have no sequence number:
+ *   !{BYTEID}{BYTECOMMAND}{DWORDCOMMANDPARAM}{CRC16}, reply ${BYTEID}{BYTECOMMAND}{DWORDSTATUS}{CRC16}
+ * The CRC16 covers everything between the attention byte and the CRC.
+ * The master gives each command a new SEQUENCE (1 - 255, rolling over), and sends it again with the same SEQUENCE if no
+ * reply arrives.  The slave keeps its last reply: if the same request (SEQUENCE and CRC16) arrives again, the slave
+ * doesn't act on it again but repeats the reply with attention byte & instead of %, so that the master can tell that
+ * its request got through and the reply was lost.  SEQUENCE 0 = not repeated (always acted on).
+ * 
+ * Broadcast and multicast frames are acted on by all the addressed slaves, which don't reply:
+ * - a frame sent to BYTEID '*' is a broadcast to all slaves
+ * - command 103 is a multicast to the group of four slaves BYTEID, BYTEID+1, BYTEID+2, BYTEID+3.
+ * The master should poll the slaves afterwards to confirm the result.
  * 
  * Commands:
- * 100 = are you alive?  Response = device status; byte0 = status (0=good), bytes 1, 2, 3 = errorcounts (debug)
+ * 100 = are you alive?  Response = device status; byte0 = status (0=good), bytes 1, 2 = errorcounts (debug),
+ *       byte 3 = number of repeated requests answered from the reply cache
  * 
- * For solenoids:
- * 101 = what is your current output?  Response = output (bits 0->7 = current states, bits 8->15 = target states)
- * 102 = change output (bits 0->31).  Response = repeat target output
+ * For solenoids (relay n = bit n, up to 32 relays on daisy-chained relay modules):
+ * 101 = what is your output?  byte 0 = 0 for the current states, 1 for the target states, 2 for the staged states
+ *       (see 113).  Response = states (bits 0->31)
+ * 102 = change output (bits 0->31).  Response = new target output (0 for relays of modules which aren't fitted).
+ *       May be broadcast.
+ *       After replying, the slave changes the relays to the target in steps (see 105), while still answering commands;
+ *       a new target can be sent at any time.  Poll with 101 to see when the outputs have settled.
+ * 103 = multicast change output: byte 0 = output for slave BYTEID, byte 1 = output for BYTEID+1, etc.  No response.
+ *       Only changes relays 0->7 of each slave.
+ * 104 = change bus speed: byte 0 = speed code; 0 = 4800 baud, 1 = 9600, 2 = 19200, 3 = 38400.  Response = repeat speed code,
+ *       sent at the old speed.  May be broadcast.  If the slave sees no valid frames on the bus (for any slave) for
+ *       20 seconds at the new speed, it falls back to 4800 baud.
+ * 105 = relay transition settings: byte 0 = most relays to switch at once (1 - 8), byte 1 = settle time after each
+ *       switch in 50 ms units (1 - 255).  Response = repeat settings.  May be broadcast.  Default 1 relay, 500 ms.
+ * 106 = relay module output mode: byte 0 = 0 for slow (long cables to the relay module), 1 for fast (default).
+ *       Response = repeat mode.  May be broadcast.
+ * 107 = relay output benchmark: byte 0 = number of times to write and latch the relay module (1 - 250), before
+ *       replying.  Only allowed while all the relays are off.  Response = byte 0 = repeat count, byte 1 = output mode.
+ *       The master times the reply against a command 100 reply to get the time per write and latch (see RelayBench.h).
+ * 108 = turnaround: byte 0 = pause before replying in ms (0 - 255, default 100), byte 1 = pause after switching the
+ *       RS485 driver in ms (0 - 20, default 5).  Response = repeat settings, sent with the old settings.  May be broadcast.
+ *       See Turnaround.h for tuning.
+ * 109 = set relays: the relays in the mask (bits 0->31) are turned on, the others are left as they are.
+ * 110 = clear relays: the relays in the mask are turned off.
+ * 111 = toggle relays: the relays in the mask are switched over.
+ *       109 - 111 change the target states on the slave in one step, so there is no need to read the output first and
+ *       nothing is lost if another command changes other relays in between.  Response = the new target states.
+ *       May be broadcast.
+ * 112 = time beacon: bytes 0, 1 = bus tick (100 ms units, rolling over).  Broadcast only.  Applies the staged target
+ *       states if they are armed for this tick or an earlier one (up to 32767 ticks earlier).
+ * 113 = stage target: the target states to apply later (bits 0->31).  Disarms any staged states.
+ *       Response = staged states (0 for relays of modules which aren't fitted).  May be broadcast.
+ * 114 = arm staged target: bytes 0, 1 = the bus tick at which to apply it.  Response = repeat tick.  May be broadcast.
+ *       Staging and arming ahead of time keeps the frames off the critical path, and all the slaves armed for the
+ *       same tick switch together, on the same beacon.
  * 
  */
 
@@ -1,14 +1,119 @@
 #ifndef SLAVECOMMS_H
 #define SLAVECOMMS_H
+#include <Arduino.h>
+#include "BusTransport.h"
+
+// byte ids and commands used on the bus - see the protocol description at the end of SlaveComms.cpp
+const unsigned char BROADCAST_BYTEID = '*';
+const unsigned char COMMAND_ALIVE = 100;
+const unsigned char COMMAND_CURRENT_OUTPUT = 101;
+const unsigned char COMMAND_CHANGE_OUTPUT = 102;
+const unsigned char COMMAND_MULTICAST_OUTPUT = 103;
+const unsigned char COMMAND_SET_BUS_SPEED = 104;
+const unsigned char COMMAND_SET_RELAY_TRANSITION = 105;
+const unsigned char COMMAND_SET_RELAY_OUTPUT_MODE = 106;
+const unsigned char COMMAND_RELAY_BENCH = 107;
+const unsigned char COMMAND_SET_TURNAROUND = 108;
+const unsigned char COMMAND_SET_RELAYS = 109;
+const unsigned char COMMAND_CLEAR_RELAYS = 110;
+const unsigned char COMMAND_TOGGLE_RELAYS = 111;
+const unsigned char COMMAND_TIME_BEACON = 112;
+const unsigned char COMMAND_STAGE_OUTPUT = 113;
+const unsigned char COMMAND_ARM_STAGED_OUTPUT = 114;
+const unsigned char COMMAND_INVALID_REPLY = 255;
+const byte MULTICAST_GROUP_SIZE = 4;
+
+// the master sends version 2 frames, which carry a sequence number: the slave recognises a repeated request by it and
+//   repeats its last reply instead of acting on the request again
+const byte NO_SEQUENCE = 0;   // the slave always acts on the frame
+
+// relay n of a slave is bit n of the output commands (up to 32 relays, on daisy-chained relay modules)
+const byte MAX_RELAYS = 32;
+
+// COMMAND_CURRENT_OUTPUT: byte 0 = which states to report
+const byte OUTPUT_CURRENT_STATES = 0;
+const byte OUTPUT_TARGET_STATES = 1;
+const byte OUTPUT_STAGED_STATES = 2;
+
+// COMMAND_TIME_BEACON and COMMAND_ARM_STAGED_OUTPUT: bytes 0, 1 = bus tick (see TimeSync.h)
+const unsigned int BUS_TICK_MS = 100;
+
+// bus speed code n (for COMMAND_SET_BUS_SPEED) = BUS_BASE_BAUD_RATE * 2^n
+const unsigned long BUS_BASE_BAUD_RATE = 4800;
+const byte MAX_BUS_SPEED_CODE = 3;
+
+// COMMAND_SET_RELAY_TRANSITION: byte 0 = most relays switched at once, byte 1 = settle time after each switch in ticks
+const byte MAX_RELAYS_AT_ONCE = 8;
+const unsigned int RELAY_SETTLE_TICK_MS = 50;
+
+// COMMAND_SET_RELAY_OUTPUT_MODE: how the slave writes to its relay module
+const byte RELAY_OUTPUT_SLOW = 0;   // 5 ms per clock edge, for long cables: about 100 ms per write and latch
+const byte RELAY_OUTPUT_FAST = 1;
+const unsigned int RELAY_SLOW_WRITE_MS = 100;
+const byte MAX_RELAY_BENCH_REPETITIONS = 250;
+
+// COMMAND_SET_TURNAROUND: byte 0 = slave's pause before replying (ms), byte 1 = pause after switching its RS485 driver (ms)
+const byte DEFAULT_REPLY_DELAY_MS = 100;
+const byte DEFAULT_DRIVER_SWITCH_DELAY_MS = 5;
+const byte MAX_DRIVER_SWITCH_DELAY_MS = 20;
+
+// returns false for frames which the slaves act on silently (broadcast and multicast)
+bool commandExpectsReply(unsigned char byteid, unsigned char bytecommand);
+
+// true for the commands which change the target states of the relays (102, 103, 109 - 111)
+bool commandChangesOutputs(unsigned char bytecommand);
+
+// true for the commands which stage a change of the target states, or apply it (112 - 114)
+bool commandStagesOutputs(unsigned char bytecommand);
+
+// true for COMMAND_SET_RELAYS, COMMAND_CLEAR_RELAYS and COMMAND_TOGGLE_RELAYS
+bool isRelayMaskCommand(unsigned char bytecommand);
+
+// the target states after the slave applies the relay mask command to states (as the slave does it)
+unsigned long applyRelayMask(unsigned char bytecommand, unsigned long states, unsigned long mask);
+
+// a reply received from a slave: %{BYTEID}{BYTECOMMAND}{DWORDSTATUS}{SEQUENCE}{CRC16}, or &{...} if replayed
+//   (or version 1: ${BYTEID}{BYTECOMMAND}{DWORDSTATUS}{CRC16})
+struct SlaveReply {
+  unsigned char byteid;
+  unsigned char bytecommand;
+  unsigned long dwordstatus;
+  byte sequence;                 // NO_SEQUENCE for version 1 replies
+  bool replayed;                 // the slave had already acted on the request, and repeated the reply it sent then
+};
+
+// called by tickSlaveComms for each valid reply (CRC ok) received from a slave
+typedef void (*SlaveReplyCallback)(const SlaveReply &reply);
 
 void setupSlaveComms();
+
+// call frequently; processes all bytes which have arrived from the bus since the last tick
 void tickSlaveComms();
 
-bool sendCommand(unsigned char byteid, unsigned char bytecommand, unsigned long dwordparameter);
-bool sendCommandTestChar(); //for testing only
+// send and receive using the given transport.  NULL = the default (SoftwareSerial)
+void setBusTransport(BusTransport *transport);
+BusTransport *getBusTransport();
 
-// calculate a CRC16 checksum of the given message
-unsigned short crc16(const unsigned char* data_p, unsigned char length);
+// change the baud rate of the transport (the slaves must be changed to match, see BusSpeed.h)
+void setBusBaudRate(unsigned long baud);
+unsigned long getBusBaudRate();
 
+// true while the transport is still sending the last frame
+bool busSending();
+
+// set the function to be called when a reply is received.  NULL = print the reply to the console
+void setSlaveReplyCallback(SlaveReplyCallback callback);
+
+// number of garbled replies received so far: CRC errors, partly-received replies, and bytes outside a reply
+//   (eg when two slaves reply at the same time)
+unsigned long rxGarbledCount();
+
+// print the receive statistics (errors etc) to dest
+void printSlaveCommsStats(Print &dest);
+
+// send a version 2 frame.  A frame sent again with the same sequence number (other than NO_SEQUENCE) is a repeat: if
+//   the slave received the first one, it doesn't act on it again
+bool sendCommand(unsigned char byteid, unsigned char bytecommand, unsigned long dwordparameter, byte sequence = NO_SEQUENCE);
+bool sendCommandTestChar(); //for testing only
 
 #endif
@@ -0,0 +1,199 @@
+#include <Arduino.h>
+#include "SlaveTable.h"
+#include "SlaveComms.h"
+#include "SystemStatus.h"
+
+SlaveRecord slaveTable[MAX_SLAVES];
+unsigned int dirtySlaves;
+
+void setupSlaveTable()
+{
+  for (int i = 0; i < MAX_SLAVES; ++i) {
+    slaveTable[i].inUse = false;
+  }
+  dirtySlaves = 0;
+}
+
+SlaveRecord *findSlave(unsigned char byteid)
+{
+  for (int i = 0; i < MAX_SLAVES; ++i) {
+    if (slaveTable[i].inUse && slaveTable[i].byteid == byteid) return &slaveTable[i];
+  }
+  return NULL;
+}
+
+SlaveRecord *addSlave(unsigned char byteid)
+{
+  SlaveRecord *existing = findSlave(byteid);
+  if (existing != NULL) return existing;
+  for (int i = 0; i < MAX_SLAVES; ++i) {
+    SlaveRecord &slave = slaveTable[i];
+    if (!slave.inUse) {
+      memset(&slave, 0, sizeof(slave));
+      slave.inUse = true;
+      slave.byteid = byteid;
+      slave.replyDelayms = DEFAULT_REPLY_DELAY_MS;
+      slave.minLatencyms = 0xFFFF;
+      markSlaveDirty(slave, true);   // its states aren't known yet
+      return &slave;
+    }
+  }
+  return NULL;
+}
+
+bool removeSlave(unsigned char byteid)
+{
+  SlaveRecord *slave = findSlave(byteid);
+  if (slave == NULL) return false;
+  slave->inUse = false;
+  markSlaveDirty(*slave, false);
+  return true;
+}
+
+byte slaveCount()
+{
+  byte count = 0;
+  for (int i = 0; i < MAX_SLAVES; ++i) {
+    if (slaveTable[i].inUse) ++count;
+  }
+  return count;
+}
+
+bool slaveDirty(const SlaveRecord &slave)
+{
+  return dirtySlaves & (1U << (&slave - slaveTable));
+}
+
+void markSlaveDirty(const SlaveRecord &slave, bool dirty)
+{
+  unsigned int bit = 1U << (&slave - slaveTable);
+  if (dirty) {
+    dirtySlaves |= bit;
+  } else {
+    dirtySlaves &= ~bit;
+  }
+}
+
+SlaveHealth slaveHealth(const SlaveRecord &slave)
+{
+  if (slave.consecutiveErrors >= OFFLINE_ERROR_COUNT) return SLAVE_OFFLINE;
+  if (slave.consecutiveErrors > 0) return SLAVE_ERRORS;
+  if (!slave.seen) return SLAVE_NOT_SEEN;
+  return SLAVE_HEALTHY;
+}
+
+bool slaveOutputsConfirmed(unsigned char byteid, unsigned long outputs)
+{
+  SlaveRecord *slave = findSlave(byteid);
+  return slave != NULL && !slaveDirty(*slave) && slave->targetStates == outputs;
+}
+
+void printSlaveStateLine(Print &dest, const SlaveRecord &slave, unsigned long timenow)
+{
+  dest.print(slave.byteid, HEX); dest.print(' ');
+  dest.print(slave.currentStates, HEX); dest.print(' ');
+  dest.print(slave.targetStates, HEX); dest.print(' ');
+  dest.print(slaveDirty(slave) ? F("changing ") : F("confirmed "));
+  if (slave.seen) {
+    dest.print(timenow - slave.lastSeenTime);
+  } else {
+    dest.print('-');
+  }
+  dest.print(' ');
+  switch (slaveHealth(slave)) {
+    case SLAVE_HEALTHY: dest.println(F("ok")); break;
+    case SLAVE_ERRORS: dest.println(F("errors")); break;
+    case SLAVE_OFFLINE: dest.println(F("offline")); break;
+    case SLAVE_NOT_SEEN: dest.println(F("not seen")); break;
+    default: dest.println(slaveHealth(slave)); break;
+  }
+}
+
+bool printSlaveStates(Print &dest, unsigned char byteid)
+{
+  unsigned long timenow = millis();
+  bool found = false;
+  for (int i = 0; i < MAX_SLAVES; ++i) {
+    const SlaveRecord &slave = slaveTable[i];
+    if (!slave.inUse || (byteid != BROADCAST_BYTEID && slave.byteid != byteid)) continue;
+    if (!found) dest.println(F("id current target state seen(ms ago) health"));
+    found = true;
+    printSlaveStateLine(dest, slave, timenow);
+  }
+  return found;
+}
+
+void recordSlaveLatency(unsigned char byteid, unsigned long latencyms)
+{
+  SlaveRecord *slave = findSlave(byteid);
+  if (slave == NULL) return;
+  slave->seen = true;
+  slave->lastSeenTime = millis();
+  unsigned int latency = (latencyms > 0xFFFF) ? 0xFFFF : latencyms;
+  slave->lastLatencyms = latency;
+  if (latency < slave->minLatencyms) slave->minLatencyms = latency;
+  if (latency > slave->maxLatencyms) slave->maxLatencyms = latency;
+}
+
+void recordOutputCommand(const Transaction &transaction)
+{
+  if (transaction.bytecommand == COMMAND_MULTICAST_OUTPUT) {
+    for (byte i = 0; i < MULTICAST_GROUP_SIZE; ++i) {
+      SlaveRecord *slave = findSlave(transaction.byteid + i);
+      if (slave == NULL) continue;
+      slave->targetStates = (slave->targetStates & ~0xFFUL) | ((transaction.dwordparameter >> (8 * i)) & 0xFF);
+      if (slave->targetStates != slave->currentStates) markSlaveDirty(*slave, true);
+    }
+    return;
+  }
+  // a broadcast gets no reply, so the new states are worked out from the parameter as the slaves do it
+  bool broadcast = (transaction.byteid == BROADCAST_BYTEID);
+  for (int i = 0; i < MAX_SLAVES; ++i) {
+    SlaveRecord &slave = slaveTable[i];
+    if (!slave.inUse || (!broadcast && slave.byteid != transaction.byteid)) continue;
+    switch (transaction.bytecommand) {
+      case COMMAND_CHANGE_OUTPUT: {
+        slave.targetStates = broadcast ? transaction.dwordparameter : transaction.dwordstatus;
+        break;
+      }
+      case COMMAND_SET_RELAYS:
+      case COMMAND_CLEAR_RELAYS:
+      case COMMAND_TOGGLE_RELAYS: {
+        slave.targetStates = broadcast ? applyRelayMask(transaction.bytecommand, slave.targetStates, transaction.dwordparameter)
+                                       : transaction.dwordstatus;
+        break;
+      }
+      case COMMAND_STAGE_OUTPUT: {
+        slave.stagedStates = broadcast ? transaction.dwordparameter : transaction.dwordstatus;
+        slave.stagedArmed = false;
+        break;
+      }
+      case COMMAND_ARM_STAGED_OUTPUT: {
+        slave.stagedTick = transaction.dwordparameter & 0xFFFF;
+        slave.stagedArmed = true;
+        break;
+      }
+      case COMMAND_TIME_BEACON: {
+        unsigned int tick = transaction.dwordparameter & 0xFFFF;
+        if (slave.stagedArmed && (int16_t)(uint16_t)(tick - slave.stagedTick) >= 0) {
+          slave.targetStates = slave.stagedStates;
+          slave.stagedArmed = false;
+        }
+        break;
+      }
+      default: {
+        assertFailureCode = ASSERT_INVALID_SWITCH;
+        break;
+      }
+    }
+    if (slave.targetStates != slave.currentStates) markSlaveDirty(slave, true);
+  }
+}
+
+void resetSlaveLatencies()
+{
+  for (int i = 0; i < MAX_SLAVES; ++i) {
+    slaveTable[i].minLatencyms = 0xFFFF;
+    slaveTable[i].maxLatencyms = 0;
+  }
+}
@@ -0,0 +1,91 @@
+#ifndef SLAVETABLE_H
+#define SLAVETABLE_H
+#include <Arduino.h>
+#include "BusTransactions.h"
+
+// The slaves which the master knows about, and what it knows about each one.
+// The table is also the cache of the slaves' relay states: the current states are confirmed by the poller's command
+//   101 reads, the target states follow the output commands which the master sends, so queries about what a slave is
+//   doing are answered from here without going on the bus.  Slaves whose target states aren't confirmed yet (they are
+//   still changing their relays, or haven't been read since the master started polling them) are marked in
+//   dirtySlaves; only those get their states read back often.  The cached target can hold relays which the slave
+//   doesn't have (a broadcast is worked out from its parameter), so if the current states stop changing short of it,
+//   the poller reads the slave's own target states again (see BusPoller.cpp).
+
+struct SlaveRecord {
+  bool inUse : 1;
+  bool seen : 1;                 // the slave has replied since it was added to the table
+  bool stagedArmed : 1;          // the staged states are armed for stagedTick
+  unsigned char byteid;
+
+  // polling
+  unsigned int pollIntervalms;
+  unsigned long nextPollTime;
+  unsigned char nextPollCommand;
+  byte nextPollStates;           // which states a command 101 poll asks for (OUTPUT_CURRENT_STATES etc)
+  byte consecutiveErrors;
+  unsigned long lastStatus;      // most recent reply to command 100
+  unsigned long lastSeenTime;    // millis() of the most recent reply from the slave
+  unsigned long confirmedTime;   // millis() of the most recent read of the current states
+  unsigned long currentStates;   // most recent reply to command 101 (relay n = bit n)
+  byte unchangedPolls;           // reads in a row which found the current states short of the target and unchanged
+  unsigned long targetStates;    // from command 101, and from the output commands sent to the slave
+  unsigned long stagedStates;    // from command 113, applied by the first time beacon at or after stagedTick once armed
+  unsigned int stagedTick;
+  unsigned long pollCount;
+  unsigned long errorCount;
+  byte lastSequence;             // of the last transaction sent to the slave (NO_SEQUENCE = none yet)
+
+  // turnaround (see Turnaround.h)
+  byte replyDelayms;             // the slave's pause before replying, as far as the master knows
+  unsigned int lastLatencyms;    // time from sending a command to receiving the reply
+  unsigned int minLatencyms;
+  unsigned int maxLatencyms;
+};
+
+const int MAX_SLAVES = 16;
+extern SlaveRecord slaveTable[MAX_SLAVES];
+
+// bit n = slaveTable[n] is dirty (so MAX_SLAVES can't be more than 16)
+extern unsigned int dirtySlaves;
+
+const byte OFFLINE_ERROR_COUNT = 8;   // after this many consecutive errors, assume the slave is missing
+
+enum SlaveHealth {SLAVE_HEALTHY = 0, SLAVE_ERRORS = 1, SLAVE_OFFLINE = 2, SLAVE_NOT_SEEN = 3};
+
+void setupSlaveTable();
+
+// returns the record for the given slave, or NULL if not found
+SlaveRecord *findSlave(unsigned char byteid);
+
+// add the slave to the table (if not already present).  Returns NULL if the table is full.
+SlaveRecord *addSlave(unsigned char byteid);
+
+// returns false if the slave wasn't in the table
+bool removeSlave(unsigned char byteid);
+
+byte slaveCount();
+
+bool slaveDirty(const SlaveRecord &slave);
+void markSlaveDirty(const SlaveRecord &slave, bool dirty);
+
+SlaveHealth slaveHealth(const SlaveRecord &slave);
+
+// true if the slave is known to have reached these target states already, so sending them again would be wasted
+bool slaveOutputsConfirmed(unsigned char byteid, unsigned long outputs);
+
+// print the cached states of the slave (BROADCAST_BYTEID = all slaves).  returns false if the slave isn't in the table
+bool printSlaveStates(Print &dest, unsigned char byteid);
+
+// called by BusTransactions for each reply received
+void recordSlaveLatency(unsigned char byteid, unsigned long latencyms);
+
+// called by BusTransactions for each output or staging command (102, 103, 109 - 114) which completes successfully: the
+//   target and staged states of the slaves it was sent to are updated, and the ones whose target states now differ
+//   from their current states are marked dirty
+void recordOutputCommand(const Transaction &transaction);
+
+// forget the latency measurements of all slaves (eg after changing their turnaround)
+void resetSlaveLatencies();
+
+#endif
@@ -12,8 +12,8 @@ Stream *consoleInput;
 
 void printDebugInfo(Print &dest)
 {
-  dest.print("Version:"); dest.println(RS485T_VERSION); 
-  dest.print("Last Assert Error:"); dest.println(assertFailureCode); 
+  dest.print(F("Version:")); dest.println(RS485T_VERSION); 
+  dest.print(F("Last Assert Error:")); dest.println(assertFailureCode); 
 }
 
 DigitalPin<LED_BUILTIN> pinStatusLED;
@@ -49,12 +49,35 @@ bool shutdownErrorsPresent()
   return false;
 }
 
+const int MAX_ERROR_CODE = ERRORCODE_PUMP_CONTROL + 16;
+byte errorFlags[(MAX_ERROR_CODE + 7) / 8];
+
+void setErrorFlag(byte errorcode)
+{
+  if (errorcode >= MAX_ERROR_CODE) {
+    assertFailureCode = ASSERT_INDEX_OUT_OF_BOUNDS;
+    return;
+  }
+  errorFlags[errorcode / 8] |= (1 << (errorcode % 8));
+}
+
+void clearErrorFlag(byte errorcode)
+{
+  if (errorcode >= MAX_ERROR_CODE) return;
+  errorFlags[errorcode / 8] &= ~(1 << (errorcode % 8));
+}
+
 void populateErrorStack()
 {
   errorStackIdx = 0;
   if (assertFailureCode != 0) {
     errorStack[errorStackIdx++] = ERRORCODE_ASSERT | assertFailureCode;
   }
+  for (int i = 0; i < MAX_ERROR_CODE && errorStackIdx < MAX_ERROR_DEPTH; ++i) {
+    if (errorFlags[i / 8] & (1 << (i % 8))) {
+      errorStack[errorStackIdx++] = i;
+    }
+  }
 }
 
 const byte PAUSE_BETWEEN_CODES = 8; // intervals of 250 ms
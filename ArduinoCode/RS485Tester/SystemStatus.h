@@ -15,12 +15,17 @@ void tickSystemStatus();
 
 void printDebugInfo(Print &dest);
 
+// errors which are shown on the status LED until they are cleared (errorcode = one of the ERRORCODE_ below, plus offset)
+void setErrorFlag(byte errorcode);
+void clearErrorFlag(byte errorcode);
+
 // assign numbers for each error code
 const byte ERRORCODE_PROBE = 16;   // leave space for NUMBER_OF_PROBES, ie 16 = probe 0, 17 = probe 1, etc
 const byte ERRORCODE_DATALOG = 32; // leave space for error codes
 const byte ERRORCODE_ASSERT = 48; // leave space for error codes
 const byte ERRORCODE_RTC = 64; // only takes up one slot
 const byte ERRORCODE_SOLAR_SENSOR = 65; // only takes up one slot
+const byte ERRORCODE_DUPLICATE_BYTEID = 66; // only takes up one slot
 const byte ERRORCODE_PUMP_CONTROL = 80; // leave space for up to 16
 
 // no error = steady on off     .#.#.#.#  
@@ -0,0 +1,95 @@
+#include <Arduino.h>
+#include "TimeSync.h"
+#include "BusTransactions.h"
+#include "BusPoller.h"
+#include "SlaveComms.h"
+
+const unsigned long TIME_BEACON_INTERVAL_MS = 10000;
+const byte MAX_ARMED_TICKS = 4;
+
+unsigned int busTick;
+unsigned long busTickTime;              // millis() at the start of busTick
+unsigned long lastBeaconTime;
+unsigned long beaconCount;
+unsigned int armedTicks[MAX_ARMED_TICKS];   // the ticks at which a beacon is due, in no particular order
+byte armedTickCount;
+
+void setupTimeSync()
+{
+  busTick = 0;
+  busTickTime = millis();
+  lastBeaconTime = busTickTime;
+  beaconCount = 0;
+  armedTickCount = 0;
+}
+
+unsigned int busTickNow()
+{
+  return busTick;
+}
+
+// true if tick is now or in the past (up to half the range of the bus tick ago)
+bool busTickDue(unsigned int tick)
+{
+  return (int16_t)(uint16_t)(busTick - tick) >= 0;
+}
+
+// the slave table has applied the staged states of the slaves armed for the beacon's tick: read them back
+void beaconSent(const Transaction &)
+{
+  pollDirtySlavesSoon();
+}
+
+// send the beacon as soon as an armed tick is due, otherwise at regular intervals
+void tickTimeSync()
+{
+  unsigned long timenow = millis();
+  while (timenow - busTickTime >= BUS_TICK_MS) {
+    ++busTick;
+    busTickTime += BUS_TICK_MS;
+  }
+
+  bool armedTickDue = false;
+  for (byte i = 0; i < armedTickCount; ++i) {
+    if (busTickDue(armedTicks[i])) armedTickDue = true;
+  }
+  if (!armedTickDue && timenow - lastBeaconTime < TIME_BEACON_INTERVAL_MS) return;
+  if (queueTransaction(BROADCAST_BYTEID, COMMAND_TIME_BEACON, busTick, beaconSent, NULL) == NO_TRANSACTION) return;  // try again next tick
+  lastBeaconTime = timenow;
+  ++beaconCount;
+  if (!armedTickDue) return;
+
+  byte kept = 0;
+  for (byte i = 0; i < armedTickCount; ++i) {
+    if (!busTickDue(armedTicks[i])) armedTicks[kept++] = armedTicks[i];
+  }
+  armedTickCount = kept;
+}
+
+int queueStageOutput(unsigned char byteid, unsigned long outputs, TransactionCallback callback, void *context)
+{
+  return queueTransaction(byteid, COMMAND_STAGE_OUTPUT, outputs, callback, context);
+}
+
+bool armStagedOutput(unsigned char byteid, unsigned int tick, TransactionCallback callback, void *context)
+{
+  byte idx = 0;
+  while (idx < armedTickCount && armedTicks[idx] != tick) ++idx;
+  if (idx >= MAX_ARMED_TICKS) return false;
+  if (queueTransaction(byteid, COMMAND_ARM_STAGED_OUTPUT, tick, callback, context) == NO_TRANSACTION) return false;
+  if (idx == armedTickCount) armedTicks[armedTickCount++] = tick;
+  return true;
+}
+
+void printTimeSync(Print &dest)
+{
+  dest.print(F("bus tick:")); dest.print(busTick);
+  dest.print(F(" beacons sent:")); dest.println(beaconCount);
+  dest.print(F("armed ticks:"));
+  if (armedTickCount == 0) dest.print(F(" none"));
+  for (byte i = 0; i < armedTickCount; ++i) {
+    dest.print(' '); dest.print(armedTicks[i]);
+    dest.print(F(" (in ")); dest.print((int16_t)(uint16_t)(armedTicks[i] - busTick) * (long)BUS_TICK_MS); dest.print(F(" ms)"));
+  }
+  dest.println();
+}
@@ -0,0 +1,30 @@
+#ifndef TIMESYNC_H
+#define TIMESYNC_H
+#include <Arduino.h>
+#include "BusTransactions.h"
+
+// Bus time, so that the slaves can switch their relays together.
+// The master counts the bus tick (BUS_TICK_MS units, 16 bits, rolling over every 109 minutes) and broadcasts it in a
+//   time beacon (command 112).  The slaves have no clock of their own: a beacon is the moment at which they apply
+//   target states which were staged (command 113) and armed for that tick or an earlier one (command 114).
+// The staging and arming are done ahead of time, each with its own frame, so the switching takes only the one beacon
+//   frame and all the armed slaves start changing their relays on it, instead of one slave after another.
+// A beacon is sent as soon as an armed tick is due, and otherwise every TIME_BEACON_INTERVAL_MS; a slave which missed
+//   the beacon for its tick applies its staged states on the next one.
+
+void setupTimeSync();
+void tickTimeSync();
+
+unsigned int busTickNow();
+
+// stage the target states of the slave (BROADCAST_BYTEID = all slaves); they aren't applied until armed
+int queueStageOutput(unsigned char byteid, unsigned long outputs, TransactionCallback callback, void *context);
+
+// arm the staged states of the slave (BROADCAST_BYTEID = all slaves) for the given bus tick, and send a beacon then.
+// returns false if the transaction queue is full or too many different ticks are already armed
+bool armStagedOutput(unsigned char byteid, unsigned int tick, TransactionCallback callback, void *context);
+
+// print the bus tick, the beacons sent and the ticks armed
+void printTimeSync(Print &dest);
+
+#endif
@@ -0,0 +1,198 @@
+#include <Arduino.h>
+#include "Turnaround.h"
+#include "BusTransactions.h"
+#include "BusPoller.h"
+#include "BusSpeed.h"
+#include "Discovery.h"
+#include "SlaveComms.h"
+#include "SlaveTable.h"
+#include "SystemStatus.h"
+
+const byte TUNING_DRIVER_SWITCH_DELAY_MS = 1;
+const byte TUNING_CHECK_FRAMES = 8;
+const byte TURNAROUND_MARGIN_MS = 2;
+
+enum TuningState {TUNING_IDLE, TUNING_CHECKING, TUNING_FINAL_CHECKING, TUNING_RESTORING};
+
+TuningState tuningState = TUNING_IDLE;
+bool tuningAllSlaves;
+int tuningSlaveIdx;
+unsigned char tuningByteid;
+int goodDelay;            // smallest reply delay which has passed the check
+int badDelay;             // largest reply delay which has failed the check, -1 = none yet
+byte candidateDelay;      // the reply delay being checked
+byte checkFrames;
+byte checkFailures;
+unsigned long checkLatencySum;
+unsigned long latencyBefore;   // mean latency at the starting reply delay
+
+void startNextTuningSlave();
+
+void tuningFinished()
+{
+  tuningState = TUNING_IDLE;
+  pausePolling(false);
+  pollSlaveSoon(BROADCAST_BYTEID);
+}
+
+void checkComplete(const Transaction &transaction);
+
+void queueCheckFrame()
+{
+  if (queueTransaction(tuningByteid, COMMAND_ALIVE, 0, checkComplete, NULL, 0) == NO_TRANSACTION) {
+    console->println(F("turnaround tuning failed: transaction queue full"));
+    tuningFinished();
+  }
+}
+
+void turnaroundSent(const Transaction &)
+{
+  // the reply to 108 uses the old turnaround, which may be one that failed, so the outcome is ignored: the check decides
+  checkFrames = 0;
+  checkFailures = 0;
+  checkLatencySum = 0;
+  if (tuningState == TUNING_RESTORING) {
+    startNextTuningSlave();
+    return;
+  }
+  queueCheckFrame();
+}
+
+// set the slave's turnaround, then check it (unless restoring the defaults)
+void setTurnaround(byte replyDelayms, byte driverSwitchDelayms)
+{
+  candidateDelay = replyDelayms;
+  unsigned long dwordparameter = replyDelayms | ((unsigned int)driverSwitchDelayms << 8);
+  if (queueTransaction(tuningByteid, COMMAND_SET_TURNAROUND, dwordparameter, turnaroundSent, NULL, 0) == NO_TRANSACTION) {
+    console->println(F("turnaround tuning failed: transaction queue full"));
+    tuningFinished();
+  }
+}
+
+void restoreDefaultTurnaround()
+{
+  console->print(F("id:")); console->print(tuningByteid, HEX); console->println(F(" turnaround tuning failed; back to the defaults"));
+  SlaveRecord *slave = findSlave(tuningByteid);
+  if (slave != NULL) slave->replyDelayms = DEFAULT_REPLY_DELAY_MS;
+  tuningState = TUNING_RESTORING;
+  setTurnaround(DEFAULT_REPLY_DELAY_MS, DEFAULT_DRIVER_SWITCH_DELAY_MS);
+}
+
+void checkComplete(const Transaction &transaction)
+{
+  ++checkFrames;
+  if (transaction.outcome == TXN_SUCCESS) {
+    checkLatencySum += transaction.latencyms;
+  } else {
+    ++checkFailures;
+  }
+  if (checkFailures == 0 && checkFrames < TUNING_CHECK_FRAMES) {
+    queueCheckFrame();
+    return;
+  }
+  bool passed = (checkFailures == 0);
+
+  if (tuningState == TUNING_FINAL_CHECKING) {
+    if (!passed) {
+      restoreDefaultTurnaround();
+      return;
+    }
+    SlaveRecord *slave = findSlave(tuningByteid);
+    console->print(F("id:")); console->print(tuningByteid, HEX);
+    console->print(F(" reply delay(ms):"));
+    console->print(slave == NULL ? DEFAULT_REPLY_DELAY_MS : slave->replyDelayms); console->print(F(" -> ")); console->print(candidateDelay);
+    console->print(F(" latency(ms):")); console->print(latencyBefore); console->print(F(" -> ")); console->println(checkLatencySum / checkFrames);
+    if (slave != NULL) slave->replyDelayms = candidateDelay;
+    startNextTuningSlave();
+    return;
+  }
+
+  if (passed) {
+    if (badDelay < 0 && goodDelay < 0) latencyBefore = checkLatencySum / checkFrames;
+    goodDelay = candidateDelay;
+  } else {
+    if (goodDelay < 0) {   // the slave doesn't work even at its starting reply delay
+      restoreDefaultTurnaround();
+      return;
+    }
+    badDelay = candidateDelay;
+  }
+  int nextDelay = (badDelay < 0) ? goodDelay / 2 : (badDelay + goodDelay) / 2;
+  if (nextDelay == goodDelay || nextDelay == badDelay) {
+    int finalDelay = goodDelay + ((badDelay < 0) ? 0 : TURNAROUND_MARGIN_MS);
+    tuningState = TUNING_FINAL_CHECKING;
+    setTurnaround((finalDelay > 255) ? 255 : finalDelay, TUNING_DRIVER_SWITCH_DELAY_MS);
+    return;
+  }
+  setTurnaround(nextDelay, TUNING_DRIVER_SWITCH_DELAY_MS);
+}
+
+void startTuningSlave(const SlaveRecord &slave)
+{
+  tuningByteid = slave.byteid;
+  goodDelay = -1;
+  badDelay = -1;
+  latencyBefore = 0;
+  tuningState = TUNING_CHECKING;
+  setTurnaround(slave.replyDelayms, TUNING_DRIVER_SWITCH_DELAY_MS);
+}
+
+void startNextTuningSlave()
+{
+  if (tuningAllSlaves) {
+    while (++tuningSlaveIdx < MAX_SLAVES) {
+      if (slaveTable[tuningSlaveIdx].inUse) {
+        startTuningSlave(slaveTable[tuningSlaveIdx]);
+        return;
+      }
+    }
+  }
+  tuningFinished();
+}
+
+bool startTurnaroundTuning(unsigned char byteid)
+{
+  if (tuningState != TUNING_IDLE || busSpeedChangeInProgress() || discoveryInProgress()
+      || slaveCount() == 0) return false;
+  tuningAllSlaves = (byteid == BROADCAST_BYTEID);
+  SlaveRecord *slave = NULL;
+  if (!tuningAllSlaves) {
+    slave = findSlave(byteid);
+    if (slave == NULL) return false;
+  }
+  pausePolling(true);
+  if (tuningAllSlaves) {
+    tuningSlaveIdx = -1;
+    startNextTuningSlave();
+  } else {
+    startTuningSlave(*slave);
+  }
+  return true;
+}
+
+bool turnaroundTuningInProgress()
+{
+  return tuningState != TUNING_IDLE;
+}
+
+void printTurnaround(Print &dest)
+{
+  dest.println(F("id replydelay(ms) latency(ms): last min max"));
+  for (int i = 0; i < MAX_SLAVES; ++i) {
+    SlaveRecord &slave = slaveTable[i];
+    if (!slave.inUse) continue;
+    dest.print(slave.byteid, HEX); dest.print(' ');
+    dest.print(slave.replyDelayms); dest.print(' ');
+    dest.print(slave.lastLatencyms); dest.print(' ');
+    if (slave.minLatencyms == 0xFFFF) {
+      dest.print('-');
+    } else {
+      dest.print(slave.minLatencyms);
+    }
+    dest.print(' ');
+    dest.println(slave.maxLatencyms);
+  }
+  if (tuningState != TUNING_IDLE) {
+    dest.print(F("tuning id:")); dest.println(tuningByteid, HEX);
+  }
+}
@@ -0,0 +1,22 @@
+#ifndef TURNAROUND_H
+#define TURNAROUND_H
+#include <Arduino.h>
+
+// Tunes each slave's turnaround (command 108: the pause before replying, and the pause after switching its RS485
+//   driver) down to the smallest value which works reliably, to cut the latency of every command.
+// For each slave: the driver switch delay is set to TUNING_DRIVER_SWITCH_DELAY_MS, then the reply delay is found by a
+//   binary search below the slave's current reply delay.  Each candidate is set with 108 then checked with several
+//   alive (100) commands without retries, all of which must be answered.  The slave is left at the smallest good
+//   reply delay plus a safety margin; if that doesn't check out either, it is put back to the defaults.
+// Polling is paused while tuning.  The latency of every reply is recorded in the slave table.
+
+// BROADCAST_BYTEID = tune all the slaves in the slave table, one after another.
+// returns false if the slave isn't in the slave table, or a tuning, bus speed change or discovery scan is in progress
+bool startTurnaroundTuning(unsigned char byteid);
+
+bool turnaroundTuningInProgress();
+
+// print the reply delay and the latencies of each slave
+void printTurnaround(Print &dest);
+
+#endif
@@ -1,6 +1,13 @@
+#picaxe 08M2
+' The 08M2 has 2048 bytes of program memory, and the compiler refuses a program which doesn't fit: check the "memory
+'   used" figure it reports after each change (Check Syntax in the editor, or picaxe08m2 -c RelayControlModule.bas)
 '
 ' the unique byte identifier for this device - change it to unique value before download!
 symbol MY_BYTEID = "A"
+' frames sent to this byte identifier are acted on by all devices, without replying
+symbol BROADCAST_BYTEID = "*"
+' the number of 8-relay modules daisy-chained on the relay data, clock and latch lines (1 - 4)
+symbol RELAY_BOARDS = 1
 
 ' hardware connections:
 ' C.0 = dual purpose: serial out (to RS485 chip), and data for Relay module
@@ -9,6 +16,8 @@ symbol MY_BYTEID = "A"
 '
 ' C.1 = clock for Relay module
 ' C.2 = latch for Relay module
+' Further relay modules are daisy-chained: the data out of each shift register goes to the data in of the next one, and
+'   the clock and latch lines are shared.  The first module (nearest the PICAXE) has relays 0-7, the next 8-15, etc.
 '
 ' C.3 = reprogram mode.  
 
@@ -32,45 +41,99 @@ symbol REPROGRAM_MODE_PIN = pinC.3
 '  C.0 = data inverse
 '  C.1 = rising clock edge to clock data in
 '  C.2 = falling latch edge to latch the output
+' With daisy-chained modules, the byte for the furthest module is sent first, and all are latched together.
 ' Due to limited pin count, the serout and Relay module Data are combined:
 '   Ensure to disable serial out (C.4) before manipulating Data for the Relay module
 ' To change the relay value, briefly (ZZ ms) set C.2 to 0.
 '
-' b0 = target relay states (1 bit per relay)
-' b1 = current relay states
-' b2 = reserved for sendbyte and sendbit
+' b0 = 1 while the current relay states differ from the target states
+' b1 = reserved for transitionstep, comparerelays, settarget, cmd107, cmdmask, cmd113, timebeacon, calculatecrc16 and
+'      the multicast offset
+' b2 = reserved for sendbyte, sendbit and transitionstep
 ' b3 = reserved for sendbyte
-' b4 = reserved for sendbyte
-' b5 = reserved for changestates
-' b6 = reserved for changestates
+' b4 = reserved for sendrelaystates, transitionstep, comparerelays, settarget, cmdmask, cmd113 and timebeacon
+' b5 = reserved for transitionstep and cmd107
+' b6 = reserved for sendbyte and transitionstep
 ' b7 = send/receive mode (0 = receive, 1 = send)
 
-symbol relayTargetStates = b0
-symbol relayCurrentStates = b1
+symbol relaysChanging = b0
 symbol rs485Mode = b7
 symbol relayByteToSend = b3
 symbol crc16value = w4					' crc16 value calculation
 symbol crc16valueLo = b8
 symbol crc16valueHi = b9
 
-symbol inputAttentionByte = b16
-symbol INPUT_BUFFER_BPTR = 18
-symbol inputByteId = b18
-symbol inputByteCommand = b19
-symbol inputParameterB0 = b20
-symbol inputParameterB1 = b21
-symbol inputParameterB2 = b22
-symbol inputParameterB3 = b23
+symbol inputAttentionByte = b16  ' also says which frame version (see the protocol below), and is then set to the reply's
+symbol INPUT_BUFFER_BPTR = 17
+symbol inputByteId = b17
+symbol inputByteCommand = b18
+symbol INPUT_PARAMETER_BPTR = 19
+symbol inputParameterB0 = b19
+symbol inputParameterB1 = b20
+symbol inputParameterB2 = b21
+symbol inputParameterB3 = b22
+symbol inputSequence = b23    ' 0 for version 1 frames
 symbol inputCRCb0 = b24
 symbol inputCRCb1 = b25
-symbol INPUT_BUFFER_BASE_LENGTH = 6 ' number of bytes in the input buffer for crc16 calculation
+symbol INPUT_BUFFER_BASE_LENGTH = 6 ' number of bytes in the input buffer for crc16 calculation (7 for version 2)
 
 symbol errorcount1 = b10  '  (number of timeouts during serial receive)
 symbol errorcount2 = b11  ' (number of CRC16 errors during serial receive)
-symbol errorcount3 = b12  ' unused 
-symbol i = b13	'used by crc16
-symbol x = b14  'used by crc16
-symbol x2 = b15 'used by crc16
+symbol errorcount3 = b12  ' (number of repeated requests answered from the reply cache)
+symbol i = b13	'used by crc16, settleticks and elapsedms
+symbol x = b14  'used by crc16 and settleticks
+symbol x2 = b15 'used by crc16 and pausescaled
+symbol pauseTime = w13 ' parameter for pausescaled (b26, b27)
+
+' bus speed: command 104 changes the clock frequency, which sets the serial baud rate:
+'   m4 = 4800 baud, m8 = 9600, m16 = 19200, m32 = 38400.
+' pause and serrxd timeouts are in ms only at m4, so pauses go through pausescaled.
+' If no valid frame arrives for BUS_FALLBACK_TICKS at a higher speed, fall back to 4800 baud
+symbol BUS_SPEED_MULTIPLIER_RAM = 28  ' clock frequency / 4 MHz = 1, 2, 4, or 8
+symbol BUS_SILENT_TICKS_RAM = 29      ' time since the last valid frame on the bus (for any slave), in 1/8 seconds
+symbol BUS_FALLBACK_TICKS = 160       ' 20 seconds
+
+' relay transitions: the relays are changed from the current states to the target states in steps of up to
+'   COILS_AT_ONCE_RAM relays (to limit the inrush current), with a settle time after each step.
+' The bus is listened to in between steps, counting the settle time in ticks of TRANSITION_TICK_MS (command 105).
+' There is no free-running timer, so the time is added up from what the slave has been doing: a tick without any byte
+'   received, FRAME_MS for each frame or reply heard (whoever it is for), and the pause before each reply.  Short gaps
+'   between frames aren't counted, so on a busy bus the settle time comes out a little longer than set, never shorter
+symbol COILS_AT_ONCE_RAM = 30         ' most relays switched in one step, 1 - 8
+symbol SETTLE_TICKS_RAM = 31          ' settle time after each step, in ticks
+symbol SETTLE_REMAINING_RAM = 32      ' ticks left before the next step
+symbol TRANSITION_TICK_MS = 50
+symbol SETTLE_ELAPSED_MS_RAM = 63     ' time counted so far towards the next tick, in ms
+symbol FRAME_MS = 21                  ' a 10 byte frame at 4800 baud
+
+' relay module output mode (command 106): fast uses shiftout, with no pauses beyond what the shift register needs;
+'   slow pauses 5 ms on each clock edge and 10 ms on each latch edge, for long cables to the relay module
+symbol RELAY_OUTPUT_MODE_RAM = 33
+symbol RELAY_OUTPUT_SLOW = 0
+symbol RELAY_OUTPUT_FAST = 1
+
+' turnaround (command 108): the pause after a frame before replying, and the pause after switching the RS485 driver.
+'   The master tunes these down to the smallest values which work reliably for this slave
+symbol REPLY_DELAY_RAM = 34           ' ms
+symbol DRIVER_SWITCH_DELAY_RAM = 35   ' ms
+symbol DEFAULT_REPLY_DELAY = 100
+symbol DEFAULT_DRIVER_SWITCH_DELAY = 5
+
+' relay states, 1 bit per relay, 4 bytes each: relays 0-7 first.  The bytes for modules which aren't fitted stay 0
+symbol RELAY_TARGET_RAM = 36          ' 36 - 39
+symbol RELAY_CURRENT_RAM = 40         ' 40 - 43
+
+' reply cache: the last version 2 reply, and the sequence number and CRC16 of the request it answered.  If the master
+'   repeats the request (because the reply went missing), the reply is sent again without acting on the request again
+symbol REPLY_CACHE_RAM = 44           ' 44 - 52: {BYTEID}{BYTECOMMAND}{DWORDSTATUS}{SEQUENCE}{CRC16}
+symbol REPLY_CACHE_REQUEST_RAM = 53   ' 53 - 55: {SEQUENCE}{CRC16}
+
+' synchronised switching: a target can be staged (command 113) and armed (114) to be applied at a bus tick; the master
+'   broadcasts time beacons (112) with the bus tick, and the first beacon at or after that tick applies it.  All the
+'   modules armed for the same tick switch on the same beacon frame
+symbol STAGED_TARGET_RAM = 56         ' 56 - 59
+symbol STAGED_TICK_RAM = 60           ' 60 - 61 (word)
+symbol STAGED_ARMED_RAM = 62          ' 1 = apply the staged target at STAGED_TICK_RAM
 
 	pullup ON
   low RELAY_CLOCK
@@ -86,47 +149,142 @@ waitwhilereprogramming:
 	endif	 
 
 	disconnect
-  relayTargetStates = 0
-  relayCurrentStates = 0
+  bptr = RELAY_TARGET_RAM
+  for b4 = 1 to 8
+		@bptrinc = 0
+  next b4
+  relaysChanging = 0
   rs485Mode = 0
   errorcount1 = 0
+  poke BUS_SPEED_MULTIPLIER_RAM, 1
+  poke BUS_SILENT_TICKS_RAM, 0
+  poke COILS_AT_ONCE_RAM, 1
+  poke SETTLE_TICKS_RAM, 10
+  poke SETTLE_REMAINING_RAM, 0
+  poke SETTLE_ELAPSED_MS_RAM, 0
+  poke RELAY_OUTPUT_MODE_RAM, RELAY_OUTPUT_FAST
+  poke REPLY_DELAY_RAM, DEFAULT_REPLY_DELAY
+  poke DRIVER_SWITCH_DELAY_RAM, DEFAULT_DRIVER_SWITCH_DELAY
+  poke REPLY_CACHE_REQUEST_RAM, 0
+  poke STAGED_ARMED_RAM, 0
 	
-  relayByteToSend = 0
-  gosub sendrelaysbyte
+  gosub sendrelaystates
 	
 main:
 	goto waitforfirst
 	
-'  change from the current states (b1) to the target states (b0), one bit at a time, waiting 500ms between bit switches
-changestates:
-  if relayCurrentStates = relayTargetStates then 
+' take the next step of the transition from the current states to the target states: switch up to
+'   COILS_AT_ONCE_RAM of the relays which differ (highest relay first), write all the modules, then start the settle time
+transitionstep:
+  gosub comparerelays
+  if relaysChanging = 0 then 
 	  return
   endif
-  b5 = 128
-  do	
-		b6 = relayCurrentStates xor relayTargetStates
-		b6 = b6 and b5
-		if b6 <> 0 then
-	  	b3 = relayCurrentStates xor b5 	
-	  	gosub sendrelaysbyte
-			pause 50
-			gosub latchrelaysstate
-			pause 450
-		endif	
-		b5 = b5 / 2  
-  loop until b5 = 0
+  peek COILS_AT_ONCE_RAM, b2
+  b4 = RELAY_BOARDS
+  do
+		b4 = b4 - 1
+		bptr = RELAY_TARGET_RAM + b4
+		b6 = @bptr
+		bptr = RELAY_CURRENT_RAM + b4
+		b6 = b6 xor @bptr
+		b5 = 128
+		do while b5 <> 0 and b2 <> 0
+			b1 = b6 and b5
+			if b1 <> 0 then
+				@bptr = @bptr xor b5
+				b2 = b2 - 1
+			endif	
+			b5 = b5 / 2  
+		loop
+  loop until b4 = 0 or b2 = 0
+  gosub sendrelaystates
+  gosub latchrelaysstate
+  peek SETTLE_TICKS_RAM, x
+  poke SETTLE_REMAINING_RAM, x
+  gosub comparerelays
+  return
+
+' set relaysChanging to 1 if any current state differs from its target state, 0 otherwise
+comparerelays:
+  relaysChanging = 0
+  for b4 = 0 to 3
+		bptr = RELAY_TARGET_RAM + b4
+		b1 = @bptr
+		bptr = RELAY_CURRENT_RAM + b4
+		if b1 <> @bptr then
+			relaysChanging = 1
+		endif
+  next b4
+  return
+
+' copy the target states from the parameter bytes; the relays of modules which aren't fitted stay off
+settarget:
+  for b4 = 0 to 3
+		bptr = INPUT_PARAMETER_BPTR + b4
+		b1 = @bptr
+		if b4 >= RELAY_BOARDS then
+			b1 = 0
+		endif
+		bptr = RELAY_TARGET_RAM + b4
+		@bptr = b1
+  next b4
+  relaysChanging = 1
   return
+
+' i ticks of the settle time have passed; once the settle time is over, take the next step
+settleticks:
+	peek SETTLE_REMAINING_RAM, x
+	if x > i then
+		x = x - i
+	else
+		x = 0
+	end if
+	poke SETTLE_REMAINING_RAM, x
+	if x = 0 then
+		gosub transitionstep
+	end if
+	return
+
+' pauseTime ms have passed: count them towards the settle time, carrying any part of a tick over to the next call
+elapsedms:
+	if relaysChanging = 0 then
+		return
+	end if
+	peek SETTLE_ELAPSED_MS_RAM, i
+	pauseTime = pauseTime + i
+	i = pauseTime // TRANSITION_TICK_MS
+	poke SETTLE_ELAPSED_MS_RAM, i
+	i = pauseTime / TRANSITION_TICK_MS
+	gosub settleticks
+	return
   
+'  write the current states to the relay modules, the furthest along the chain first (latchrelaysstate outputs them)
+sendrelaystates:
+  b4 = RELAY_BOARDS
+  do
+		b4 = b4 - 1
+		bptr = RELAY_CURRENT_RAM + b4
+		relayByteToSend = @bptr
+		gosub sendrelaysbyte
+  loop until b4 = 0
+  return
+
 ' byte to send is in b3
 sendrelaysbyte:
   gosub rs485modeSetToRead
 
-  b1 = relayByteToSend
-  for b4 = 0 to 7
+  peek RELAY_OUTPUT_MODE_RAM, b2
+  if b2 = RELAY_OUTPUT_FAST then
+		b2 = relayByteToSend ^ $FF		' the data is inverted on its way to the relay module
+		shiftout RELAY_DATA, RELAY_CLOCK, LSBFirst_L, (b2)
+		return
+  endif
+  for b6 = 0 to 7
     b2 = relayByteToSend and 1
     gosub sendbit
     relayByteToSend = relayByteToSend / 2
-  next b4
+  next b6
   return
   
 ' bit to send is in b2
@@ -136,86 +294,353 @@ sendbit:
   else
 		high RELAY_DATA
   endif	
-  pause 5
+  pauseTime = 5
+  gosub pausescaled
   high RELAY_CLOCK
-  pause 5
+  pauseTime = 5
+  gosub pausescaled
   low RELAY_CLOCK
   return
   
 latchrelaysstate:
+  peek RELAY_OUTPUT_MODE_RAM, b2
+  if b2 = RELAY_OUTPUT_FAST then
+		low RELAY_LATCH
+		high RELAY_LATCH
+		return
+  endif
   low RELAY_LATCH
-	pause 10
+	pauseTime = 10
+	gosub pausescaled
 	high RELAY_LATCH
-	pause 10
+	pauseTime = 10
+	gosub pausescaled
 	return
 
 '/*
 ' * Protocol for communicating with slave device is:
 ' * 
-' * 1) Master sends !{BYTEID}{BYTECOMMAND}{DWORDCOMMANDPARAM}{CRC16} then releases bus and waits for reply
-' * 2) Slave waits at least 100 ms then responds ${BYTEID}{BYTECOMMAND}{DWORDSTATUS}{CRC16} then releases bus
+' * 1) Master sends #{BYTEID}{BYTECOMMAND}{DWORDCOMMANDPARAM}{SEQUENCE}{CRC16} then releases bus and waits for reply
+' * 2) Slave waits (100 ms by default, see 108) then responds %{BYTEID}{BYTECOMMAND}{DWORDSTATUS}{SEQUENCE}{CRC16} then
+' *    releases bus
+' * 
+' * The attention byte gives the frame version.  This is version 2; version 1 frames have no sequence number:
+' *   !{BYTEID}{BYTECOMMAND}{DWORDCOMMANDPARAM}{CRC16}, reply ${BYTEID}{BYTECOMMAND}{DWORDSTATUS}{CRC16}
+' * The CRC16 covers everything between the attention byte and the CRC.
+' * The master gives each command a new SEQUENCE (1 - 255, rolling over), and sends it again with the same SEQUENCE if no
+' * reply arrives.  The slave keeps its last reply: if the same request (SEQUENCE and CRC16) arrives again, the slave
+' * doesn't act on it again but repeats the reply with attention byte & instead of %, so that the master can tell that
+' * its request got through and the reply was lost.  SEQUENCE 0 = not repeated (always acted on).
+' * 
+' * Broadcast and multicast frames are acted on by all the addressed slaves, which don't reply:
+' * - a frame sent to BYTEID "*" is a broadcast to all slaves
+' * - command 103 is a multicast to the group of four slaves BYTEID, BYTEID+1, BYTEID+2, BYTEID+3.
+' * The master should poll the slaves afterwards to confirm the result.
 ' * 
 ' * Commands:
-' * 100 = are you alive?  Response = device status; byte0 = status (0=good), bytes 1, 2, 3 = errorcounts (debug)
+' * 100 = are you alive?  Response = device status; byte0 = status (0=good), bytes 1, 2 = errorcounts (debug),
+' *       byte 3 = number of repeated requests answered from the reply cache
 ' * 
-' * For solenoids:
-' * 101 = what is your current output?  Response = output (bits 0->7 = current states, bits 8->15 = target states)
-' * 102 = change output (bits 0->31).  Response = repeat target output
-' *       After sending a reply immediately, the code will then change the solenoids to match the target states
-' *       It won't be responsive to further commands during this time
+' * For solenoids (relay n = bit n, up to 32 relays on daisy-chained relay modules):
+' * 101 = what is your output?  byte 0 = 0 for the current states, 1 for the target states, 2 for the staged states
+' *       (see 113).  Response = states (bits 0->31)
+' * 102 = change output (bits 0->31).  Response = new target output (0 for relays of modules which aren't fitted).
+' *       May be broadcast.
+' *       After replying, the slave changes the solenoids to match the target states in steps (see 105), while still
+' *       answering commands; a new target can be sent at any time.  Poll with 101 to see when the outputs have settled.
+' * 103 = multicast change output: byte 0 = output for slave BYTEID, byte 1 = output for BYTEID+1, etc.  No response.
+' *       Only changes relays 0->7 of each slave.
+' * 104 = change bus speed: byte 0 = speed code; 0 = 4800 baud, 1 = 9600, 2 = 19200, 3 = 38400.  Response = repeat speed code,
+' *       sent at the old speed.  May be broadcast.  If the slave sees no valid frames on the bus (for any slave) for
+' *       20 seconds at the new speed, it falls back to 4800 baud.
+' * 105 = relay transition settings: byte 0 = most relays to switch at once (1 - 8), byte 1 = settle time after each
+' *       switch in 50 ms units (1 - 255).  Response = repeat settings.  May be broadcast.  Default 1 relay, 500 ms.
+' * 106 = relay module output mode: byte 0 = 0 for slow (long cables to the relay module), 1 for fast (default).
+' *       Response = repeat mode.  May be broadcast.
+' * 107 = relay output benchmark: byte 0 = number of times to write and latch the relay module (1 - 250), before
+' *       replying.  Only allowed while all the relays are off.  Response = byte 0 = repeat count, byte 1 = output mode.
+' *       The master times the reply against a command 100 reply to get the time per write and latch.
+' * 108 = turnaround: byte 0 = pause before replying in ms (0 - 255, default 100), byte 1 = pause after switching the
+' *       RS485 driver in ms (0 - 20, default 5).  Response = repeat settings, sent with the old settings.  May be broadcast.
+' * 109 = set relays: the relays in the mask (bits 0->31) are turned on, the others are left as they are.
+' * 110 = clear relays: the relays in the mask are turned off.
+' * 111 = toggle relays: the relays in the mask are switched over.
+' *       109 - 111 change the target states in one step, without the master having to read them first.
+' *       Response = the new target states.  May be broadcast.
+' * 112 = time beacon: bytes 0, 1 = bus tick (100 ms units, rolling over).  Broadcast only.  Applies the staged target
+' *       if it is armed for this tick or an earlier one (up to 32767 ticks earlier).
+' * 113 = stage target: the target states to apply later (bits 0->31).  Disarms any staged target.
+' *       Response = staged states (0 for relays of modules which aren't fitted).  May be broadcast.
+' * 114 = arm staged target: bytes 0, 1 = the bus tick at which to apply it.  Response = repeat tick.  May be broadcast.
+' *       Staging and arming ahead of time keeps the frames off the critical path, and all the modules armed for the
+' *       same tick switch together.
 ' * 
 ' * Response with bytecommand = 255 indicates parsing error / invalid command
 ' */
 
 waitforfirst:
-	gosub rs485modeSetToWrite
-	sertxd ("$")
-	goto waitforfirst
-	
 	gosub rs485modeSetToRead
-  serrxd inputAttentionByte 
+	if relaysChanging <> 0 then
+		peek BUS_SPEED_MULTIPLIER_RAM, x2
+		pauseTime = TRANSITION_TICK_MS * x2
+		serrxd [pauseTime, transitiontimeout], inputAttentionByte
+	else
+	  serrxd [1000, busidle], inputAttentionByte 
+	end if
 		
-	if inputAttentionByte <> "$" and inputAttentionByte <> "!" then goto waitforfirst
+	' the replies of other slaves are read in full too, so that their bytes aren't mistaken for attention bytes
   bptr = INPUT_BUFFER_BPTR
-  serrxd [1000, timeout],@bptrinc,@bptrinc,@bptrinc,@bptrinc,@bptrinc,@bptrinc,@bptrinc,@bptrinc 
+	if inputAttentionByte = "!" or inputAttentionByte = "$" then
+	  serrxd [1000, timeout],@bptrinc,@bptrinc,@bptrinc,@bptrinc,@bptrinc,@bptrinc,@bptrinc,@bptrinc 
+		inputCRCb1 = inputCRCb0
+		inputCRCb0 = inputSequence
+		inputSequence = 0
+	else if inputAttentionByte = "#" or inputAttentionByte = "%" or inputAttentionByte = "&" then
+	  serrxd [1000, timeout],@bptrinc,@bptrinc,@bptrinc,@bptrinc,@bptrinc,@bptrinc,@bptrinc,@bptrinc,@bptrinc 
+	else
+		goto waitforfirst
+	end if
 	' inputByteId  = {BYTEID}
 	' inputByteCommand  = {BYTECOMMAND}
 	' inputParameterB0  - inputParameterB3  = {DWORDCOMMANDPARAM}
+	' inputSequence = {SEQUENCE}
 	' inputCRCb0  - inputCRCb1  = {CRC16}
-	if inputAttentionByte <> "!" or inputByteId <> MY_BYTEID then goto waitforfirst
+	if inputAttentionByte <> "!" and inputAttentionByte <> "#" then goto otherframe
+	b1 = MY_BYTEID - inputByteId		' position of this device in a multicast group
+	if inputByteCommand = 103 and b1 > 3 then goto otherframe
+	if inputByteCommand <> 103 and inputByteId <> MY_BYTEID and inputByteId <> BROADCAST_BYTEID then goto otherframe
 	gosub checkcrc16
 	if crc16value <> 0 then
 		errorcount2 = errorcount2 + 1 MAX 250
-		goto waitforfirst
+		goto frameheard
+	end if
+	poke BUS_SILENT_TICKS_RAM, 0
+	if inputByteId = BROADCAST_BYTEID or inputByteCommand = 103 then goto silentcommand
+
+	' a repeat of the request which the cached reply answered?
+	if inputSequence <> 0 then
+		peek REPLY_CACHE_REQUEST_RAM, x, i, x2
+		if x = inputSequence and i = inputCRCb0 and x2 = inputCRCb1 then
+			inputAttentionByte = "&"
+		else
+			poke REPLY_CACHE_REQUEST_RAM, inputSequence, inputCRCb0, inputCRCb1
+		end if
 	end if
 
-	pause 100
-	if inputByteCommand = 100 then 
+	peek REPLY_DELAY_RAM, x2
+	pauseTime = x2
+	gosub pausescaled
+	if inputAttentionByte = "&" then
+		errorcount3 = errorcount3 + 1 MAX 250
+		for i = 0 to 8
+			bptr = REPLY_CACHE_RAM + i
+			x = @bptr
+			bptr = INPUT_BUFFER_BPTR + i
+			@bptr = x
+		next i
+		goto sendreply
+	else if inputByteCommand = 100 then 
 		gosub cmd100
 	else if inputByteCommand = 101 then
 		gosub cmd101
 	else if inputByteCommand = 102 then
 		gosub cmd102
+	else if inputByteCommand = 104 then
+		gosub cmd104
+	else if inputByteCommand = 105 then
+		gosub cmd105
+	else if inputByteCommand = 106 then
+		gosub cmd106
+	else if inputByteCommand = 107 then
+		gosub cmd107
+	else if inputByteCommand = 108 then
+		gosub cmd108
+	else if inputByteCommand >= 109 and inputByteCommand <= 111 then
+		gosub cmdmask
+	else if inputByteCommand = 113 then
+		gosub cmd113
+	else if inputByteCommand = 114 then
+		gosub cmd114
 	else
 		gosub cmdinvalid
 	end if
+	if inputAttentionByte = "!" then
+		inputAttentionByte = "$"
+	else
+		inputAttentionByte = "%"
+	end if
 	gosub calculatecrc16
+	if inputAttentionByte = "$" then
+		inputSequence = crc16valueLo		' version 1 has no sequence number: the CRC follows the dword
+		inputCRCb0 = crc16valueHi
+	else
+		inputCRCb0 = crc16valueLo
+		inputCRCb1 = crc16valueHi
+	end if
+sendreply:
 	gosub rs485modeSetToWrite
 	bptr = INPUT_BUFFER_BPTR
-	sertxd ("$",@bptrinc,@bptrinc,@bptrinc,@bptrinc,@bptrinc,@bptrinc,@bptrinc,@bptrinc)
+	if inputAttentionByte = "$" then
+		sertxd ("$",@bptrinc,@bptrinc,@bptrinc,@bptrinc,@bptrinc,@bptrinc,@bptrinc,@bptrinc)
+	else
+		sertxd (inputAttentionByte,@bptrinc,@bptrinc,@bptrinc,@bptrinc,@bptrinc,@bptrinc,@bptrinc,@bptrinc,@bptrinc)
+	end if
 	gosub rs485modeSetToRead
+	if inputAttentionByte = "&" then
+		goto replysent
+	else if inputAttentionByte = "%" and inputSequence <> 0 then
+		for i = 0 to 8
+			bptr = INPUT_BUFFER_BPTR + i
+			x = @bptr
+			bptr = REPLY_CACHE_RAM + i
+			@bptr = x
+		next i
+	end if
 	if inputByteCommand = 102 then
-		relayTargetStates = inputParameterB0
-		gosub changestates
+		gosub settarget
+	else if inputByteCommand = 104 then
+		gosub setbusspeed
+	else if inputByteCommand = 105 then
+		gosub settransition
+	else if inputByteCommand = 108 then
+		gosub setturnaround
 	end if
+replysent:
+	' the request, the pause and the reply count towards any settle time (and a new transition starts straight away)
+	peek BUS_SPEED_MULTIPLIER_RAM, x2
+	pauseTime = FRAME_MS * 2 / x2
+	peek REPLY_DELAY_RAM, i
+	pauseTime = pauseTime + i
+	gosub elapsedms
 	
 	goto waitforfirst	
 	
+	' broadcast or multicast: act on the command without replying
+silentcommand:
+	if inputByteCommand = 102 then
+		gosub settarget
+	else if inputByteCommand = 103 then
+		bptr = MY_BYTEID - inputByteId + INPUT_PARAMETER_BPTR
+		b1 = @bptr
+		poke RELAY_TARGET_RAM, b1
+		relaysChanging = 1
+	else if inputByteCommand >= 109 and inputByteCommand <= 111 then
+		gosub cmdmask
+	else if inputByteCommand = 112 then
+		gosub timebeacon
+	else
+		if inputByteCommand = 113 then
+			gosub cmd113
+		end if
+		if inputByteCommand = 114 then
+			gosub cmd114
+		end if
+		if inputByteCommand = 104 and inputParameterB0 <= 3 then
+			gosub setbusspeed
+		end if
+		if inputByteCommand = 105 then
+			gosub cmd105
+			if inputByteCommand = 105 then
+				gosub settransition
+			end if
+		end if
+		if inputByteCommand = 106 then
+			gosub cmd106
+		end if
+		if inputByteCommand = 108 then
+			gosub cmd108
+			if inputByteCommand = 108 then
+				gosub setturnaround
+			end if
+		end if
+	end if
+	goto frameheard
+
+	' a frame for another slave, or a slave's reply.  Above the base bus speed, a valid one shows that the bus is
+	'   still working at this speed even if this slave isn't being addressed (eg it isn't polled, or polling is paused
+	'   for a discovery scan), so it restarts the fallback count (see busidle).  The CRC is only checked there: at the
+	'   base speed the count isn't used, and checking every frame would take too long at 4 MHz
+otherframe:
+	peek BUS_SPEED_MULTIPLIER_RAM, x
+	if x > 1 then
+		gosub checkcrc16
+		if crc16value = 0 then
+			poke BUS_SILENT_TICKS_RAM, 0
+		end if
+	end if
+	' the time the frame took counts towards any settle time
+frameheard:
+	peek BUS_SPEED_MULTIPLIER_RAM, x2
+	pauseTime = FRAME_MS / x2
+	gosub elapsedms
+	goto waitforfirst
+
+	' no byte received for a tick while the relays are changing
+transitiontimeout:
+	pauseTime = TRANSITION_TICK_MS
+	gosub elapsedms
+	goto waitforfirst
+
+	' a frame stopped part way through
 timeout:
   errorcount1 = errorcount1 + 1 MAX 250
+	peek BUS_SPEED_MULTIPLIER_RAM, x2
+	pauseTime = 1000 / x2
+	gosub elapsedms
 	goto waitforfirst
+
+	' nothing received for 1000 ms at 4 MHz (less at higher frequencies, hence 8 / multiplier ticks)
+	' above the base bus speed, count the time since the last valid frame and fall back if the master has gone quiet
+busidle:
+	peek BUS_SPEED_MULTIPLIER_RAM, x
+	if x > 1 then
+		x2 = 8 / x
+		peek BUS_SILENT_TICKS_RAM, i
+		i = i + x2 MAX 250
+		poke BUS_SILENT_TICKS_RAM, i
+		if i >= BUS_FALLBACK_TICKS then
+			inputParameterB0 = 0
+			gosub setbusspeed
+		end if
+	end if
+	goto waitforfirst
+
+	' change the clock frequency (and hence baud rate) to match the speed code in inputParameterB0
+setbusspeed:
+	lookup inputParameterB0, (1, 2, 4, 8), x
+	poke BUS_SPEED_MULTIPLIER_RAM, x
+	poke BUS_SILENT_TICKS_RAM, 0
+	if inputParameterB0 = 0 then
+		setfreq m4
+	else if inputParameterB0 = 1 then
+		setfreq m8
+	else if inputParameterB0 = 2 then
+		setfreq m16
+	else
+		setfreq m32
+	end if
+	return
+
+	' store the transition settings from command 105
+settransition:
+	poke COILS_AT_ONCE_RAM, inputParameterB0
+	poke SETTLE_TICKS_RAM, inputParameterB1
+	return
+
+	' store the turnaround delays from command 108
+setturnaround:
+	poke REPLY_DELAY_RAM, inputParameterB0
+	poke DRIVER_SWITCH_DELAY_RAM, inputParameterB1
+	return
+
+	' pause for pauseTime ms regardless of the clock frequency
+pausescaled:
+	peek BUS_SPEED_MULTIPLIER_RAM, x2
+	pauseTime = pauseTime * x2
+	pause pauseTime
+	return
   
-	' calculate crc16 of the bytes in inputByteId,inputByteCommand, inputParameterB0  - inputParameterB3
+	' calculate crc16 of the bytes in inputByteId,inputByteCommand, inputParameterB0  - inputParameterB3 (and inputSequence)
 	' compare with inputCRCb0 - inputCRCb1
 	' if match: set crc16value to 0, otherwise non-zero
 checkcrc16:
@@ -225,6 +650,8 @@ checkcrc16:
 	return
 	
 	' calculate crc16 of the bytes in inputByteId,inputByteCommand, inputParameterB0  - inputParameterB3, store in crc16value
+	' version 2 frames and replies (see inputAttentionByte) include inputSequence as well
+	' (must give the same result as crc16() in the Arduino RS485 master, see Crc16.h)
 '	unsigned short crc16(const unsigned char* data_p, unsigned char length){
 '    unsigned char x;
 '    unsigned short crc = 0xFFFF;
@@ -237,8 +664,12 @@ checkcrc16:
 '  }
 calculatecrc16:
 	crc16value = $ffff
+	b1 = INPUT_BUFFER_BASE_LENGTH
+	if inputAttentionByte <> "!" and inputAttentionByte <> "$" then
+		b1 = b1 + 1
+	end if
 	bptr = INPUT_BUFFER_BPTR
-	for i = 1 to INPUT_BUFFER_BASE_LENGTH
+	for i = 1 to b1
 		x = @bptrinc					'x = crc >> 8 ^ *data_p++;
 		x = x ^ crc16valueHi  
 		x2 = x / 16						'x ^= x>>4;
@@ -262,16 +693,146 @@ cmd100:
 	inputParameterB3 = errorcount3
 	return
 	
-' * 101 = what is your current output?  Response = output (bits 0->7 = current states, bits 8->15 = target states)
+' * 101 = what is your output?  byte 0 = 0 current states, 1 target states, 2 staged states.  Response = states (bits 0->31)
 cmd101:
-	inputParameterB0 = relayCurrentStates
-	inputParameterB1 = relayTargetStates
+	if inputParameterB0 > 2 then
+		gosub cmdinvalid
+		return
+	end if
+	bptr = RELAY_CURRENT_RAM
+	if inputParameterB0 = 1 then
+		bptr = RELAY_TARGET_RAM
+	else if inputParameterB0 = 2 then
+		bptr = STAGED_TARGET_RAM
+	end if
+	inputParameterB0 = @bptrinc
+	inputParameterB1 = @bptrinc
+	inputParameterB2 = @bptrinc
+	inputParameterB3 = @bptr
+	return
+
+' * 102 = change output (bits 0->31).  Response = the target output as settarget stores it after the reply: the relays of
+'   modules which aren't fitted are 0
+cmd102:
+	for b4 = 0 to 3
+		if b4 >= RELAY_BOARDS then
+			bptr = INPUT_PARAMETER_BPTR + b4
+			@bptr = 0
+		end if
+	next b4
+	return
+
+' * 104 = change bus speed: byte 0 = speed code 0 - 3.  Response = repeat speed code; the speed changes after the response
+cmd104:
+	if inputParameterB0 > 3 then
+		gosub cmdinvalid
+	end if
+	return
+
+' * 105 = relay transition settings: byte 0 = relays at once (1 - 8), byte 1 = settle time (50 ms units, 1 - 255).  Response = repeat settings
+cmd105:
+	if inputParameterB0 = 0 or inputParameterB0 > 8 or inputParameterB1 = 0 then
+		gosub cmdinvalid
+	end if
+	return
+
+' * 106 = relay module output mode: byte 0 = 0 slow, 1 fast.  Response = repeat mode
+cmd106:
+	if inputParameterB0 > RELAY_OUTPUT_FAST then
+		gosub cmdinvalid
+	else
+		poke RELAY_OUTPUT_MODE_RAM, inputParameterB0
+	end if
+	return
+
+' * 107 = relay output benchmark: write and latch the relay module byte 0 times.  Response = count, output mode
+cmd107:
+	bptr = RELAY_TARGET_RAM
+	b1 = @bptrinc or @bptrinc or @bptrinc or @bptrinc or @bptrinc or @bptrinc or @bptrinc or @bptrinc
+	if b1 <> 0 or inputParameterB0 = 0 or inputParameterB0 > 250 then
+		gosub cmdinvalid
+		return
+	end if
+	for b5 = 1 to inputParameterB0
+		gosub sendrelaystates
+		gosub latchrelaysstate
+	next b5
+	peek RELAY_OUTPUT_MODE_RAM, inputParameterB1
 	inputParameterB2 = 0
 	inputParameterB3 = 0
 	return
 
-' * 102 = change output (bits 0->31).  Response = repeat target output
-cmd102:
+' * 108 = turnaround: byte 0 = reply delay ms, byte 1 = driver switch delay ms (0 - 20).  Response = repeat settings
+cmd108:
+	if inputParameterB1 > 20 then
+		gosub cmdinvalid
+	end if
+	return
+
+' * 109 - 111 = set, clear or toggle the target states of the relays in the mask (bits 0->31).  Response = new target states
+cmdmask:
+  for b4 = 0 to 3
+		bptr = RELAY_TARGET_RAM + b4
+		b1 = @bptr
+		bptr = INPUT_PARAMETER_BPTR + b4
+		if inputByteCommand = 109 then
+			b1 = b1 or @bptr
+		else if inputByteCommand = 110 then
+			b1 = b1 andnot @bptr
+		else
+			b1 = b1 xor @bptr
+		end if
+		if b4 >= RELAY_BOARDS then
+			b1 = 0
+		end if
+		@bptr = b1
+		bptr = RELAY_TARGET_RAM + b4
+		@bptr = b1
+  next b4
+  relaysChanging = 1
+  return
+
+' * 112 = time beacon: bytes 0, 1 = bus tick.  Apply the staged target if it is armed for this tick or earlier
+timebeacon:
+	peek STAGED_ARMED_RAM, x
+	if x = 0 then
+		return
+	end if
+	peek STAGED_TICK_RAM, word crc16value
+	crc16value = inputParameterB1 * 256 + inputParameterB0 - crc16value		' ticks since the armed tick, rolling over
+	if crc16value >= 32768 then
+		return
+	end if
+	for b4 = 0 to 3
+		bptr = STAGED_TARGET_RAM + b4
+		b1 = @bptr
+		bptr = RELAY_TARGET_RAM + b4
+		@bptr = b1
+	next b4
+	poke STAGED_ARMED_RAM, 0
+	relaysChanging = 1
+	return
+
+' * 113 = stage target (bits 0->31), to be applied by a time beacon once armed (114).  Response = staged states (the
+'   relays of modules which aren't fitted are 0)
+cmd113:
+	for b4 = 0 to 3
+		bptr = INPUT_PARAMETER_BPTR + b4
+		b1 = @bptr
+		if b4 >= RELAY_BOARDS then
+			b1 = 0
+		end if
+		@bptr = b1
+		bptr = STAGED_TARGET_RAM + b4
+		@bptr = b1
+	next b4
+	poke STAGED_ARMED_RAM, 0
+	return
+
+' * 114 = arm the staged target: bytes 0, 1 = bus tick at which to apply it.  Response = repeat tick
+cmd114:
+	poke STAGED_TICK_RAM, inputParameterB0, inputParameterB1
+	poke STAGED_ARMED_RAM, 1
 	return
 
 cmdinvalid:
@@ -282,7 +843,9 @@ rs485modeSetToRead:
   if rs485Mode = 1 then
 		rs485Mode = 0
 		low RS485_DIR
-		pause 5
+		peek DRIVER_SWITCH_DELAY_RAM, x2
+		pauseTime = x2
+		gosub pausescaled
 	endif
 	return
   
@@ -290,7 +853,9 @@ rs485modeSetToWrite:
   if rs485Mode = 0 then
 		rs485Mode = 1
 		high RS485_DIR
-		pause 5
+		peek DRIVER_SWITCH_DELAY_RAM, x2
+		pauseTime = x2
+		gosub pausescaled
 	endif
 	return
   